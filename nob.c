@@ -25,6 +25,8 @@ int main(int argc, char** argv) {
     mkdir_if_not_exists("build");
     cmd_append(&c, "clang", 
                    "src/main.c", "src/arena.c", "src/fs.c", "src/config.c", "src/error.c", "src/lexer.c", "src/parser.c", 
+                   "src/shrimp.c", "src/shrimp_x86_64.c", "src/shrimp_bytecode.c", "src/shrimp_text.c", "src/shrimp_pass.c",
+                   "src/shrimp_cfg.c", "src/shrimp_sccp.c", "src/shrimp_dce.c", "src/shrimp_copyprop.c", "src/shrimp_gvn.c", "src/shrimp_licm.c", "src/shrimp_strength.c", "src/shrimp_iv.c", "src/shrimp_scev.c", "src/shrimp_unroll.c", "src/shrimp_rotate.c", "src/shrimp_eval.c", "src/shrimp_algebra.c", "src/shrimp_simplify.c", "src/shrimp_layout.c", "src/shrimp_profile.c", "src/shrimp_range.c", "src/shrimp_inline.c", "src/shrimp_tailrec.c", "src/shrimp_unswitch.c",
                    "-o", "build/bongc", 
                    "-Wall", 
                    "-Wextra", 
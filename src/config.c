@@ -7,11 +7,36 @@
 static void help(const char* prog_name) {
     fprintf(stderr, "%s [OPTIONS] <input.bg>\n", prog_name);
     fprintf(stderr, "OPTIONS:\n");
-    fprintf(stderr, "  -help: Prints this help message");
+    fprintf(stderr, "  -help: Prints this help message\n");
+    fprintf(stderr, "  -ir: The input is textual Shrimp IR (as printed by bongc) instead of Bong source\n");
+    fprintf(stderr, "  -bc: The input is a Shrimp bytecode file instead of Bong source\n");
+    fprintf(stderr, "  -emit-bc <file>: Writes the optimized Shrimp IR as bytecode to <file>\n");
+    fprintf(stderr, "  -O0, -O1, -O2, -Os: Optimization level (default: -O1)\n");
+    fprintf(stderr, "  -passes=<a,[b,c],...>: Runs exactly these passes in this order, the ones in [] until nothing changes\n");
+    fprintf(stderr, "  -time-passes: Reports the time and instruction count change of every pass\n");
+    fprintf(stderr, "  -unroll-threshold=<n>: How many instructions a loop may grow to by unrolling it (default: 64)\n");
+    fprintf(stderr, "  -eval-fuel=<n>: How many instructions the program may run at compile time to be replaced by its result (default: 1048576)\n");
+    fprintf(stderr, "  -inline-threshold=<n>: How many instructions a function may have on top of its call to be inlined (default: 16)\n");
+    fprintf(stderr, "  -unswitch-threshold=<n>: How many instructions unswitching loops may add to a function (default: 64)\n");
+    fprintf(stderr, "  -fprofile-generate=<file>: Builds the program unoptimized with counters it writes to <file> when it exits\n");
+    fprintf(stderr, "  -fprofile-use=<file>: Optimizes with what a -fprofile-generate build of the same program wrote to <file>\n");
+}
+
+// Reads the number after `flag` (which ends in the `=`) in `arg`, it has to be a positive one
+static bool parse_positive_flag(const char* arg, const char* flag, size_t* out) {
+    char* end;
+    const char* value = arg + strlen(flag);
+    *out = strtoull(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || *out == 0) {
+        fprintf(stderr, "[ERROR]: %.*s expects a positive number, got `%s`\n", (int)strlen(flag) - 1, flag, value);
+        return false;
+    }
+    return true;
 }
 
 bool parse_config(int argc, char** argv, Config* out) {
     out->prog_name = *argv++; argc--;
+    out->opt_level = SHRIMP_O1;
     if (argc == 0) {
         fprintf(stderr, "[ERROR]: No flags/inputs/subcommands provided\n");
         help(out->prog_name);
@@ -21,6 +46,68 @@ bool parse_config(int argc, char** argv, Config* out) {
         if (strcmp(*argv, "-help") == 0) {
             help(out->prog_name);
             exit(0);
+        } else if (strcmp(*argv, "-O0") == 0) {
+            out->opt_level = SHRIMP_O0;
+            argv++; argc--;
+        } else if (strcmp(*argv, "-O1") == 0) {
+            out->opt_level = SHRIMP_O1;
+            argv++; argc--;
+        } else if (strcmp(*argv, "-O2") == 0) {
+            out->opt_level = SHRIMP_O2;
+            argv++; argc--;
+        } else if (strcmp(*argv, "-Os") == 0) {
+            out->opt_level = SHRIMP_OS;
+            argv++; argc--;
+        } else if (strncmp(*argv, "-passes=", strlen("-passes=")) == 0) {
+            out->passes = *argv + strlen("-passes=");
+            argv++; argc--;
+        } else if (strncmp(*argv, "-unroll-threshold=", strlen("-unroll-threshold=")) == 0) {
+            if (!parse_positive_flag(*argv, "-unroll-threshold=", &out->unroll_threshold)) {
+                help(out->prog_name);
+                return false;
+            }
+            argv++; argc--;
+        } else if (strncmp(*argv, "-eval-fuel=", strlen("-eval-fuel=")) == 0) {
+            if (!parse_positive_flag(*argv, "-eval-fuel=", &out->eval_fuel)) {
+                help(out->prog_name);
+                return false;
+            }
+            argv++; argc--;
+        } else if (strncmp(*argv, "-inline-threshold=", strlen("-inline-threshold=")) == 0) {
+            if (!parse_positive_flag(*argv, "-inline-threshold=", &out->inline_threshold)) {
+                help(out->prog_name);
+                return false;
+            }
+            argv++; argc--;
+        } else if (strncmp(*argv, "-unswitch-threshold=", strlen("-unswitch-threshold=")) == 0) {
+            if (!parse_positive_flag(*argv, "-unswitch-threshold=", &out->unswitch_threshold)) {
+                help(out->prog_name);
+                return false;
+            }
+            argv++; argc--;
+        } else if (strncmp(*argv, "-fprofile-generate=", strlen("-fprofile-generate=")) == 0) {
+            out->profile_generate = *argv + strlen("-fprofile-generate=");
+            argv++; argc--;
+        } else if (strncmp(*argv, "-fprofile-use=", strlen("-fprofile-use=")) == 0) {
+            out->profile_use = *argv + strlen("-fprofile-use=");
+            argv++; argc--;
+        } else if (strcmp(*argv, "-time-passes") == 0) {
+            out->time_passes = true;
+            argv++; argc--;
+        } else if (strcmp(*argv, "-ir") == 0) {
+            out->input_kind = INPUT_SHRIMP_IR;
+            argv++; argc--;
+        } else if (strcmp(*argv, "-bc") == 0) {
+            out->input_kind = INPUT_SHRIMP_BYTECODE;
+            argv++; argc--;
+        } else if (strcmp(*argv, "-emit-bc") == 0) {
+            argv++; argc--;
+            if (argc == 0) {
+                fprintf(stderr, "[ERROR]: -emit-bc expects an output path\n");
+                help(out->prog_name);
+                return false;
+            }
+            out->bytecode_output = *argv++; argc--;
         } else {
             if (**argv == '-') {
                 fprintf(stderr, "[ERROR]: Not known flag supplied\n");
@@ -35,5 +122,14 @@ bool parse_config(int argc, char** argv, Config* out) {
             }
         }
     }
+    if ((out->profile_generate != NULL && *out->profile_generate == '\0') || (out->profile_use != NULL && *out->profile_use == '\0')) {
+        fprintf(stderr, "[ERROR]: -fprofile-generate and -fprofile-use expect a file\n");
+        help(out->prog_name);
+        return false;
+    }
+    if (out->profile_generate != NULL && out->profile_use != NULL) {
+        fprintf(stderr, "[ERROR]: -fprofile-generate and -fprofile-use can't be used together\n");
+        return false;
+    }
     return true;
 }
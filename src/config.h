@@ -2,10 +2,28 @@
 #define CONFIG_H_
 
 #include <stdbool.h>
+#include "shrimp.h"
+
+typedef enum {
+    INPUT_BONG,
+    INPUT_SHRIMP_BYTECODE,
+    INPUT_SHRIMP_IR,
+} InputKind;
 
 typedef struct {
     const char* prog_name;
     const char* input;
+    InputKind input_kind;
+    const char* bytecode_output;
+    Shrimp_OptLevel opt_level;
+    const char* passes;
+    bool time_passes;
+    size_t unroll_threshold;
+    size_t eval_fuel;
+    size_t inline_threshold;
+    size_t unswitch_threshold;
+    const char* profile_generate;
+    const char* profile_use;
 } Config;
 
 bool parse_config(int argc, char** argv, Config* out);
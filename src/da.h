@@ -11,7 +11,7 @@
         (arr)->capacity *= 1.5; \
         void* old = (arr)->items; \
         (arr)->items = arena_alloc((arena), sizeof(*(arr)->items) * (arr)->capacity);\
-        memcpy((arr)->items, old, sizeof(*(arr)->items) * ((arr)->capacity / 1.5)); \
+        memcpy((arr)->items, old, sizeof(*(arr)->items) * (arr)->count); \
     }\
     (arr)->items[(arr)->count++] = (item);\
 } while (false)
@@ -40,6 +40,18 @@ void print_token(const Token* t) {
             fprintf(stderr, "Close curly");
             break;
         }
+        case TT_OPEN_PAREN: {
+            fprintf(stderr, "Open paren");
+            break;
+        }
+        case TT_CLOSE_PAREN: {
+            fprintf(stderr, "Close paren");
+            break;
+        }
+        case TT_COMMA: {
+            fprintf(stderr, "Comma");
+            break;
+        }
         case TT_OPERATOR: {
             switch (t->op) {
                 case OT_PLUS: fprintf(stderr, "Operator `+`"); break;
@@ -56,6 +68,8 @@ void print_token(const Token* t) {
                 case KT_RETURN: fprintf(stderr, "Keyword: return"); break;
                 case KT_IF: fprintf(stderr, "Keyword: if"); break;
                 case KT_WHILE: fprintf(stderr, "Keyword: while"); break;
+                case KT_FN: fprintf(stderr, "Keyword: fn"); break;
+                case KT_EXPORT: fprintf(stderr, "Keyword: export"); break;
                 case KT_NO: assert(false && "Unreachable this keyword is never produced"); break;
             }
             break;
@@ -135,6 +149,24 @@ bool lexer_run(Lexer* lexer, Tokens* out) {
             lexer_bump(lexer);
             continue;
         }
+        if (lexer_peek(lexer) == '(') {
+            Token t = {.type = TT_OPEN_PAREN, .offset = lexer->pos, .len = 1, .file = lexer->source};
+            da_push(out, t, lexer->arena);
+            lexer_bump(lexer);
+            continue;
+        }
+        if (lexer_peek(lexer) == ')') {
+            Token t = {.type = TT_CLOSE_PAREN, .offset = lexer->pos, .len = 1, .file = lexer->source};
+            da_push(out, t, lexer->arena);
+            lexer_bump(lexer);
+            continue;
+        }
+        if (lexer_peek(lexer) == ',') {
+            Token t = {.type = TT_COMMA, .offset = lexer->pos, .len = 1, .file = lexer->source};
+            da_push(out, t, lexer->arena);
+            lexer_bump(lexer);
+            continue;
+        }
         if (lexer_peek(lexer) == '<') {
             Token t = {.type = TT_OPERATOR, .op = OT_LT, .offset = lexer->pos, .len = 1, .file = lexer->source};
             da_push(out, t, lexer->arena);
@@ -197,6 +229,8 @@ static KeywordType lexer_to_kw(const char* pos, size_t len) {
     if (len == 6 && strncmp(pos, "return", 6) == 0) return KT_RETURN;
     if (len == 5 && strncmp(pos, "while", 5) == 0) return KT_WHILE;
     if (len == 2 && strncmp(pos, "if", 2) == 0) return KT_IF;
+    if (len == 2 && strncmp(pos, "fn", 2) == 0) return KT_FN;
+    if (len == 6 && strncmp(pos, "export", 6) == 0) return KT_EXPORT;
 
     return KT_NO;
 }
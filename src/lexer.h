@@ -17,6 +17,9 @@ typedef enum {
     TT_ASSIGN,
     TT_OPEN_CURLY,
     TT_CLOSE_CURLY,
+    TT_OPEN_PAREN,
+    TT_CLOSE_PAREN,
+    TT_COMMA,
 } TokenType;
 
 typedef enum {
@@ -33,6 +36,8 @@ typedef enum {
     KT_RETURN,
     KT_IF,
     KT_WHILE,
+    KT_FN,
+    KT_EXPORT,
 } KeywordType;
 
 
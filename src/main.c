@@ -16,219 +16,167 @@
 #include "config.h"
 #include "lexer.h"
 #include "parser.h"
+#include "shrimp.h"
 
-// ---- IR ----
-// This contains all of the logic that should be treated as external (since I'll probably make this a separate library)
-// for generating final executables or other target files
-// NO internal logic of Bong should be here
-// When moving it out the da_append macro will only be an internal thing for this library
-typedef enum {
-    SHRIMP_IT_ADD,
-    SHRIMP_IT_SUB,
-    SHRIMP_IT_MUL,
-    SHRIMP_IT_DIV,
-    SHRIMP_IT_JUMP,
-    SHRIMP_IT_LABEL,
-    SHRIMP_IT_CMP_LT,
-    SHRIMP_IT_CMP_MT,
-    SHRIMP_IT_ASSIGN,
-    SHRIMP_IT_RETURN,
-    SHRIMP_IT_JUMP_IF_NOT,
-} Shrimp_InstrType;
-
-typedef enum {
-    SHRIMP_VK_CONST,
-    SHRIMP_VK_TEMP,
-} Shrimp_ValueKind;
-
-typedef struct {
-    size_t index;
-    size_t size;
-    size_t offset;
-} Shrimp_Temp;
-
-typedef uint64_t Shrimp_Label;
-
-typedef struct {
-    Shrimp_ValueKind kind;
-    union {
-        uint64_t c;
-        Shrimp_Temp t;
-    };
-} Shrimp_Value;
-
-typedef struct {
-    Shrimp_InstrType t;
-    union {
-        Shrimp_Value ret;
-        struct {
-            Shrimp_Value v;
-            Shrimp_Temp into;
-        } assign;
-        struct {
-            Shrimp_Value l;
-            Shrimp_Value r;
-            Shrimp_Temp result;
-        } binop;
-        struct {
-            Shrimp_Value cond;
-            Shrimp_Label to;
-        } jmp_if_not;
-        struct {
-            Shrimp_Label to;
-        } jmp;
-        Shrimp_Label label;
-    };
-} Shrimp_Instr;
-
+// our internal shrimp usage
 typedef struct {
-    const char* name;
-    int64_t current_offset;
-    size_t last_allocated_size;
-    size_t temp_c;
-    Shrimp_Label label_count;
-    // body
-    size_t count;
-    size_t capacity;
-    Shrimp_Instr* items;
-} Shrimp_Function;
+    StringView name;
+    Shrimp_Value val;
+} NameIRValue;
 
 typedef struct {
+    NameIRValue* items;
     size_t count;
     size_t capacity;
-    Shrimp_Function* items;
-    const char* name;
-} Shrimp_Module;
-
-typedef enum {
-    SHRIMP_TARGET_X86_64_NASM_LINUX,
-    SHRIMP_TARGET_COUNT
-} Shrimp_Target;
-
-typedef enum {
-    SHRIMP_OUTPUT_ASM,
-    SHRIMP_OUTPUT_OBJ,
-    SHRIMP_OUTPUT_EXE,
-} Shrimp_OutputKind;
-
-typedef enum {
-    SHRIMP_OPT_NONE       = 0,
-    SHRIMP_OPT_CONST_FOLD = 1,
-    /* TODO
-    SHRIMP_OPT_DEAD_CODE  = 2,
-    SHRIMP_OPT_INLINE     = 4,
-    */
-} Shrimp_OptFlags;
-
-typedef struct {
-    Shrimp_Target target;
-    Shrimp_OutputKind output_kind;
-    Shrimp_OptFlags opts;
-    // TODO: bool emit_debug_info;
-    const char* output_name;
-} Shrimp_CompOptions;
-
-// user facing code (generating the IR)
-Shrimp_Module Shrimp_module_new(const char* name);
-void Shrimp_module_cleanup(Shrimp_Module mod);
-Shrimp_Function* Shrimp_module_new_function(Shrimp_Module* mod, const char* name);
-Shrimp_Label Shrimp_function_label_alloc(Shrimp_Function* func);
-void Shrimp_function_label_push(Shrimp_Function* func, Shrimp_Label label);
-void Shrimp_function_return(Shrimp_Function* func, Shrimp_Value value);
-Shrimp_Value Shrimp_function_add(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
-Shrimp_Value Shrimp_function_sub(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
-Shrimp_Value Shrimp_function_mul(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
-Shrimp_Value Shrimp_function_div(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
-Shrimp_Value Shrimp_function_cmp_lt(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
-Shrimp_Value Shrimp_function_cmp_mt(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
-void Shrimp_function_jump_if_not(Shrimp_Function* func, Shrimp_Value v, Shrimp_Label l);
-void Shrimp_function_jump(Shrimp_Function* func, Shrimp_Label l);
-Shrimp_Value Shrimp_function_alloc_temp(Shrimp_Function* func, size_t size);
-void Shrimp_function_assign_temp(Shrimp_Function* func, Shrimp_Value target, Shrimp_Value value);
-Shrimp_Value Shrimp_value_make_const(uint64_t num);
-
-void Shrimp_module_dump(FILE* file, Shrimp_Module mod);
-void Shrimp_value_dump(FILE* file, Shrimp_Value v);
-
-bool Shrimp_module_verify(const Shrimp_Module* mod);
-bool Shrimp_module_compile(Shrimp_Module* mod, Shrimp_CompOptions opts);
-void Shrimp_module_optimize(Shrimp_Module* mod, Shrimp_CompOptions opts);
-void Shrimp_module_const_fold(Shrimp_Module* mod);
-bool Shrimp_module_x86_64_nasm_linux_compile(const Shrimp_Module* mod, Shrimp_CompOptions opts);
-
-// codegen part ( TODO: add function to generate code according to the supported targets )
-bool Shrimp_module_x86_64_dump_nasm_mod(const Shrimp_Module* mod, FILE* file);
-void Shrimp_x86_64_nasm_mov_value_to_reg(const Shrimp_Value* value, const char* reg, FILE* out);
-
+} VariableLUT;
 
-// our internal shrimp usage
 typedef struct {
     StringView name;
-    Shrimp_Value val;
-} NameIRValue;
+    // index of the function in the module
+    uint32_t index;
+    size_t param_count;
+} NameFunction;
 
 typedef struct {
-    NameIRValue* items;
+    NameFunction* items;
     size_t count;
     size_t capacity;
-} VariableLUT;
+} FunctionLUT;
 
 void variableLUT_insert(VariableLUT* lut, StringView name, Shrimp_Value value, Arena* arena);
 NameIRValue* variableLUT_get(const VariableLUT* lut, StringView name);
+NameFunction* functionLUT_get(const FunctionLUT* lut, StringView name);
 
+bool generate_bong(const Config* c, Shrimp_Module* out, Arena* arena);
 bool generate_mod(Body* nodes, Shrimp_Module* out, Arena* arena);
-bool generate_statement(const Stmt* st, Shrimp_Function* out, VariableLUT* lut, Arena* arena);
-bool generate_expr(Shrimp_Value* out_value, const Expr* n, Shrimp_Function* out, const VariableLUT* lut);
+bool generate_fn(const Stmt* st, Shrimp_Module* out, const FunctionLUT* funcs, Arena* arena);
+bool generate_statement(const Stmt* st, Shrimp_Function* out, VariableLUT* lut, const FunctionLUT* funcs, Arena* arena);
+bool generate_expr(Shrimp_Value* out_value, const Expr* n, Shrimp_Function* out, const VariableLUT* lut, const FunctionLUT* funcs);
 
 
 int main(int argc, char** argv) {
     Arena arena = arena_new(1024 * 1024 * 8);
     Config c = {0};
     if (!parse_config(argc, argv, &c)) return false;
+    Shrimp_Module mod = {0};
+    switch (c.input_kind) {
+        case INPUT_BONG: {
+            if (!generate_bong(&c, &mod, &arena)) return 1;
+            break;
+        }
+        case INPUT_SHRIMP_BYTECODE: {
+            if (!Shrimp_module_map_bytecode(c.input, &mod)) return 1;
+            break;
+        }
+        case INPUT_SHRIMP_IR: {
+            SourceFile file = {0};
+            if (!read_entire_file(c.input, &file, &arena)) return 1;
+            if (!Shrimp_module_parse(c.input, file.content.items, file.content.count, &mod)) return 1;
+            break;
+        }
+    }
+    Shrimp_CompOptions opts = {
+        .target = SHRIMP_TARGET_X86_64_NASM_LINUX,
+        .opts = Shrimp_opt_level_flags(c.opt_level),
+        .passes = c.passes,
+        .time_passes = c.time_passes,
+        .unroll_threshold = c.unroll_threshold,
+        .eval_fuel = c.eval_fuel,
+        .inline_threshold = c.inline_threshold,
+        .unswitch_threshold = c.unswitch_threshold,
+        .profile_generate = c.profile_generate,
+        .profile_use = c.profile_use,
+        .output_kind = SHRIMP_OUTPUT_EXE,
+        .output_name = mod.name,
+        .bytecode_output = c.bytecode_output,
+    };
+    if (!Shrimp_module_compile(&mod, opts)) return false;
+    Shrimp_module_dump(stdout, mod);
+}
+
+bool generate_bong(const Config* c, Shrimp_Module* out, Arena* arena) {
     SourceFile file = {0};
-    if (!read_entire_file(c.input, &file, &arena)) return 1;
+    if (!read_entire_file(c->input, &file, arena)) return false;
     Lexer l = {
         .pos = 0,
         .source = &file,
-        .arena = &arena
+        .arena = arena
     };
     Tokens tokens = {0};
-    if (!lexer_run(&l, &tokens)) return 1;
+    if (!lexer_run(&l, &tokens)) return false;
     Parser p = {
-        .arena = &arena,
+        .arena = arena,
         .pos = 0,
         .source = &file,
         .tokens = &tokens,
     };
     Body nodes = {0};
-    if (!parser_parse(&p, &nodes)) return 1;
-    Shrimp_Module mod = Shrimp_module_new("main");
-    if (!generate_mod(&nodes, &mod, &arena)) return false;
-    Shrimp_CompOptions opts = {
-        .target = SHRIMP_TARGET_X86_64_NASM_LINUX,
-        .opts = SHRIMP_OPT_CONST_FOLD,
-        .output_kind = SHRIMP_OUTPUT_EXE,
-        .output_name = mod.name
-    };
-    if (!Shrimp_module_compile(&mod, opts)) return false;
-    Shrimp_module_dump(stdout, mod);
+    if (!parser_parse(&p, &nodes)) return false;
+    return generate_mod(&nodes, out, arena);
 }
 
 
 bool generate_mod(Body* nodes, Shrimp_Module* out, Arena* arena) {
     *out = Shrimp_module_new("main");
-    Shrimp_Function* main_func = Shrimp_module_new_function(out, "_start");
+    Shrimp_module_new_function(out, "_start");
+    // every function gets declared before any code is generated so calls can go to the ones defined further down
+    FunctionLUT funcs = {0};
+    for (size_t i = 0; i < nodes->count; i++) {
+        const Stmt* st = &nodes->items[i];
+        if (st->type != ST_FN) continue;
+        StringView name = st->fn.name;
+        if (functionLUT_get(&funcs, name) != NULL || (name.count == 6 && strncmp(name.items, "_start", 6) == 0)) {
+            fprintf(stderr, "[ERROR]: Function "STR_FMT" is defined more than once\n", STR_ARG(&name));
+            return false;
+        }
+        char* cname = arena_alloc(arena, name.count + 1);
+        memcpy(cname, name.items, name.count);
+        cname[name.count] = '\0';
+        NameFunction fn = {.name = name, .index = out->count, .param_count = st->fn.params.count};
+        Shrimp_Function* f = Shrimp_module_new_function(out, cname);
+        f->exported = st->fn.exported;
+        for (size_t p = 0; p < st->fn.params.count; p++) Shrimp_function_add_param(f);
+        da_push(&funcs, fn, arena);
+    }
+
     VariableLUT lut = {0};
-    for (size_t i = 0; i < nodes->count; i++) generate_statement(&nodes->items[i], main_func, &lut, arena);
+    for (size_t i = 0; i < nodes->count; i++) {
+        const Stmt* st = &nodes->items[i];
+        if (st->type == ST_FN) {
+            if (!generate_fn(st, out, &funcs, arena)) return false;
+            continue;
+        }
+        // the module doesn't get any new functions from here on, so the pointer stays good
+        if (!generate_statement(st, &out->items[0], &lut, &funcs, arena)) return false;
+    }
     if (!Shrimp_module_verify(out)) return false;
     return true;
 }
 
-bool generate_statement(const Stmt* st, Shrimp_Function* out, VariableLUT* lut, Arena* arena) {
+bool generate_fn(const Stmt* st, Shrimp_Module* out, const FunctionLUT* funcs, Arena* arena) {
+    Shrimp_Function* f = &out->items[functionLUT_get(funcs, st->fn.name)->index];
+    VariableLUT lut = {0};
+    for (size_t p = 0; p < st->fn.params.count; p++) {
+        if (variableLUT_get(&lut, st->fn.params.items[p]) != NULL) {
+            fprintf(stderr, "[ERROR]: Function "STR_FMT" has more than one param called "STR_FMT"\n", STR_ARG(&st->fn.name), STR_ARG(&st->fn.params.items[p]));
+            return false;
+        }
+        // params are the first temps of the function
+        variableLUT_insert(&lut, st->fn.params.items[p], (Shrimp_Value){.kind = SHRIMP_VK_TEMP, .t = p}, arena);
+    }
+    for (size_t i = 0; i < st->fn.body.count; i++) {
+        if (!generate_statement(&st->fn.body.items[i], f, &lut, funcs, arena)) return false;
+    }
+    // running off the end returns 0
+    Shrimp_function_return(f, Shrimp_value_make_const(0));
+    return true;
+}
+
+bool generate_statement(const Stmt* st, Shrimp_Function* out, VariableLUT* lut, const FunctionLUT* funcs, Arena* arena) {
     switch(st->type) {
         case ST_RET: {
             Shrimp_Value value;
-            if (!generate_expr(&value, &st->ret, out, lut)) return false;
+            if (!generate_expr(&value, &st->ret, out, lut, funcs)) return false;
             Shrimp_function_return(out, value);
             break;
         }
@@ -236,23 +184,31 @@ bool generate_statement(const Stmt* st, Shrimp_Function* out, VariableLUT* lut,
             NameIRValue var = {
                 .name = st->var_def.name,
             };
-            if (!generate_expr(&var.val, &st->var_def.value, out, lut)) return false;
+            if (!generate_expr(&var.val, &st->var_def.value, out, lut, funcs)) return false;
+            // `y := x` would otherwise share x's temp and see every later change of x
+            if (st->var_def.value.type == ET_ID) {
+                Shrimp_Value copy = Shrimp_function_alloc_temp(out, 8);
+                Shrimp_function_assign_temp(out, copy, var.val);
+                var.val = copy;
+            }
             da_push(lut, var, arena);
             break;
         }
         case ST_VAR_REASSIGN: {
             NameIRValue* var = variableLUT_get(lut, st->var_reassign.name);
             Shrimp_Value new = {0};
-            if (!generate_expr(&new, &st->var_reassign.value, out, lut)) return false;
+            if (!generate_expr(&new, &st->var_reassign.value, out, lut, funcs)) return false;
             Shrimp_function_assign_temp(out, var->val, new);
             break;
         }
         case ST_IF: {
             Shrimp_Label after = Shrimp_function_label_alloc(out);
             Shrimp_Value value;
-            if (!generate_expr(&value, &st->if_st.cond, out, lut)) return false;
+            if (!generate_expr(&value, &st->if_st.cond, out, lut, funcs)) return false;
             Shrimp_function_jump_if_not(out, value, after);
-            for (size_t j = 0; j < st->if_st.body.count; j++) generate_statement(&st->if_st.body.items[j], out, lut, arena);
+            for (size_t j = 0; j < st->if_st.body.count; j++) {
+                if (!generate_statement(&st->if_st.body.items[j], out, lut, funcs, arena)) return false;
+            }
             Shrimp_function_label_push(out, after);
             break;
         }
@@ -262,20 +218,23 @@ bool generate_statement(const Stmt* st, Shrimp_Function* out, VariableLUT* lut,
 
             Shrimp_function_label_push(out, condition);
             Shrimp_Value value;
-            if (!generate_expr(&value, &st->while_st.cond, out, lut)) return false;
+            if (!generate_expr(&value, &st->while_st.cond, out, lut, funcs)) return false;
             Shrimp_function_jump_if_not(out, value, after);
 
-            for (size_t j = 0; j < st->while_st.body.count; j++) generate_statement(&st->while_st.body.items[j], out, lut, arena);
+            for (size_t j = 0; j < st->while_st.body.count; j++) {
+                if (!generate_statement(&st->while_st.body.items[j], out, lut, funcs, arena)) return false;
+            }
 
             Shrimp_function_jump(out, condition);
             Shrimp_function_label_push(out, after);
             break;
         }
+        case ST_FN: assert(false && "Functions are only at the top level");
     }
     return true;
 }
 
-bool generate_expr(Shrimp_Value* out_value, const Expr* n, Shrimp_Function* out, const VariableLUT* lut) {
+bool generate_expr(Shrimp_Value* out_value, const Expr* n, Shrimp_Function* out, const VariableLUT* lut, const FunctionLUT* funcs) {
     switch (n->type) {
         case ET_NUMBER: {
             *out_value = Shrimp_function_alloc_temp(out, 8);
@@ -293,8 +252,8 @@ bool generate_expr(Shrimp_Value* out_value, const Expr* n, Shrimp_Function* out,
         }
         case ET_BIN: {
             Shrimp_Value l, r;
-            if (!generate_expr(&l, n->bin.l, out, lut)) return false;
-            if (!generate_expr(&r, n->bin.r, out, lut)) return false;
+            if (!generate_expr(&l, n->bin.l, out, lut, funcs)) return false;
+            if (!generate_expr(&r, n->bin.r, out, lut, funcs)) return false;
             switch (n->bin.op) {
                 case OT_PLUS: {
                     *out_value = Shrimp_function_add(out, l, r);
@@ -321,6 +280,29 @@ bool generate_expr(Shrimp_Value* out_value, const Expr* n, Shrimp_Function* out,
                     return true;
                 }
             }
+            return false;
+        }
+        case ET_CALL: {
+            NameFunction* fn = functionLUT_get(funcs, n->call.name);
+            if (fn == NULL) {
+                fprintf(stderr, "[ERROR]: Unknown function "STR_FMT" called\n", STR_ARG(&n->call.name));
+                return false;
+            }
+            if (fn->param_count != n->call.args.count) {
+                fprintf(stderr, "[ERROR]: Function "STR_FMT" takes %zu arguments but is called with %zu\n",
+                        STR_ARG(&n->call.name), fn->param_count, n->call.args.count);
+                return false;
+            }
+            Shrimp_Value* args = malloc(sizeof(Shrimp_Value) * (n->call.args.count + 1));
+            for (size_t i = 0; i < n->call.args.count; i++) {
+                if (!generate_expr(&args[i], &n->call.args.items[i], out, lut, funcs)) {
+                    free(args);
+                    return false;
+                }
+            }
+            *out_value = Shrimp_function_call(out, fn->index, args, n->call.args.count);
+            free(args);
+            return true;
         }
     }
     assert(false);
@@ -333,7 +315,7 @@ void variableLUT_insert(VariableLUT* lut, StringView name, Shrimp_Value value, A
     };
     da_push(lut, n, arena);
 }
-NameIRValue* variableLUT_get(const VariableLUT* lut, StringView name) {
+NameFunction* functionLUT_get(const FunctionLUT* lut, StringView name) {
     for (size_t i = 0; i < lut->count; i++) {
         if (name.count == lut->items[i].name.count && strncmp(name.items, lut->items[i].name.items, name.count) == 0) {
             return &lut->items[i];
@@ -342,792 +324,11 @@ NameIRValue* variableLUT_get(const VariableLUT* lut, StringView name) {
     return NULL;
 }
 
-#define SHRIMP_DA_INIT_CAP 16
-#define Shrimp_da_push(arr, item) do { \
-    if ((arr)->capacity == 0) {\
-        (arr)->capacity = DA_INIT_CAP;\
-        (arr)->items = malloc(sizeof(*(arr)->items) * (arr)->capacity);\
-    }\
-    if ((arr)->count >= (arr)->capacity) {\
-        (arr)->capacity *= 1.5; \
-        (arr)->items = realloc((arr)->items, (arr)->capacity); \
-    }\
-    (arr)->items[(arr)->count++] = (item);\
-} while (false)
-
-Shrimp_Module Shrimp_module_new(const char* name) {
-    return (Shrimp_Module){.name = name};
-}
-
-bool Shrimp_module_compile(Shrimp_Module* mod, Shrimp_CompOptions opts) {
-    if (!Shrimp_module_verify(mod)) return false;
-    if (opts.opts) Shrimp_module_optimize(mod, opts);
-    switch (opts.target) {
-        case SHRIMP_TARGET_X86_64_NASM_LINUX: return Shrimp_module_x86_64_nasm_linux_compile(mod, opts);
-        default: {
-            fprintf(stderr, "[ERROR]: Unknown target %d\n", opts.target);
-            return false;
-        }
-    }
-    return true;
-}
-
-void Shrimp_module_optimize(Shrimp_Module* mod, Shrimp_CompOptions opts) {
-    if (opts.opts & SHRIMP_OPT_CONST_FOLD) Shrimp_module_const_fold(mod);
-}
-
-typedef struct {
-    size_t idx;
-    uint64_t value;
-} IndexValuePair;
-
-typedef struct {
-    IndexValuePair* items;
-    size_t count;
-    size_t capacity;
-} IndexValuePairs;
-
-IndexValuePair* find_pair(const IndexValuePairs* pairs, Shrimp_Value value) {
-    if (value.kind == SHRIMP_VK_CONST) return NULL;
-    for (size_t i = 0; i < pairs->count; i++) {
-        if (pairs->items[i].idx == value.t.index) {
-            return &pairs->items[i];
-        }
-    }
-    return NULL;
-}
-
-void Shrimp_module_const_fold(Shrimp_Module* mod) {
-    for (size_t f_i = 0; f_i < mod->count; f_i++) {
-        Shrimp_Function* f = &mod->items[f_i];
-        IndexValuePairs pairs = {0};
-        for (size_t i_i = 0; i_i < f->count; i_i++) {
-            Shrimp_Instr* instr = &f->items[i_i];
-            switch (instr->t) {
-                case SHRIMP_IT_ASSIGN: {
-                    if (instr->assign.v.kind == SHRIMP_VK_CONST) {
-                        IndexValuePair p = {
-                            .idx = instr->assign.into.index,
-                            .value = instr->assign.v.c,
-                        };
-                        Shrimp_da_push(&pairs, p);
-                        break;
-                    }
-                    IndexValuePair* p = find_pair(&pairs, instr->assign.v);
-                    if (p && instr->assign.v.kind != SHRIMP_VK_CONST) {
-                        instr->assign.v = (Shrimp_Value) {
-                            .kind = SHRIMP_VK_CONST,
-                            .c = p->value
-                        };
-                    }
-                    break;
-                }
-                case SHRIMP_IT_RETURN: {
-                    IndexValuePair* p = find_pair(&pairs, instr->ret);
-                    if (p && instr->ret.kind != SHRIMP_VK_CONST) {
-                        instr->ret = (Shrimp_Value) {
-                            .kind = SHRIMP_VK_CONST,
-                            .c = p->value
-                        };
-                    }
-                    break;
-                }
-                case SHRIMP_IT_ADD: {
-                    bool l_const = instr->binop.l.kind == SHRIMP_VK_CONST;
-                    bool r_const = instr->binop.r.kind == SHRIMP_VK_CONST;
-
-                    IndexValuePair* l_pair = l_const ? NULL : find_pair(&pairs, instr->binop.l);
-                    IndexValuePair* r_pair = r_const ? NULL : find_pair(&pairs, instr->binop.r);
-
-                    const size_t* l_val = l_const ? &instr->binop.l.c : (l_pair ? &l_pair->value : NULL);
-                    const size_t* r_val = r_const ? &instr->binop.r.c : (r_pair ? &r_pair->value : NULL);
-
-                    if (l_val && r_val && instr->t != SHRIMP_IT_ASSIGN) {
-                        *instr = (Shrimp_Instr) {
-                            .t = SHRIMP_IT_ASSIGN,
-                            .assign = {
-                                .into = instr->binop.result,
-                                .v = {
-                                    .kind = SHRIMP_VK_CONST,
-                                    .c = *l_val + *r_val
-                                }
-                            }
-                        };
-                        IndexValuePair p =  {
-                            .value = *l_val + *r_val,
-                            .idx = instr->assign.into.index,
-                        };
-                        Shrimp_da_push(&pairs, p);
-                    }
-                    break;
-                }
-                case SHRIMP_IT_SUB: {
-                    bool l_const = instr->binop.l.kind == SHRIMP_VK_CONST;
-                    bool r_const = instr->binop.r.kind == SHRIMP_VK_CONST;
-
-                    IndexValuePair* l_pair = l_const ? NULL : find_pair(&pairs, instr->binop.l);
-                    IndexValuePair* r_pair = r_const ? NULL : find_pair(&pairs, instr->binop.r);
-
-                    const size_t* l_val = l_const ? &instr->binop.l.c : (l_pair ? &l_pair->value : NULL);
-                    const size_t* r_val = r_const ? &instr->binop.r.c : (r_pair ? &r_pair->value : NULL);
-
-                    if (l_val && r_val && instr->t != SHRIMP_IT_ASSIGN) {
-                        *instr = (Shrimp_Instr) {
-                            .t = SHRIMP_IT_ASSIGN,
-                            .assign = {
-                                .into = instr->binop.result,
-                                .v = {
-                                    .kind = SHRIMP_VK_CONST,
-                                    .c = *l_val - *r_val
-                                }
-                            }
-                        };
-                        IndexValuePair p =  {
-                            .value = *l_val - *r_val,
-                            .idx = instr->assign.into.index,
-                        };
-                        Shrimp_da_push(&pairs, p);
-                    }
-                    break;
-                }
-                case SHRIMP_IT_MUL: {
-                    bool l_const = instr->binop.l.kind == SHRIMP_VK_CONST;
-                    bool r_const = instr->binop.r.kind == SHRIMP_VK_CONST;
-
-                    IndexValuePair* l_pair = l_const ? NULL : find_pair(&pairs, instr->binop.l);
-                    IndexValuePair* r_pair = r_const ? NULL : find_pair(&pairs, instr->binop.r);
-
-                    const size_t* l_val = l_const ? &instr->binop.l.c : (l_pair ? &l_pair->value : NULL);
-                    const size_t* r_val = r_const ? &instr->binop.r.c : (r_pair ? &r_pair->value : NULL);
-
-                    if (l_val && r_val && instr->t != SHRIMP_IT_ASSIGN) {
-                        *instr = (Shrimp_Instr) {
-                            .t = SHRIMP_IT_ASSIGN,
-                            .assign = {
-                                .into = instr->binop.result,
-                                .v = {
-                                    .kind = SHRIMP_VK_CONST,
-                                    .c = *l_val * *r_val
-                                }
-                            }
-                        };
-                        IndexValuePair p =  {
-                            .value = *l_val * *r_val,
-                            .idx = instr->assign.into.index,
-                        };
-                        Shrimp_da_push(&pairs, p);
-                    }
-                    break;
-                }
-                case SHRIMP_IT_DIV: {
-                    bool l_const = instr->binop.l.kind == SHRIMP_VK_CONST;
-                    bool r_const = instr->binop.r.kind == SHRIMP_VK_CONST;
-
-                    IndexValuePair* l_pair = l_const ? NULL : find_pair(&pairs, instr->binop.l);
-                    IndexValuePair* r_pair = r_const ? NULL : find_pair(&pairs, instr->binop.r);
-
-                    const size_t* l_val = l_const ? &instr->binop.l.c : (l_pair ? &l_pair->value : NULL);
-                    const size_t* r_val = r_const ? &instr->binop.r.c : (r_pair ? &r_pair->value : NULL);
-
-                    if (l_val && r_val && instr->t != SHRIMP_IT_ASSIGN) {
-                        *instr = (Shrimp_Instr) {
-                            .t = SHRIMP_IT_ASSIGN,
-                            .assign = {
-                                .into = instr->binop.result,
-                                .v = {
-                                    .kind = SHRIMP_VK_CONST,
-                                    .c = *l_val / *r_val
-                                }
-                            }
-                        };
-                        IndexValuePair p =  {
-                            .value = *l_val / *r_val,
-                            .idx = instr->assign.into.index,
-                        };
-                        Shrimp_da_push(&pairs, p);
-                    }
-                    break;
-                }
-                case SHRIMP_IT_CMP_LT: {
-                    bool l_const = instr->binop.l.kind == SHRIMP_VK_CONST;
-                    bool r_const = instr->binop.r.kind == SHRIMP_VK_CONST;
-
-                    IndexValuePair* l_pair = l_const ? NULL : find_pair(&pairs, instr->binop.l);
-                    IndexValuePair* r_pair = r_const ? NULL : find_pair(&pairs, instr->binop.r);
-
-                    const size_t* l_val = l_const ? &instr->binop.l.c : (l_pair ? &l_pair->value : NULL);
-                    const size_t* r_val = r_const ? &instr->binop.r.c : (r_pair ? &r_pair->value : NULL);
-
-                    if (l_val && r_val && instr->t != SHRIMP_IT_ASSIGN) {
-                        *instr = (Shrimp_Instr) {
-                            .t = SHRIMP_IT_ASSIGN,
-                            .assign = {
-                                .into = instr->binop.result,
-                                .v = {
-                                    .kind = SHRIMP_VK_CONST,
-                                    .c = *l_val < *r_val
-                                }
-                            }
-                        };
-                        IndexValuePair p =  {
-                            .value = *l_val < *r_val,
-                            .idx = instr->assign.into.index,
-                        };
-                        Shrimp_da_push(&pairs, p);
-                    }
-                    break;
-                }
-                case SHRIMP_IT_CMP_MT: {
-                    bool l_const = instr->binop.l.kind == SHRIMP_VK_CONST;
-                    bool r_const = instr->binop.r.kind == SHRIMP_VK_CONST;
-
-                    IndexValuePair* l_pair = l_const ? NULL : find_pair(&pairs, instr->binop.l);
-                    IndexValuePair* r_pair = r_const ? NULL : find_pair(&pairs, instr->binop.r);
-
-                    const size_t* l_val = l_const ? &instr->binop.l.c : (l_pair ? &l_pair->value : NULL);
-                    const size_t* r_val = r_const ? &instr->binop.r.c : (r_pair ? &r_pair->value : NULL);
-
-                    if (l_val && r_val && instr->t != SHRIMP_IT_ASSIGN) {
-                        *instr = (Shrimp_Instr) {
-                            .t = SHRIMP_IT_ASSIGN,
-                            .assign = {
-                                .into = instr->binop.result,
-                                .v = {
-                                    .kind = SHRIMP_VK_CONST,
-                                    .c = *l_val > *r_val
-                                }
-                            }
-                        };
-                        IndexValuePair p =  {
-                            .value = *l_val > *r_val,
-                            .idx = instr->assign.into.index,
-                        };
-                        Shrimp_da_push(&pairs, p);
-                    }
-                    break;
-                }
-                case SHRIMP_IT_LABEL: {
-                    pairs.count = 0;
-                    break;
-                }
-                case SHRIMP_IT_JUMP: case SHRIMP_IT_JUMP_IF_NOT: break;
-                                                                                       
-            }
-        }
-    }
-}
-
-bool Shrimp_module_verify(const Shrimp_Module* mod) {
-    return true;
-}
-
-bool Shrimp_module_x86_64_nasm_linux_compile(const Shrimp_Module* mod, Shrimp_CompOptions opts) {
-    char asm_path[256] = {0};
-    char o_path[256] = {0};
-    snprintf(asm_path, sizeof(asm_path), "%s.asm", opts.output_name);
-    snprintf(o_path, sizeof(o_path), "%s.o", opts.output_name);
-
-    FILE* asm_file = fopen(asm_path, "wb");
-
-    if (!Shrimp_module_x86_64_dump_nasm_mod(mod, asm_file)) {
-        fprintf(stderr, "[ERROR]: Failed to generate assembly\n");
-        return false;
-    }
-
-    fclose(asm_file);
-
-    if (opts.output_kind == SHRIMP_OUTPUT_ASM) {
-        fprintf(stderr, "[INFO]: Generated %s\n", asm_path);
-        return true;
-    }
-
-    // TODO: Don't use system here
-    char command_buffer[1024] = {0};
-    snprintf(command_buffer, sizeof(command_buffer), "nasm %s -felf64 -o %s", asm_path, o_path);
-    system(command_buffer);
-
-    if (opts.output_kind == SHRIMP_OUTPUT_OBJ) {
-        fprintf(stderr, "[INFO]: Generated %s\n", o_path);
-        return true;
-    }
-    memset(command_buffer, 0, sizeof(command_buffer));
-    snprintf(command_buffer, sizeof(command_buffer), "ld %s -o %s", o_path, opts.output_name);
-    system(command_buffer);
-    fprintf(stderr, "[INFO]: Generated %s\n", opts.output_name);
-    return true;
-}
-
-void Shrimp_module_dump(FILE* file, Shrimp_Module mod) {
-    for (size_t i = 0; i < mod.count; i++) {
-        const Shrimp_Function* func = &mod.items[i];
-        fprintf(file, "func %s() {\n", func->name);
-        for (size_t j = 0; j < func->count; j++) {
-            const Shrimp_Instr* instr = &func->items[j];
-            fprintf(file, "  ");
-            switch (instr->t) {
-                case SHRIMP_IT_ADD: {
-                    fprintf(file, "$%zu <- ", instr->binop.result.index);
-                    Shrimp_value_dump(file, instr->binop.l);
-                    fprintf(file, " + ");
-                    Shrimp_value_dump(file, instr->binop.r);
-                    break;
-                }
-                case SHRIMP_IT_SUB: {
-                    fprintf(file, "$%zu <- ", instr->binop.result.index);
-                    Shrimp_value_dump(file, instr->binop.l);
-                    fprintf(file, " - ");
-                    Shrimp_value_dump(file, instr->binop.r);
-                    break;
-                }
-                case SHRIMP_IT_MUL: {
-                    fprintf(file, "$%zu <- ", instr->binop.result.index);
-                    Shrimp_value_dump(file, instr->binop.l);
-                    fprintf(file, " * ");
-                    Shrimp_value_dump(file, instr->binop.r);
-                    break;
-                }
-                case SHRIMP_IT_DIV: {
-                    fprintf(file, "$%zu <- ", instr->binop.result.index);
-                    Shrimp_value_dump(file, instr->binop.l);
-                    fprintf(file, " / ");
-                    Shrimp_value_dump(file, instr->binop.r);
-                    break;
-                }
-                case SHRIMP_IT_CMP_LT: {
-                    fprintf(file, "$%zu <- ", instr->binop.result.index);
-                    Shrimp_value_dump(file, instr->binop.l);
-                    fprintf(file, " < ");
-                    Shrimp_value_dump(file, instr->binop.r);
-                    break;
-                }
-                case SHRIMP_IT_CMP_MT: {
-                    fprintf(file, "$%zu <- ", instr->binop.result.index);
-                    Shrimp_value_dump(file, instr->binop.l);
-                    fprintf(file, " > ");
-                    Shrimp_value_dump(file, instr->binop.r);
-                    break;
-                }
-                case SHRIMP_IT_ASSIGN: {
-                    fprintf(file, "$%zu <- ", instr->assign.into.index);
-                    Shrimp_value_dump(file, instr->assign.v);
-                    break;
-                }
-                case SHRIMP_IT_RETURN: {
-                    fprintf(file, "return ");
-                    Shrimp_value_dump(file, instr->ret);
-                    break;
-                }
-                case SHRIMP_IT_LABEL: {
-                    fprintf(file, "%zu:", instr->label);
-                    break;
-                }
-                case SHRIMP_IT_JUMP: {
-                    fprintf(file, "jump @%zu", instr->jmp.to);
-                    break;
-                }
-                case SHRIMP_IT_JUMP_IF_NOT: {
-                    fprintf(file, "jump_z ");
-                    Shrimp_value_dump(file, instr->jmp_if_not.cond);
-                    fprintf(file, " @%zu", instr->jmp_if_not.to);
-                    break;
-                }
-            }
-            fprintf(file, "\n");
-        }
-        fprintf(file, "}\n");
-    }
-}
-
-void Shrimp_value_dump(FILE* file, Shrimp_Value v) {
-    switch (v.kind) {
-        case SHRIMP_VK_CONST: {
-            fprintf(file, "%zu", v.c);
-            break;
-        }
-        case SHRIMP_VK_TEMP: {
-            fprintf(file, "$%zu", v.t.index);
-            break;
-        }
-    }
-}
-
-void Shrimp_module_cleanup(Shrimp_Module mod) {
-    if (mod.items != NULL) free(mod.items);
-}
-
-Shrimp_Function* Shrimp_module_new_function(Shrimp_Module* mod, const char* name) {
-    Shrimp_Function f = {.name = name};
-    Shrimp_da_push(mod, f);
-    return &mod->items[mod->count-1];
-}
-
-void Shrimp_function_return(Shrimp_Function* func, Shrimp_Value value) {
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_RETURN,
-        .ret = value
-    };
-    Shrimp_da_push(func, instr);
-}
-
-Shrimp_Label Shrimp_function_label_alloc(Shrimp_Function* func) {
-    return func->label_count++;
-}
-void Shrimp_function_label_push(Shrimp_Function* func, Shrimp_Label label) {
-    Shrimp_Instr lab = {
-        .t = SHRIMP_IT_LABEL,
-        .label = label
-    };
-    Shrimp_da_push(func, lab);
-}
-
-Shrimp_Value Shrimp_function_add(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
-    Shrimp_Value result = Shrimp_function_alloc_temp(func, 8);
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_ADD,
-        .binop = {
-            .l = l,
-            .r = r,
-            .result = result.t
-        }
-    };
-    Shrimp_da_push(func, instr);
-
-    return result;
-}
-
-Shrimp_Value Shrimp_function_sub(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
-    Shrimp_Value result = Shrimp_function_alloc_temp(func, 8);
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_SUB,
-        .binop = {
-            .l = l,
-            .r = r,
-            .result = result.t
-        }
-    };
-    Shrimp_da_push(func, instr);
-
-    return result;
-}
-
-Shrimp_Value Shrimp_function_mul(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
-    Shrimp_Value result = Shrimp_function_alloc_temp(func, 8);
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_MUL,
-        .binop = {
-            .l = l,
-            .r = r,
-            .result = result.t
-        }
-    };
-    Shrimp_da_push(func, instr);
-
-    return result;
-}
-Shrimp_Value Shrimp_function_div(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
-    Shrimp_Value result = Shrimp_function_alloc_temp(func, 8);
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_DIV,
-        .binop = {
-            .l = l,
-            .r = r,
-            .result = result.t
-        }
-    };
-    Shrimp_da_push(func, instr);
-
-    return result;
-}
-
-Shrimp_Value Shrimp_function_cmp_lt(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
-    Shrimp_Value result = Shrimp_function_alloc_temp(func, 8);
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_CMP_LT,
-        .binop = {
-            .l = l,
-            .r = r,
-            .result = result.t
-        }
-    };
-    Shrimp_da_push(func, instr);
-
-    return result;
-}
-
-Shrimp_Value Shrimp_function_cmp_mt(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
-    Shrimp_Value result = Shrimp_function_alloc_temp(func, 8);
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_CMP_MT,
-        .binop = {
-            .l = l,
-            .r = r,
-            .result = result.t
-        }
-    };
-    Shrimp_da_push(func, instr);
-
-    return result;
-}
-
-size_t Shrimp_function_align_temp_offset(size_t current_offset, size_t allocation_size) {
-    return (current_offset + allocation_size - 1) & ~(allocation_size - 1);
-}
-
-Shrimp_Value Shrimp_function_alloc_temp(Shrimp_Function* func, size_t size) {
-    size_t new_offset = Shrimp_function_align_temp_offset(func->current_offset, size);
-    Shrimp_Value v = {
-        .kind = SHRIMP_VK_TEMP,
-        .t = {
-            .size = size,
-            .offset = new_offset,
-            .index = func->temp_c++
-        }
-    };
-    func->last_allocated_size = size;
-    func->current_offset = new_offset + size;
-    return v;
-}
-
-Shrimp_Value Shrimp_value_make_const(uint64_t num) {
-    return (Shrimp_Value){
-        .kind = SHRIMP_VK_CONST,
-        .c = num
-    };
-}
-void Shrimp_function_assign_temp(Shrimp_Function* func, Shrimp_Value target, Shrimp_Value value) {
-    assert(target.kind == SHRIMP_VK_TEMP);
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_ASSIGN,
-        .assign = {
-            .v = value,
-            .into = target.t
-        }
-    };
-    Shrimp_da_push(func, instr);
-}
-
-void Shrimp_function_jump_if_not(Shrimp_Function* func, Shrimp_Value v, Shrimp_Label l) {
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_JUMP_IF_NOT,
-        .jmp_if_not = {
-            .cond = v,
-            .to = l
-        }
-    };
-    Shrimp_da_push(func, instr);
-}
-void Shrimp_function_jump(Shrimp_Function* func, Shrimp_Label l) {
-    Shrimp_Instr instr = {
-        .t = SHRIMP_IT_JUMP,
-        .jmp = {
-            .to = l
+NameIRValue* variableLUT_get(const VariableLUT* lut, StringView name) {
+    for (size_t i = 0; i < lut->count; i++) {
+        if (name.count == lut->items[i].name.count && strncmp(name.items, lut->items[i].name.items, name.count) == 0) {
+            return &lut->items[i];
         }
-    };
-    Shrimp_da_push(func, instr);
-
-}
-
-const char* Shrimp_x86_64_nasm_sized_reg(const char* init_reg, size_t size) {
-    if (size != 1 && size != 2 && size != 4 && size != 8) {
-        fprintf(stderr, "Invalid size: %zu. Must be a power of 2 and less or equal to 8.\n", size);
-        return NULL;
     }
-    size_t index = (size_t)log2(size);
-    const char* rax[4] = {"al", "ax", "eax", "rax"};
-    const char* rbx[4] = {"bl", "bx", "ebx", "rbx"};
-    const char* rcx[4] = {"cl", "cx", "ecx", "rcx"};
-    const char* rdx[4] = {"dl", "dx", "edx", "rdx"};
-    const char* rsi[4] = {"sil", "si", "esi", "rsi"};
-    const char* rdi[4] = {"dil", "di", "edi", "rdi"};
-    const char* r8[4] = {"r8b", "r8w", "r8d", "r8"};
-    const char* r9[4] = {"r9b", "r9w", "r9d", "r9"};
-    const char* r10[4] = {"r10b", "r10w", "r10d", "r10"};
-    const char* r11[4] = {"r11b", "r11w", "r11d", "r11"};
-    const char* r12[4] = {"r12b", "r12w", "r12d", "r12"};
-    const char* r13[4] = {"r13b", "r13w", "r13d", "r13"};
-    const char* r14[4] = {"r14b", "r14w", "r14d", "r14"};
-    const char* r15[4] = {"r15b", "r15w", "r15d", "r15"};
-    if (strcmp(init_reg, "rax") == 0) return rax[index];
-    if (strcmp(init_reg, "rbx") == 0) return rbx[index];
-    if (strcmp(init_reg, "rcx") == 0) return rcx[index];
-    if (strcmp(init_reg, "rdx") == 0) return rdx[index];
-    if (strcmp(init_reg, "rsi") == 0) return rsi[index];
-    if (strcmp(init_reg, "rdi") == 0) return rdi[index];
-    if (strcmp(init_reg, "r8") == 0) return r8[index];
-    if (strcmp(init_reg, "r9") == 0) return r9[index];
-    if (strcmp(init_reg, "r10") == 0) return r10[index];
-    if (strcmp(init_reg, "r11") == 0) return r11[index];
-    if (strcmp(init_reg, "r12") == 0) return r12[index];
-    if (strcmp(init_reg, "r13") == 0) return r13[index];
-    if (strcmp(init_reg, "r14") == 0) return r14[index];
-    if (strcmp(init_reg, "r15") == 0) return r15[index];
-    fprintf(stderr, "[FATAL DIE ERROR]: What kinda register did you pass in??? %s\n", init_reg);
     return NULL;
 }
-
-const char* Shrimp_x86_64_nasm_mem_op_prefix(size_t size) {
-    switch (size) {
-        case 1: return "byte";
-        case 2: return "word";
-        case 4: return "dword";
-        case 8: return "qword";
-        default: {
-            fprintf(stderr, "Invalid size: %zu. Must be a power of 2 and less or equal to 8.\n", size);
-            return NULL;
-        }
-    }
-}
-
-bool Shrimp_module_x86_64_dump_nasm_mod(const Shrimp_Module* mod, FILE* file) {
-    for (size_t i = 0; i < mod->count; i++) {
-        fprintf(file, "section .text\n");
-        fprintf(file, "global _start\n");
-        const Shrimp_Function* f = &mod->items[i];
-        fprintf(file, "%s:\n", f->name);
-        fprintf(file, "  push rbp\n");
-        fprintf(file, "  mov rbp, rsp\n");
-        // NOTE: the + 8 is cause the offset stores the current available offset AND we are assuming 8 sized temps
-        fprintf(file, "  sub rsp, %zu\n", f->current_offset + f->last_allocated_size);
-
-        // store callee saved registers according to the x86_64 sysV AMD64 abi
-        fprintf(file, "  push rbx\n");
-        fprintf(file, "  push r12\n");
-        fprintf(file, "  push r13\n");
-        fprintf(file, "  push r14\n");
-        fprintf(file, "  push r15\n");
-
-        for (size_t j = 0; j < f->count; j++) {
-            const Shrimp_Instr* instr = &f->items[j];
-            switch (instr->t) {
-                case SHRIMP_IT_ADD: {
-                    const char* prefix = Shrimp_x86_64_nasm_mem_op_prefix(instr->binop.result.size);
-                    const char* r10 = Shrimp_x86_64_nasm_sized_reg("r10", instr->binop.result.size);
-                    const char* r11 = Shrimp_x86_64_nasm_sized_reg("r11", instr->binop.result.size);
-                    fprintf(file, "  mov %s [rbp - %zu], 0\n", prefix, instr->binop.result.offset);
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.l, "r10", file);
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.r, "r11", file);
-                    fprintf(file, "  add [rbp - %zu], %s\n", instr->binop.result.offset, r10);
-                    fprintf(file, "  add [rbp - %zu], %s\n", instr->binop.result.offset, r11);
-                    break;
-                }
-                case SHRIMP_IT_SUB: {
-                    const char* prefix = Shrimp_x86_64_nasm_mem_op_prefix(instr->binop.result.size);
-                    const char* r10 = Shrimp_x86_64_nasm_sized_reg("r10", instr->binop.result.size);
-                    const char* r11 = Shrimp_x86_64_nasm_sized_reg("r11", instr->binop.result.size);
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.l, "r10", file);
-                    fprintf(file, "  mov %s [rbp - %zu], %s\n", prefix, instr->binop.result.offset, r10);
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.r, "r11", file);
-                    fprintf(file, "  sub [rbp - %zu], %s\n", instr->binop.result.offset, r11);
-                    break;
-                }
-                case SHRIMP_IT_MUL: {
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.l, "r10", file);
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.r, "r11", file);
-                    fprintf(file, "  imul r10, r11\n");
-                    const char* prefix = Shrimp_x86_64_nasm_mem_op_prefix(instr->binop.result.size);
-                    const char* r10 = Shrimp_x86_64_nasm_sized_reg("r10", instr->binop.result.size);
-                    fprintf(file, "  mov %s [rbp - %zu], %s\n", prefix, instr->binop.result.offset, r10);
-                    break;
-                }
-                case SHRIMP_IT_DIV: {
-                    fprintf(file, "  mov rdx, 0\n");
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.l, "rax", file);
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.r, "r10", file);
-                    fprintf(file, "  idiv r10\n");
-
-                    const char* prefix = Shrimp_x86_64_nasm_mem_op_prefix(instr->binop.result.size);
-                    const char* rax = Shrimp_x86_64_nasm_sized_reg("rax", instr->binop.result.size);
-
-                    fprintf(file, "  mov %s [rbp - %zu], %s\n", prefix, instr->binop.result.offset, rax);
-                    break;
-                }
-                case SHRIMP_IT_ASSIGN: {
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->assign.v, "r10", file);
-                    const char* prefix = Shrimp_x86_64_nasm_mem_op_prefix(instr->assign.into.size);
-                    const char* r10 = Shrimp_x86_64_nasm_sized_reg("r10", instr->assign.into.size);
-                    fprintf(file, "  mov %s [rbp - %zu], %s\n", prefix, instr->assign.into.offset, r10);
-                    break;
-                }
-                case SHRIMP_IT_RETURN: {
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->ret, "rax", file);
-                    fprintf(file, "  jmp .exit\n");
-                    break;
-                }
-                case SHRIMP_IT_LABEL: {
-                    fprintf(file, "  .%zu:\n", instr->label);
-                    break;
-                }
-                case SHRIMP_IT_JUMP: {
-                    fprintf(file, "  jmp .%zu\n", instr->jmp.to);
-                    break;
-                }
-                case SHRIMP_IT_JUMP_IF_NOT: {
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->jmp_if_not.cond, "r10", file);
-                    fprintf(file, "  cmp r10, 0\n");
-                    fprintf(file, "  jz .%zu\n", instr->jmp_if_not.to);
-                    break;
-                }
-                // TODO: I remember a way to make this more concise
-                case SHRIMP_IT_CMP_LT: {
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.l, "r10", file);
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.r, "r11", file);
-
-                    const char* prefix = Shrimp_x86_64_nasm_mem_op_prefix(instr->binop.result.size);
-                    const char* r10 = Shrimp_x86_64_nasm_sized_reg("r10", instr->binop.result.size);
-                    const char* r11 = Shrimp_x86_64_nasm_sized_reg("r11", instr->binop.result.size);
-
-                    fprintf(file, "  cmp %s, %s\n", r10, r11);
-                    fprintf(file, "  mov %s, 0\n", r10);
-                    fprintf(file, "  mov %s, 1\n", r11);
-                    fprintf(file, "  cmovl %s, %s\n", r10, r11);
-                    fprintf(file, "  mov %s [rbp - %zu], %s\n", prefix, instr->binop.result.offset, r10);
-                    break;
-                }
-                case SHRIMP_IT_CMP_MT: {
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.l, "r10", file);
-                    Shrimp_x86_64_nasm_mov_value_to_reg(&instr->binop.r, "r11", file);
-
-                    const char* prefix = Shrimp_x86_64_nasm_mem_op_prefix(instr->binop.result.size);
-                    const char* r10 = Shrimp_x86_64_nasm_sized_reg("r10", instr->binop.result.size);
-                    const char* r11 = Shrimp_x86_64_nasm_sized_reg("r11", instr->binop.result.size);
-
-                    fprintf(file, "  cmp %s, %s\n", r10, r11);
-                    fprintf(file, "  mov %s, 0\n", r10);
-                    fprintf(file, "  mov %s, 1\n", r11);
-                    fprintf(file, "  cmovg %s, %s\n", r10, r11);
-                    fprintf(file, "  mov %s [rbp - %zu], %s\n", prefix, instr->binop.result.offset, r10);
-                    break;
-                }
-            }
-        }
-        fprintf(file, "  .exit:\n");
-
-        fprintf(file, "  pop r15\n");
-        fprintf(file, "  pop r14\n");
-        fprintf(file, "  pop r13\n");
-        fprintf(file, "  pop r12\n");
-        fprintf(file, "  pop rbx\n");
-
-        fprintf(file, "  mov rsp, rbp\n");
-        fprintf(file, "  pop rbp\n");
-        fprintf(file, "  mov rdi, rax\n");
-        fprintf(file, "  mov rax, 60\n");
-        fprintf(file, "  syscall\n");
-    }
-    return true;
-}
-
-void Shrimp_x86_64_nasm_mov_value_to_reg(const Shrimp_Value* value, const char* reg, FILE* out) {
-    switch(value->kind) {
-        case SHRIMP_VK_TEMP: {
-            fprintf(out, "  mov %s, ", Shrimp_x86_64_nasm_sized_reg(reg, value->t.size));
-            fprintf(out, "[rbp - %zu]\n", value->t.offset);
-            break;
-        }
-        case SHRIMP_VK_CONST: {
-            fprintf(out, "  mov %s, ", reg);
-            fprintf(out, "%zu\n", value->c);
-            break;
-        }
-    }
-}
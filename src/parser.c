@@ -12,6 +12,8 @@ static bool parser_empty(const Parser* parser);
 
 static bool parser_stmt(Parser* parser, Stmt* out);
 static bool parser_block(Parser* parser, Body* out);
+static bool parser_fn(Parser* parser, Stmt* out);
+static bool parser_call(Parser* parser, Expr* out);
 /*
     Ref: Crafting interpreters page 80
     expression → equality ;
@@ -79,6 +81,20 @@ static bool parser_stmt(Parser* parser, Stmt* out) {
                     if (!parser_block(parser, &out->while_st.body)) return false;
                     return true;
                 }
+                case KT_FN: {
+                    return parser_fn(parser, out);
+                }
+                case KT_EXPORT: {
+                    Token fn = {0};
+                    if (!parser_expect_and_bump(parser, TT_KEYWORD, &fn) || fn.kw != KT_FN) {
+                        fprintf(stderr, "[ERROR]: Expected `fn` after `export`\n");
+                        bong_error(parser->source, fn.offset);
+                        return false;
+                    }
+                    if (!parser_fn(parser, out)) return false;
+                    out->fn.exported = true;
+                    return true;
+                }
             }
         }
         case TT_IDENT: {
@@ -146,6 +162,11 @@ static bool parser_block(Parser* parser, Body* out) {
         }
         Stmt s = {0};
         if (!parser_stmt(parser, &s)) return false;
+        if (s.type == ST_FN) {
+            fprintf(stderr, "[ERROR]: Functions can only be defined at the top level\n");
+            bong_error(parser->source, open_curly.offset);
+            return false;
+        }
         da_push(out, s, parser->arena);
     }
     fprintf(stderr, "[ERROR]: Missing `}` to close a block\n");
@@ -153,6 +174,64 @@ static bool parser_block(Parser* parser, Body* out) {
     return false;
 }
 
+// fn name(a, b) { ... }
+static bool parser_fn(Parser* parser, Stmt* out) {
+    Token t = {0};
+    if (!parser_expect_and_bump(parser, TT_IDENT, &t)) {
+        fprintf(stderr, "[ERROR]: Expected the name of the function after `fn`\n");
+        bong_error(parser->source, t.offset);
+        return false;
+    }
+    out->type = ST_FN;
+    out->fn.name = t.id;
+    if (!parser_expect_and_bump(parser, TT_OPEN_PAREN, &t)) {
+        fprintf(stderr, "[ERROR]: Expected a `(` after the name of the function\n");
+        bong_error(parser->source, t.offset);
+        return false;
+    }
+    while (parser_peek(parser, &t) && t.type != TT_CLOSE_PAREN) {
+        if (out->fn.params.count != 0 && !parser_expect_and_bump(parser, TT_COMMA, &t)) {
+            fprintf(stderr, "[ERROR]: Expected a `,` between the params of the function\n");
+            bong_error(parser->source, t.offset);
+            return false;
+        }
+        if (!parser_expect_and_bump(parser, TT_IDENT, &t)) {
+            fprintf(stderr, "[ERROR]: Expected the name of a param\n");
+            bong_error(parser->source, t.offset);
+            return false;
+        }
+        da_push(&out->fn.params, t.id, parser->arena);
+    }
+    if (!parser_expect_and_bump(parser, TT_CLOSE_PAREN, &t)) {
+        fprintf(stderr, "[ERROR]: Missing `)` after the params of the function\n");
+        bong_error(parser->source, parser_last_token(parser).offset);
+        return false;
+    }
+    return parser_block(parser, &out->fn.body);
+}
+
+// the arguments of a call, the name was already bumped
+static bool parser_call(Parser* parser, Expr* out) {
+    Token t = {0};
+    parser_bump(parser, &t);
+    while (parser_peek(parser, &t) && t.type != TT_CLOSE_PAREN) {
+        if (out->call.args.count != 0 && !parser_expect_and_bump(parser, TT_COMMA, &t)) {
+            fprintf(stderr, "[ERROR]: Expected a `,` between the arguments of the call\n");
+            bong_error(parser->source, t.offset);
+            return false;
+        }
+        Expr arg = {0};
+        if (!parser_expression(parser, &arg)) return false;
+        da_push(&out->call.args, arg, parser->arena);
+    }
+    if (!parser_expect_and_bump(parser, TT_CLOSE_PAREN, &t)) {
+        fprintf(stderr, "[ERROR]: Missing `)` after the arguments of the call\n");
+        bong_error(parser->source, parser_last_token(parser).offset);
+        return false;
+    }
+    return true;
+}
+
 static bool parser_expression(Parser* parser, Expr* out) {
     return parser_eq(parser, out);
 }
@@ -224,7 +303,13 @@ static bool parser_primary(Parser* parser, Expr* out) {
             return true;
         }
         case TT_IDENT: {
-            // TODO: Function calls as values 
+            Token next = {0};
+            if (!parser_empty(parser) && parser_peek(parser, &next) && next.type == TT_OPEN_PAREN) {
+                out->type = ET_CALL;
+                out->call.name = t.id;
+                out->call.args = (Args){0};
+                return parser_call(parser, out);
+            }
             out->type = ET_ID;
             out->id = t.id;
             return true;
@@ -18,6 +18,7 @@ typedef enum {
     ET_NUMBER,
     ET_ID,
     ET_BIN,
+    ET_CALL,
 } ExprType;
 
 typedef enum {
@@ -26,8 +27,24 @@ typedef enum {
     ST_WHILE,
     ST_VAR_DEF,
     ST_VAR_REASSIGN,
+    // only at the top level
+    ST_FN,
 } StmtType;
 
+struct Expr;
+
+typedef struct {
+    struct Expr* items;
+    size_t count;
+    size_t capacity;
+} Args;
+
+typedef struct {
+    StringView* items;
+    size_t count;
+    size_t capacity;
+} Params;
+
 typedef struct Expr {
     ExprType type;
     union {
@@ -38,6 +55,10 @@ typedef struct Expr {
             struct Expr* r;
             OperatorType op;
         } bin;
+        struct {
+            StringView name;
+            Args args;
+        } call;
     };
 } Expr;
 
@@ -70,6 +91,13 @@ typedef struct Stmt {
             StringView name;
             Expr value;
         } var_reassign;
+        struct {
+            StringView name;
+            Params params;
+            Body body;
+            // callable from outside of the program with the C calling convention
+            bool exported;
+        } fn;
     };
 } Stmt;
 
@@ -0,0 +1,910 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+_Static_assert(sizeof(Shrimp_Instr) == 16, "Shrimp_Instr should stay packed into 16 bytes");
+
+static Shrimp_Value Shrimp_function_binop(Shrimp_Function* func, Shrimp_InstrType t, Shrimp_Value l, Shrimp_Value r);
+
+Shrimp_Module Shrimp_module_new(const char* name) {
+    return (Shrimp_Module){.name = name};
+}
+
+bool Shrimp_module_compile(Shrimp_Module* mod, Shrimp_CompOptions opts) {
+    if (!Shrimp_module_verify(mod)) return false;
+    if (opts.profile_use != NULL && !Shrimp_module_profile_use(mod, opts.profile_use)) return false;
+    // the counters have to belong to the IR as it is now, which is what -fprofile-use reads them into
+    mod->profile_output = opts.profile_generate;
+    if (opts.profile_generate == NULL && (opts.opts || opts.passes) && !Shrimp_module_optimize(mod, opts)) return false;
+    if (opts.bytecode_output != NULL && !Shrimp_module_write_bytecode(mod, opts.bytecode_output)) return false;
+    switch (opts.target) {
+        case SHRIMP_TARGET_X86_64_NASM_LINUX: return Shrimp_module_x86_64_nasm_linux_compile(mod, opts);
+        default: {
+            fprintf(stderr, "[ERROR]: Unknown target %d\n", opts.target);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Constant folding
+// Walks every block once, keeping what is known about the temps in a dense array indexed by the temp. A temp is
+// known from the point a constant is written to it until anything else is written to it or the block ends, known
+// temps are replaced by their value wherever they're read and binops with both operands known become an
+// assignment of the result.
+
+typedef struct {
+    // the block the constant was written in, it only holds while that block runs and 0 is no block
+    uint32_t block;
+    // the constant as it was written, reads get the same ref instead of looking the value up in the pool again
+    Shrimp_Ref ref;
+} Shrimp_FoldCell;
+
+static bool Shrimp_fold_function(Shrimp_Function* f) {
+    // patching the def-use chains costs as much as the temp has uses, so they're rebuilt once at the end instead
+    bool had_uses = Shrimp_function_has_uses(f);
+    if (had_uses) Shrimp_function_free_uses(f);
+    Shrimp_FoldCell* cells = calloc(f->temps.count + 1, sizeof(Shrimp_FoldCell));
+    uint32_t block = 1;
+    bool changed = false;
+    for (size_t i = 0; i < f->count; i++) {
+        Shrimp_Instr instr = f->items[i];
+        if (instr.t == SHRIMP_IT_LABEL) {
+            block++;
+            continue;
+        }
+        Shrimp_Ref* ops[2];
+        size_t n = Shrimp_instr_operands(&instr, ops);
+        bool folded = false;
+        for (size_t o = 0; o < n; o++) {
+            if (SHRIMP_REF_IS_CONST(*ops[o]) || cells[*ops[o]].block != block) continue;
+            *ops[o] = cells[*ops[o]].ref;
+            folded = true;
+        }
+        uint64_t value;
+        if (Shrimp_instr_is_binop(instr.t) && SHRIMP_REF_IS_CONST(instr.binop.l) && SHRIMP_REF_IS_CONST(instr.binop.r) &&
+            Shrimp_eval_binop(instr.t, Shrimp_function_const(f, instr.binop.l), Shrimp_function_const(f, instr.binop.r), &value)) {
+            instr = (Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = instr.binop.result, .v = Shrimp_function_const_ref(f, value)}};
+            folded = true;
+        }
+        uint32_t def;
+        if (Shrimp_instr_def(&instr, &def)) {
+            bool known = instr.t == SHRIMP_IT_ASSIGN && SHRIMP_REF_IS_CONST(instr.assign.v);
+            cells[def] = known ? (Shrimp_FoldCell){.block = block, .ref = instr.assign.v} : (Shrimp_FoldCell){0};
+        }
+        if (!folded) continue;
+        f->items[i] = instr;
+        changed = true;
+    }
+    free(cells);
+    if (had_uses) Shrimp_function_build_uses(f);
+    return changed;
+}
+
+bool Shrimp_module_const_fold(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) changed |= Shrimp_fold_function(&mod->items[i]);
+    return changed;
+}
+
+static bool Shrimp_function_verify_ref(const Shrimp_Function* func, Shrimp_Ref ref) {
+    if (SHRIMP_REF_IS_CONST(ref)) return SHRIMP_REF_INDEX(ref) < func->consts.count;
+    return ref < func->temps.count;
+}
+
+// Every label is placed at most once and the jumps only go to placed ones
+static bool Shrimp_function_verify_labels(const Shrimp_Function* func) {
+    bool* placed = calloc(func->label_count ? func->label_count : 1, sizeof(bool));
+    bool ok = true;
+    for (size_t i = 0; i < func->count && ok; i++) {
+        if (func->items[i].t != SHRIMP_IT_LABEL) continue;
+        if (placed[func->items[i].label]) {
+            fprintf(stderr, "[ERROR]: Label %u is placed more than once in function %s\n", func->items[i].label, func->name);
+            ok = false;
+        }
+        placed[func->items[i].label] = true;
+    }
+    for (size_t i = 0; i < func->count && ok; i++) {
+        const Shrimp_Instr* instr = &func->items[i];
+        Shrimp_Label to;
+        if (instr->t == SHRIMP_IT_JUMP) to = instr->jmp.to;
+        else if (Shrimp_instr_is_branch(instr->t)) to = instr->jmp_if_not.to;
+        else continue;
+        if (!placed[to]) {
+            fprintf(stderr, "[ERROR]: Instruction %zu in function %s jumps to label %u which is never placed\n", i, func->name, to);
+            ok = false;
+        }
+    }
+    free(placed);
+    return ok;
+}
+
+bool Shrimp_module_verify(const Shrimp_Module* mod) {
+    for (size_t f_i = 0; f_i < mod->count; f_i++) {
+        const Shrimp_Function* f = &mod->items[f_i];
+        if (f->param_count > f->temps.count) {
+            fprintf(stderr, "[ERROR]: Function %s has more params than temps\n", f->name);
+            return false;
+        }
+        for (size_t t = 0; t < f->temps.count; t++) {
+            uint32_t size = f->temps.items[t].size;
+            if (size != 1 && size != 2 && size != 4 && size != 8) {
+                fprintf(stderr, "[ERROR]: Temp %zu in function %s is %u bytes, it has to be 1, 2, 4 or 8\n", t, f->name, size);
+                return false;
+            }
+        }
+        // the ARGs seen since the last CALL
+        size_t args = 0;
+        for (size_t i_i = 0; i_i < f->count; i_i++) {
+            const Shrimp_Instr* instr = &f->items[i_i];
+            bool ok = true;
+            if (args != 0 && instr->t != SHRIMP_IT_ARG && instr->t != SHRIMP_IT_NOP && instr->t != SHRIMP_IT_CALL) {
+                fprintf(stderr, "[ERROR]: Instruction %zu in function %s comes between the arguments and their call\n", i_i, f->name);
+                return false;
+            }
+            switch (instr->t) {
+                case SHRIMP_IT_ADD: case SHRIMP_IT_SUB: case SHRIMP_IT_MUL: case SHRIMP_IT_DIV:
+                case SHRIMP_IT_CMP_LT: case SHRIMP_IT_CMP_MT: case SHRIMP_IT_SHL: case SHRIMP_IT_SHR: case SHRIMP_IT_MULHU: {
+                    ok = Shrimp_function_verify_ref(f, instr->binop.l) &&
+                         Shrimp_function_verify_ref(f, instr->binop.r) &&
+                         instr->binop.result < f->temps.count;
+                    break;
+                }
+                case SHRIMP_IT_ASSIGN: {
+                    ok = Shrimp_function_verify_ref(f, instr->assign.v) && instr->assign.into < f->temps.count;
+                    break;
+                }
+                case SHRIMP_IT_RETURN: ok = Shrimp_function_verify_ref(f, instr->ret); break;
+                case SHRIMP_IT_LABEL: ok = instr->label < f->label_count; break;
+                case SHRIMP_IT_JUMP: ok = instr->jmp.to < f->label_count; break;
+                case SHRIMP_IT_NOP: break;
+                case SHRIMP_IT_JUMP_IF_NOT: case SHRIMP_IT_JUMP_IF: {
+                    ok = Shrimp_function_verify_ref(f, instr->jmp_if_not.cond) && instr->jmp_if_not.to < f->label_count;
+                    break;
+                }
+                case SHRIMP_IT_ARG: {
+                    ok = Shrimp_function_verify_ref(f, instr->arg);
+                    args++;
+                    break;
+                }
+                case SHRIMP_IT_CALL: {
+                    ok = instr->call.func < mod->count && instr->call.result < f->temps.count;
+                    if (ok && (instr->call.argc != mod->items[instr->call.func].param_count || instr->call.argc != args)) {
+                        fprintf(stderr, "[ERROR]: Call %zu in function %s doesn't pass as many arguments as %s takes\n",
+                                i_i, f->name, mod->items[instr->call.func].name);
+                        return false;
+                    }
+                    args = 0;
+                    break;
+                }
+                default: {
+                    fprintf(stderr, "[ERROR]: Unknown instruction %u in function %s at %zu\n", instr->t, f->name, i_i);
+                    return false;
+                }
+            }
+            if (!ok) {
+                fprintf(stderr, "[ERROR]: Instruction %zu in function %s refers to a temp, constant or label that doesn't exist\n", i_i, f->name);
+                return false;
+            }
+        }
+        if (args != 0) {
+            fprintf(stderr, "[ERROR]: Function %s ends with arguments that aren't passed to a call\n", f->name);
+            return false;
+        }
+        if (!Shrimp_function_verify_labels(f)) return false;
+    }
+    return true;
+}
+
+void Shrimp_module_dump(FILE* file, Shrimp_Module mod) {
+    for (size_t i = 0; i < mod.count; i++) {
+        const Shrimp_Function* func = &mod.items[i];
+        fprintf(file, func->exported ? "export func %s(" : "func %s(", func->name);
+        for (uint32_t p = 0; p < func->param_count; p++) {
+            if (p != 0) fprintf(file, ", ");
+            Shrimp_ref_dump(file, func, p);
+        }
+        fprintf(file, ") {\n");
+        for (size_t j = 0; j < func->count; j++) {
+            const Shrimp_Instr* instr = &func->items[j];
+            fprintf(file, "  ");
+            switch (instr->t) {
+                case SHRIMP_IT_ADD: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " + ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_SUB: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " - ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_MUL: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " * ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_DIV: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " / ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_CMP_LT: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " < ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_CMP_MT: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " > ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_SHL: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " << ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_SHR: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " >> ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_MULHU: {
+                    Shrimp_ref_dump(file, func, instr->binop.result);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->binop.l);
+                    fprintf(file, " *h ");
+                    Shrimp_ref_dump(file, func, instr->binop.r);
+                    break;
+                }
+                case SHRIMP_IT_ASSIGN: {
+                    Shrimp_ref_dump(file, func, instr->assign.into);
+                    fprintf(file, " <- ");
+                    Shrimp_ref_dump(file, func, instr->assign.v);
+                    break;
+                }
+                case SHRIMP_IT_RETURN: {
+                    fprintf(file, "return ");
+                    Shrimp_ref_dump(file, func, instr->ret);
+                    break;
+                }
+                case SHRIMP_IT_LABEL: {
+                    fprintf(file, "%u:", instr->label);
+                    break;
+                }
+                case SHRIMP_IT_JUMP: {
+                    fprintf(file, "jump @%u", instr->jmp.to);
+                    break;
+                }
+                case SHRIMP_IT_JUMP_IF_NOT: case SHRIMP_IT_JUMP_IF: {
+                    fprintf(file, instr->t == SHRIMP_IT_JUMP_IF ? "jump_nz " : "jump_z ");
+                    Shrimp_ref_dump(file, func, instr->jmp_if_not.cond);
+                    fprintf(file, " @%u", instr->jmp_if_not.to);
+                    if (instr->jmp_if_not.taken != 0 || instr->jmp_if_not.not_taken != 0) {
+                        fprintf(file, " weights %u:%u", instr->jmp_if_not.taken, instr->jmp_if_not.not_taken);
+                    }
+                    break;
+                }
+                case SHRIMP_IT_NOP: {
+                    fprintf(file, "nop");
+                    break;
+                }
+                case SHRIMP_IT_ARG: {
+                    fprintf(file, "arg ");
+                    Shrimp_ref_dump(file, func, instr->arg);
+                    break;
+                }
+                case SHRIMP_IT_CALL: {
+                    Shrimp_ref_dump(file, func, instr->call.result);
+                    fprintf(file, " <- call %s", mod.items[instr->call.func].name);
+                    break;
+                }
+            }
+            fprintf(file, "\n");
+        }
+        fprintf(file, "}\n");
+    }
+}
+
+void Shrimp_ref_dump(FILE* file, const Shrimp_Function* func, Shrimp_Ref ref) {
+    if (SHRIMP_REF_IS_CONST(ref)) {
+        fprintf(file, "%lu", Shrimp_function_const(func, ref));
+    } else {
+        fprintf(file, "$%u", SHRIMP_REF_INDEX(ref));
+        // the size is only spelled out for the ones narrowed from the default
+        uint32_t size = Shrimp_function_temp(func, SHRIMP_REF_INDEX(ref))->size;
+        if (size != 8) fprintf(file, ":%u", size);
+    }
+}
+
+void Shrimp_function_free(Shrimp_Function* f) {
+    Shrimp_da_free(f);
+    Shrimp_da_free(&f->temps);
+    Shrimp_da_free(&f->consts);
+    free(f->const_map.slots);
+    Shrimp_function_free_uses(f);
+}
+
+void Shrimp_module_cleanup(Shrimp_Module mod) {
+    for (size_t i = 0; i < mod.count; i++) Shrimp_function_free(&mod.items[i]);
+    Shrimp_da_free(&mod);
+    if (mod.mapping != NULL) munmap(mod.mapping, mod.mapping_size);
+}
+
+Shrimp_Function* Shrimp_module_new_function(Shrimp_Module* mod, const char* name) {
+    Shrimp_Function f = {.name = name};
+    Shrimp_da_push(mod, f);
+    return &mod->items[mod->count-1];
+}
+
+uint32_t Shrimp_module_find_function(const Shrimp_Module* mod, const char* name) {
+    for (size_t i = 0; i < mod->count; i++) {
+        if (strcmp(mod->items[i].name, name) == 0) return i;
+    }
+    return SHRIMP_NO_FUNCTION;
+}
+
+Shrimp_Value Shrimp_function_add_param(Shrimp_Function* func) {
+    assert(func->temps.count == func->param_count && "Params have to be the first temps");
+    func->param_count++;
+    return Shrimp_function_alloc_temp(func, 8);
+}
+
+void Shrimp_function_return(Shrimp_Function* func, Shrimp_Value value) {
+    Shrimp_Instr instr = {
+        .t = SHRIMP_IT_RETURN,
+        .ret = Shrimp_function_ref(func, value)
+    };
+    Shrimp_function_push(func, instr);
+}
+
+Shrimp_Label Shrimp_function_label_alloc(Shrimp_Function* func) {
+    return func->label_count++;
+}
+void Shrimp_function_label_push(Shrimp_Function* func, Shrimp_Label label) {
+    Shrimp_Instr lab = {
+        .t = SHRIMP_IT_LABEL,
+        .label = label
+    };
+    Shrimp_function_push(func, lab);
+}
+
+static Shrimp_Value Shrimp_function_binop(Shrimp_Function* func, Shrimp_InstrType t, Shrimp_Value l, Shrimp_Value r) {
+    Shrimp_Value result = Shrimp_function_alloc_temp(func, 8);
+    Shrimp_Instr instr = {
+        .t = t,
+        .binop = {
+            .l = Shrimp_function_ref(func, l),
+            .r = Shrimp_function_ref(func, r),
+            .result = result.t
+        }
+    };
+    Shrimp_function_push(func, instr);
+
+    return result;
+}
+
+Shrimp_Value Shrimp_function_add(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
+    return Shrimp_function_binop(func, SHRIMP_IT_ADD, l, r);
+}
+
+Shrimp_Value Shrimp_function_sub(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
+    return Shrimp_function_binop(func, SHRIMP_IT_SUB, l, r);
+}
+
+Shrimp_Value Shrimp_function_mul(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
+    return Shrimp_function_binop(func, SHRIMP_IT_MUL, l, r);
+}
+
+Shrimp_Value Shrimp_function_div(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
+    return Shrimp_function_binop(func, SHRIMP_IT_DIV, l, r);
+}
+
+Shrimp_Value Shrimp_function_cmp_lt(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
+    return Shrimp_function_binop(func, SHRIMP_IT_CMP_LT, l, r);
+}
+
+Shrimp_Value Shrimp_function_cmp_mt(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r) {
+    return Shrimp_function_binop(func, SHRIMP_IT_CMP_MT, l, r);
+}
+
+size_t Shrimp_function_align_temp_offset(size_t current_offset, size_t allocation_size) {
+    return (current_offset + allocation_size - 1) & ~(allocation_size - 1);
+}
+
+Shrimp_Value Shrimp_function_alloc_temp(Shrimp_Function* func, size_t size) {
+    size_t new_offset = Shrimp_function_align_temp_offset(func->current_offset, size);
+    Shrimp_Temp t = {
+        .size = size,
+        .offset = new_offset,
+        .index = func->temps.count
+    };
+    bool had_uses = Shrimp_function_has_uses(func);
+    Shrimp_da_push(&func->temps, t);
+    if (had_uses) {
+        Shrimp_TempUses u = {0};
+        Shrimp_da_push(&func->uses, u);
+    }
+    func->last_allocated_size = size;
+    func->current_offset = new_offset + size;
+    return (Shrimp_Value) {
+        .kind = SHRIMP_VK_TEMP,
+        .t = t.index
+    };
+}
+
+void Shrimp_function_truncate_temps(Shrimp_Function* func, size_t count) {
+    if (count >= func->temps.count) return;
+    if (Shrimp_function_has_uses(func)) {
+        for (size_t i = count; i < func->uses.count; i++) {
+            Shrimp_da_free(&func->uses.items[i].defs);
+            Shrimp_da_free(&func->uses.items[i].uses);
+        }
+        func->uses.count = count;
+    }
+    func->temps.count = count;
+    const Shrimp_Temp* last = count == 0 ? NULL : &func->temps.items[count - 1];
+    func->current_offset = last == NULL ? 0 : last->offset + last->size;
+    func->last_allocated_size = last == NULL ? 0 : last->size;
+}
+
+Shrimp_Value Shrimp_value_make_const(uint64_t num) {
+    return (Shrimp_Value){
+        .kind = SHRIMP_VK_CONST,
+        .c = num
+    };
+}
+
+Shrimp_Ref Shrimp_function_ref(Shrimp_Function* func, Shrimp_Value value) {
+    switch (value.kind) {
+        case SHRIMP_VK_CONST: return Shrimp_function_const_ref(func, value.c);
+        case SHRIMP_VK_TEMP: {
+            assert(value.t < func->temps.count);
+            return value.t;
+        }
+    }
+    assert(false);
+}
+
+static size_t Shrimp_const_hash(uint64_t c) {
+    c ^= c >> 33;
+    c *= 0xff51afd7ed558ccdull;
+    c ^= c >> 33;
+    return c;
+}
+
+static void Shrimp_const_map_rebuild(Shrimp_Function* func, size_t capacity) {
+    Shrimp_ConstMap* map = &func->const_map;
+    free(map->slots);
+    map->slots = calloc(capacity, sizeof(uint32_t));
+    map->capacity = capacity;
+    map->count = func->consts.count;
+    for (size_t i = 0; i < func->consts.count; i++) {
+        size_t s = Shrimp_const_hash(func->consts.items[i]) & (capacity - 1);
+        while (map->slots[s] != 0) s = (s + 1) & (capacity - 1);
+        map->slots[s] = i + 1;
+    }
+}
+
+Shrimp_Ref Shrimp_function_const_ref(Shrimp_Function* func, uint64_t c) {
+    Shrimp_ConstMap* map = &func->const_map;
+    // kept at most half full, and pools that changed behind its back (mapped in, compacted) get it rebuilt
+    if (map->count != func->consts.count || (func->consts.count + 1) * 2 > map->capacity) {
+        size_t capacity = 16;
+        while (capacity < (func->consts.count + 1) * 2) capacity *= 2;
+        Shrimp_const_map_rebuild(func, capacity);
+    }
+    size_t s = Shrimp_const_hash(c) & (map->capacity - 1);
+    for (; map->slots[s] != 0; s = (s + 1) & (map->capacity - 1)) {
+        uint32_t index = map->slots[s] - 1;
+        if (func->consts.items[index] == c) return index | SHRIMP_REF_CONST_BIT;
+    }
+    assert(func->consts.count < SHRIMP_REF_CONST_BIT);
+    Shrimp_da_push(&func->consts, c);
+    map->slots[s] = func->consts.count;
+    map->count++;
+    return (func->consts.count - 1) | SHRIMP_REF_CONST_BIT;
+}
+
+void Shrimp_function_compact_consts(Shrimp_Function* func) {
+    uint32_t* index = malloc(sizeof(uint32_t) * (func->consts.count + 1));
+    memset(index, 0xff, sizeof(uint32_t) * func->consts.count);
+    for (size_t i = 0; i < func->count; i++) {
+        Shrimp_Ref* ops[2];
+        size_t n = Shrimp_instr_operands(&func->items[i], ops);
+        for (size_t o = 0; o < n; o++) {
+            if (SHRIMP_REF_IS_CONST(*ops[o])) index[SHRIMP_REF_INDEX(*ops[o])] = 0;
+        }
+    }
+    size_t kept = 0;
+    for (size_t c = 0; c < func->consts.count; c++) {
+        if (index[c] == UINT32_MAX) continue;
+        index[c] = kept;
+        func->consts.items[kept++] = func->consts.items[c];
+    }
+    if (kept != func->consts.count) {
+        func->consts.count = kept;
+        for (size_t i = 0; i < func->count; i++) {
+            Shrimp_Ref* ops[2];
+            size_t n = Shrimp_instr_operands(&func->items[i], ops);
+            for (size_t o = 0; o < n; o++) {
+                if (SHRIMP_REF_IS_CONST(*ops[o])) *ops[o] = index[SHRIMP_REF_INDEX(*ops[o])] | SHRIMP_REF_CONST_BIT;
+            }
+        }
+    }
+    free(index);
+}
+
+void Shrimp_function_compact_temps(Shrimp_Function* func) {
+    uint32_t* index = malloc(sizeof(uint32_t) * (func->temps.count + 1));
+    memset(index, 0xff, sizeof(uint32_t) * func->temps.count);
+    for (uint32_t p = 0; p < func->param_count; p++) index[p] = 0;
+    for (size_t i = 0; i < func->count; i++) {
+        Shrimp_Ref* ops[2];
+        size_t n = Shrimp_instr_operands(&func->items[i], ops);
+        for (size_t o = 0; o < n; o++) {
+            if (!SHRIMP_REF_IS_CONST(*ops[o])) index[*ops[o]] = 0;
+        }
+        uint32_t def;
+        if (Shrimp_instr_def(&func->items[i], &def)) index[def] = 0;
+    }
+    size_t kept = 0;
+    size_t offset = 0;
+    for (size_t t = 0; t < func->temps.count; t++) {
+        if (index[t] == UINT32_MAX) continue;
+        Shrimp_Temp temp = func->temps.items[t];
+        index[t] = kept;
+        temp.index = kept;
+        // narrowed temps keep the 8 byte slot every temp gets in the frame
+        temp.offset = offset;
+        offset += 8;
+        func->temps.items[kept++] = temp;
+    }
+    if (kept != func->temps.count) {
+        bool had_uses = Shrimp_function_has_uses(func);
+        if (had_uses) Shrimp_function_free_uses(func);
+        func->temps.count = kept;
+        func->current_offset = offset;
+        func->last_allocated_size = kept == 0 ? 0 : 8;
+        for (size_t i = 0; i < func->count; i++) {
+            Shrimp_Instr* instr = &func->items[i];
+            Shrimp_Ref* ops[2];
+            size_t n = Shrimp_instr_operands(instr, ops);
+            for (size_t o = 0; o < n; o++) {
+                if (!SHRIMP_REF_IS_CONST(*ops[o])) *ops[o] = index[*ops[o]];
+            }
+            uint32_t def;
+            if (Shrimp_instr_def(instr, &def)) Shrimp_instr_set_def(instr, index[def]);
+        }
+        if (had_uses) Shrimp_function_build_uses(func);
+    }
+    free(index);
+}
+
+uint64_t Shrimp_function_const(const Shrimp_Function* func, Shrimp_Ref ref) {
+    assert(SHRIMP_REF_IS_CONST(ref));
+    return func->consts.items[SHRIMP_REF_INDEX(ref)];
+}
+
+const Shrimp_Temp* Shrimp_function_temp(const Shrimp_Function* func, uint32_t index) {
+    assert(index < func->temps.count);
+    return &func->temps.items[index];
+}
+
+void Shrimp_function_assign_temp(Shrimp_Function* func, Shrimp_Value target, Shrimp_Value value) {
+    assert(target.kind == SHRIMP_VK_TEMP);
+    Shrimp_Instr instr = {
+        .t = SHRIMP_IT_ASSIGN,
+        .assign = {
+            .v = Shrimp_function_ref(func, value),
+            .into = target.t
+        }
+    };
+    Shrimp_function_push(func, instr);
+}
+
+void Shrimp_function_jump_if_not(Shrimp_Function* func, Shrimp_Value v, Shrimp_Label l) {
+    Shrimp_Instr instr = {
+        .t = SHRIMP_IT_JUMP_IF_NOT,
+        .jmp_if_not = {
+            .cond = Shrimp_function_ref(func, v),
+            .to = l
+        }
+    };
+    Shrimp_function_push(func, instr);
+}
+void Shrimp_function_jump(Shrimp_Function* func, Shrimp_Label l) {
+    Shrimp_Instr instr = {
+        .t = SHRIMP_IT_JUMP,
+        .jmp = {
+            .to = l
+        }
+    };
+    Shrimp_function_push(func, instr);
+
+}
+
+Shrimp_Value Shrimp_function_call(Shrimp_Function* func, uint32_t callee, const Shrimp_Value* args, size_t argc) {
+    for (size_t i = 0; i < argc; i++) {
+        Shrimp_Instr arg = {
+            .t = SHRIMP_IT_ARG,
+            .arg = Shrimp_function_ref(func, args[i])
+        };
+        Shrimp_function_push(func, arg);
+    }
+    Shrimp_Value result = Shrimp_function_alloc_temp(func, 8);
+    Shrimp_Instr instr = {
+        .t = SHRIMP_IT_CALL,
+        .call = {
+            .func = callee,
+            .result = result.t,
+            .argc = argc
+        }
+    };
+    Shrimp_function_push(func, instr);
+    return result;
+}
+
+bool Shrimp_instr_is_binop(uint8_t t) {
+    switch (t) {
+        case SHRIMP_IT_ADD: case SHRIMP_IT_SUB: case SHRIMP_IT_MUL: case SHRIMP_IT_DIV:
+        case SHRIMP_IT_CMP_LT: case SHRIMP_IT_CMP_MT: case SHRIMP_IT_SHL: case SHRIMP_IT_SHR: case SHRIMP_IT_MULHU: return true;
+        default: return false;
+    }
+}
+
+void Shrimp_instr_set_def(Shrimp_Instr* instr, uint32_t temp) {
+    if (instr->t == SHRIMP_IT_ASSIGN) instr->assign.into = temp;
+    else if (instr->t == SHRIMP_IT_CALL) instr->call.result = temp;
+    else instr->binop.result = temp;
+}
+
+bool Shrimp_instr_may_trap(const Shrimp_Function* func, const Shrimp_Instr* instr) {
+    if (instr->t != SHRIMP_IT_DIV) return false;
+    return !SHRIMP_REF_IS_CONST(instr->binop.r) || Shrimp_function_const(func, instr->binop.r) == 0;
+}
+
+bool Shrimp_instr_is_branch(uint8_t t) {
+    return t == SHRIMP_IT_JUMP_IF_NOT || t == SHRIMP_IT_JUMP_IF;
+}
+
+bool Shrimp_function_falls_to(const Shrimp_Function* func, uint32_t at, Shrimp_Label label) {
+    for (; at < func->count && (func->items[at].t == SHRIMP_IT_LABEL || func->items[at].t == SHRIMP_IT_NOP); at++) {
+        if (func->items[at].t == SHRIMP_IT_LABEL && func->items[at].label == label) return true;
+    }
+    return false;
+}
+
+// how many jumps are followed looking for the return, so a loop of them can't hang
+#define SHRIMP_TAIL_CALL_MAX_JUMPS 8
+
+bool Shrimp_function_is_tail_call(const Shrimp_Function* func, uint32_t at) {
+    uint32_t result = func->items[at].call.result;
+    size_t jumps = 0;
+    for (uint32_t i = at + 1; i < func->count;) {
+        const Shrimp_Instr* instr = &func->items[i];
+        if (instr->t == SHRIMP_IT_NOP || instr->t == SHRIMP_IT_LABEL) {
+            i++;
+            continue;
+        }
+        if (instr->t == SHRIMP_IT_RETURN) return !SHRIMP_REF_IS_CONST(instr->ret) && SHRIMP_REF_INDEX(instr->ret) == result;
+        if (instr->t != SHRIMP_IT_JUMP || ++jumps > SHRIMP_TAIL_CALL_MAX_JUMPS) return false;
+        Shrimp_Label to = instr->jmp.to;
+        for (i = 0; i < func->count && !(func->items[i].t == SHRIMP_IT_LABEL && func->items[i].label == to); i++);
+    }
+    return false;
+}
+
+typedef bool (*Shrimp_BinopFold)(uint64_t l, uint64_t r, uint64_t* out);
+
+static bool Shrimp_fold_add(uint64_t l, uint64_t r, uint64_t* out) { *out = l + r; return true; }
+static bool Shrimp_fold_sub(uint64_t l, uint64_t r, uint64_t* out) { *out = l - r; return true; }
+static bool Shrimp_fold_mul(uint64_t l, uint64_t r, uint64_t* out) { *out = l * r; return true; }
+static bool Shrimp_fold_cmp_lt(uint64_t l, uint64_t r, uint64_t* out) { *out = l < r; return true; }
+static bool Shrimp_fold_cmp_mt(uint64_t l, uint64_t r, uint64_t* out) { *out = l > r; return true; }
+static bool Shrimp_fold_shl(uint64_t l, uint64_t r, uint64_t* out) { *out = l << (r & 63); return true; }
+static bool Shrimp_fold_shr(uint64_t l, uint64_t r, uint64_t* out) { *out = l >> (r & 63); return true; }
+static bool Shrimp_fold_mulhu(uint64_t l, uint64_t r, uint64_t* out) { *out = (uint64_t)(((unsigned __int128)l * r) >> 64); return true; }
+
+static bool Shrimp_fold_div(uint64_t l, uint64_t r, uint64_t* out) {
+    // leave the division by zero for the runtime to trap on
+    if (r == 0) return false;
+    *out = l / r;
+    return true;
+}
+
+// What every binop computes, everything that folds goes through here so the passes can't disagree about it
+static const Shrimp_BinopFold shrimp_binop_folds[] = {
+    [SHRIMP_IT_ADD] = Shrimp_fold_add,
+    [SHRIMP_IT_SUB] = Shrimp_fold_sub,
+    [SHRIMP_IT_MUL] = Shrimp_fold_mul,
+    [SHRIMP_IT_DIV] = Shrimp_fold_div,
+    [SHRIMP_IT_CMP_LT] = Shrimp_fold_cmp_lt,
+    [SHRIMP_IT_CMP_MT] = Shrimp_fold_cmp_mt,
+    [SHRIMP_IT_SHL] = Shrimp_fold_shl,
+    [SHRIMP_IT_SHR] = Shrimp_fold_shr,
+    [SHRIMP_IT_MULHU] = Shrimp_fold_mulhu,
+};
+
+bool Shrimp_eval_binop(uint8_t t, uint64_t l, uint64_t r, uint64_t* out) {
+    if (t >= sizeof(shrimp_binop_folds) / sizeof(shrimp_binop_folds[0]) || shrimp_binop_folds[t] == NULL) return false;
+    return shrimp_binop_folds[t](l, r, out);
+}
+
+size_t Shrimp_instr_operands(Shrimp_Instr* instr, Shrimp_Ref* out[2]) {
+    switch (instr->t) {
+        case SHRIMP_IT_ADD: case SHRIMP_IT_SUB: case SHRIMP_IT_MUL: case SHRIMP_IT_DIV:
+        case SHRIMP_IT_CMP_LT: case SHRIMP_IT_CMP_MT: case SHRIMP_IT_SHL: case SHRIMP_IT_SHR: case SHRIMP_IT_MULHU: {
+            out[0] = &instr->binop.l;
+            out[1] = &instr->binop.r;
+            return 2;
+        }
+        case SHRIMP_IT_ASSIGN: out[0] = &instr->assign.v; return 1;
+        case SHRIMP_IT_RETURN: out[0] = &instr->ret; return 1;
+        case SHRIMP_IT_JUMP_IF_NOT: case SHRIMP_IT_JUMP_IF: out[0] = &instr->jmp_if_not.cond; return 1;
+        case SHRIMP_IT_ARG: out[0] = &instr->arg; return 1;
+        case SHRIMP_IT_JUMP: case SHRIMP_IT_LABEL: case SHRIMP_IT_NOP: case SHRIMP_IT_CALL: return 0;
+    }
+    return 0;
+}
+
+bool Shrimp_instr_def(const Shrimp_Instr* instr, uint32_t* out) {
+    switch (instr->t) {
+        case SHRIMP_IT_ADD: case SHRIMP_IT_SUB: case SHRIMP_IT_MUL: case SHRIMP_IT_DIV:
+        case SHRIMP_IT_CMP_LT: case SHRIMP_IT_CMP_MT: case SHRIMP_IT_SHL: case SHRIMP_IT_SHR: case SHRIMP_IT_MULHU: {
+            *out = instr->binop.result;
+            return true;
+        }
+        case SHRIMP_IT_ASSIGN: *out = instr->assign.into; return true;
+        case SHRIMP_IT_CALL: *out = instr->call.result; return true;
+        default: return false;
+    }
+}
+
+bool Shrimp_function_has_uses(const Shrimp_Function* func) {
+    return func->uses.count == func->temps.count;
+}
+
+static void Shrimp_instr_list_remove(Shrimp_InstrList* list, uint32_t instr) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->items[i] == instr) {
+            list->items[i] = list->items[--list->count];
+            return;
+        }
+    }
+    assert(false && "The def-use chains are out of sync with the instructions");
+}
+
+static void Shrimp_function_link_instr(Shrimp_Function* func, uint32_t index) {
+    Shrimp_Instr* instr = &func->items[index];
+    Shrimp_Ref* ops[2];
+    size_t n = Shrimp_instr_operands(instr, ops);
+    for (size_t i = 0; i < n; i++) {
+        if (!SHRIMP_REF_IS_CONST(*ops[i])) Shrimp_da_push(&func->uses.items[*ops[i]].uses, index);
+    }
+    uint32_t def;
+    if (Shrimp_instr_def(instr, &def)) Shrimp_da_push(&func->uses.items[def].defs, index);
+}
+
+static void Shrimp_function_unlink_instr(Shrimp_Function* func, uint32_t index) {
+    Shrimp_Instr* instr = &func->items[index];
+    Shrimp_Ref* ops[2];
+    size_t n = Shrimp_instr_operands(instr, ops);
+    for (size_t i = 0; i < n; i++) {
+        if (!SHRIMP_REF_IS_CONST(*ops[i])) Shrimp_instr_list_remove(&func->uses.items[*ops[i]].uses, index);
+    }
+    uint32_t def;
+    if (Shrimp_instr_def(instr, &def)) Shrimp_instr_list_remove(&func->uses.items[def].defs, index);
+}
+
+void Shrimp_function_free_uses(Shrimp_Function* func) {
+    for (size_t i = 0; i < func->uses.count; i++) {
+        Shrimp_da_free(&func->uses.items[i].defs);
+        Shrimp_da_free(&func->uses.items[i].uses);
+    }
+    Shrimp_da_free(&func->uses);
+    func->uses = (Shrimp_Uses){0};
+}
+
+void Shrimp_function_build_uses(Shrimp_Function* func) {
+    Shrimp_function_free_uses(func);
+    func->uses.capacity = func->temps.count ? func->temps.count : 1;
+    func->uses.count = func->temps.count;
+    func->uses.items = calloc(func->uses.capacity, sizeof(Shrimp_TempUses));
+    for (size_t i = 0; i < func->count; i++) Shrimp_function_link_instr(func, i);
+}
+
+void Shrimp_function_push(Shrimp_Function* func, Shrimp_Instr instr) {
+    assert(func->count < SHRIMP_NO_INSTR);
+    Shrimp_da_push(func, instr);
+    if (Shrimp_function_has_uses(func)) Shrimp_function_link_instr(func, func->count - 1);
+}
+
+void Shrimp_function_set_instr(Shrimp_Function* func, size_t index, Shrimp_Instr instr) {
+    bool has_uses = Shrimp_function_has_uses(func);
+    if (has_uses) Shrimp_function_unlink_instr(func, index);
+    func->items[index] = instr;
+    if (has_uses) Shrimp_function_link_instr(func, index);
+}
+
+void Shrimp_function_remove_instr(Shrimp_Function* func, size_t index) {
+    Shrimp_function_set_instr(func, index, (Shrimp_Instr){.t = SHRIMP_IT_NOP});
+}
+
+void Shrimp_function_compact(Shrimp_Function* func) {
+    size_t kept = 0;
+    for (size_t i = 0; i < func->count; i++) {
+        if (func->items[i].t != SHRIMP_IT_NOP) func->items[kept++] = func->items[i];
+    }
+    if (kept == func->count) return;
+    func->count = kept;
+    if (Shrimp_function_has_uses(func)) Shrimp_function_build_uses(func);
+}
+
+void Shrimp_function_insert(Shrimp_Function* func, size_t index, const Shrimp_Instr* instrs, size_t count) {
+    assert(index <= func->count);
+    if (count == 0) return;
+    // grow through the push so borrowed items get copied out
+    for (size_t i = 0; i < count; i++) Shrimp_da_push(func, (Shrimp_Instr){.t = SHRIMP_IT_NOP});
+    assert(func->count < SHRIMP_NO_INSTR);
+    memmove(&func->items[index + count], &func->items[index], sizeof(Shrimp_Instr) * (func->count - count - index));
+    memcpy(&func->items[index], instrs, sizeof(Shrimp_Instr) * count);
+    if (Shrimp_function_has_uses(func)) Shrimp_function_build_uses(func);
+}
+
+void Shrimp_function_replace_uses(Shrimp_Function* func, uint32_t temp, Shrimp_Ref with) {
+    assert(Shrimp_function_has_uses(func));
+    if (temp == with) return;
+    Shrimp_InstrList* uses = &func->uses.items[temp].uses;
+    for (size_t i = 0; i < uses->count; i++) {
+        uint32_t index = uses->items[i];
+        Shrimp_Ref* ops[2];
+        size_t n = Shrimp_instr_operands(&func->items[index], ops);
+        for (size_t j = 0; j < n; j++) {
+            if (*ops[j] != temp) continue;
+            *ops[j] = with;
+            if (!SHRIMP_REF_IS_CONST(with)) Shrimp_da_push(&func->uses.items[with].uses, index);
+        }
+    }
+    uses->count = 0;
+}
+
+bool Shrimp_function_temp_is_dead(const Shrimp_Function* func, uint32_t temp) {
+    assert(Shrimp_function_has_uses(func));
+    return func->uses.items[temp].uses.count == 0;
+}
+
+uint32_t Shrimp_function_temp_def(const Shrimp_Function* func, uint32_t temp) {
+    assert(Shrimp_function_has_uses(func));
+    const Shrimp_InstrList* defs = &func->uses.items[temp].defs;
+    if (temp < func->param_count) return SHRIMP_NO_INSTR;
+    return defs->count == 1 ? defs->items[0] : SHRIMP_NO_INSTR;
+}
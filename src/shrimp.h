@@ -0,0 +1,415 @@
+#ifndef SHRIMP_H_
+#define SHRIMP_H_
+
+// ---- IR ----
+// This contains all of the logic that should be treated as external (since I'll probably make this a separate library)
+// for generating final executables or other target files
+// NO internal logic of Bong should be here
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    SHRIMP_IT_ADD,
+    SHRIMP_IT_SUB,
+    SHRIMP_IT_MUL,
+    SHRIMP_IT_DIV,
+    SHRIMP_IT_JUMP,
+    SHRIMP_IT_LABEL,
+    SHRIMP_IT_CMP_LT,
+    SHRIMP_IT_CMP_MT,
+    SHRIMP_IT_ASSIGN,
+    SHRIMP_IT_RETURN,
+    SHRIMP_IT_JUMP_IF_NOT,
+    // only made by the strength reduction, the shift amount is taken modulo 64 like on x86
+    SHRIMP_IT_SHL,
+    SHRIMP_IT_SHR,
+    // the upper 64 bits of the unsigned 128 bit product
+    SHRIMP_IT_MULHU,
+    // left behind by passes that delete instructions, dropped by Shrimp_function_compact
+    SHRIMP_IT_NOP,
+    // only made by loop rotation, jumps when the condition isn't 0 and has the operands of SHRIMP_IT_JUMP_IF_NOT
+    SHRIMP_IT_JUMP_IF,
+    // the arguments of a call, in order and right in front of the SHRIMP_IT_CALL they belong to (nops may be between)
+    SHRIMP_IT_ARG,
+    // calls another function of the module, which has no effect other than what it returns (if it returns at all)
+    SHRIMP_IT_CALL,
+} Shrimp_InstrType;
+
+typedef enum {
+    SHRIMP_VK_CONST,
+    SHRIMP_VK_TEMP,
+} Shrimp_ValueKind;
+
+// One entry of the per-function temp table, the instructions only refer to it by index
+typedef struct {
+    uint32_t index;
+    uint32_t size;
+    uint32_t offset;
+} Shrimp_Temp;
+
+typedef uint32_t Shrimp_Label;
+
+// Operand of a packed instruction
+// If the top bit is set the rest is an index into the constant pool of the function,
+// otherwise it's an index into the temp table
+typedef uint32_t Shrimp_Ref;
+#define SHRIMP_REF_CONST_BIT ((Shrimp_Ref)1 << 31)
+#define SHRIMP_REF_IS_CONST(ref) (((ref) & SHRIMP_REF_CONST_BIT) != 0)
+#define SHRIMP_REF_INDEX(ref) ((ref) & ~SHRIMP_REF_CONST_BIT)
+
+// What the user of the library passes around when building the IR
+typedef struct {
+    Shrimp_ValueKind kind;
+    union {
+        uint64_t c;
+        uint32_t t;
+    };
+} Shrimp_Value;
+
+// 16 bytes: 1 byte opcode + up to 3 32-bit operands
+typedef struct {
+    uint8_t t;
+    union {
+        uint32_t ops[3];
+        Shrimp_Ref ret;
+        struct {
+            Shrimp_Ref v;
+            uint32_t into;
+        } assign;
+        struct {
+            Shrimp_Ref l;
+            Shrimp_Ref r;
+            uint32_t result;
+        } binop;
+        struct {
+            Shrimp_Ref cond;
+            Shrimp_Label to;
+            // how often the jump was and wasn't taken relative to each other according to the profile
+            // both are 0 when there's no profile for it, see Shrimp_module_profile_use
+            uint16_t taken;
+            uint16_t not_taken;
+        } jmp_if_not;
+        struct {
+            Shrimp_Label to;
+        } jmp;
+        Shrimp_Label label;
+        Shrimp_Ref arg;
+        struct {
+            // index of the callee in the module
+            uint32_t func;
+            uint32_t result;
+            // how many SHRIMP_IT_ARG come before it, always the callee's param_count
+            uint32_t argc;
+        } call;
+    };
+} Shrimp_Instr;
+
+typedef struct {
+    Shrimp_Temp* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_Temps;
+
+typedef struct {
+    uint64_t* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_Consts;
+
+// Open addressing table from the constants to their index in the pool, so every value is in there only once
+// Only valid while it has as many entries as the pool, Shrimp_function_const_ref rebuilds it otherwise
+typedef struct {
+    // index into the pool + 1, 0 for an empty slot
+    uint32_t* slots;
+    size_t capacity;
+    size_t count;
+} Shrimp_ConstMap;
+
+#define SHRIMP_NO_INSTR UINT32_MAX
+
+// Indices of instructions in a function body
+typedef struct {
+    uint32_t* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_InstrList;
+
+// Def-use chain of one temp
+// uses has one entry per operand, so `$2 <- $1 + $1` is in the uses of $1 twice
+typedef struct {
+    Shrimp_InstrList defs;
+    Shrimp_InstrList uses;
+} Shrimp_TempUses;
+
+// Parallel to the temp table, only valid while it has as many entries as there are temps
+typedef struct {
+    Shrimp_TempUses* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_Uses;
+
+typedef struct {
+    const char* name;
+    // the first param_count temps hold the arguments when the function starts
+    uint32_t param_count;
+    // visible outside of the module and called with the SysV AMD64 convention, the rest are only called from inside it
+    bool exported;
+    int64_t current_offset;
+    size_t last_allocated_size;
+    Shrimp_Label label_count;
+    Shrimp_Temps temps;
+    Shrimp_Consts consts;
+    Shrimp_ConstMap const_map;
+    Shrimp_Uses uses;
+    // body
+    size_t count;
+    size_t capacity;
+    Shrimp_Instr* items;
+} Shrimp_Function;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Shrimp_Function* items;
+    const char* name;
+    // set when the module was mapped in from a bytecode file, the functions borrow their arrays from it
+    void* mapping;
+    size_t mapping_size;
+    // how many instructions an unrolled loop may grow to, 0 for the default, set from Shrimp_CompOptions
+    size_t unroll_threshold;
+    // how many instructions the compile time evaluation may run per function, 0 for the default
+    size_t eval_fuel;
+    // how big a function may be to get inlined into a call, 0 for the default
+    size_t inline_threshold;
+    // how many instructions unswitching may add to a function, 0 for the default
+    size_t unswitch_threshold;
+    // set for instrumented builds, the program writes its profile here when it exits
+    const char* profile_output;
+} Shrimp_Module;
+
+typedef enum {
+    SHRIMP_TARGET_X86_64_NASM_LINUX,
+    SHRIMP_TARGET_COUNT
+} Shrimp_Target;
+
+typedef enum {
+    SHRIMP_OUTPUT_ASM,
+    SHRIMP_OUTPUT_OBJ,
+    SHRIMP_OUTPUT_EXE,
+} Shrimp_OutputKind;
+
+typedef enum {
+    SHRIMP_OPT_NONE       = 0,
+    SHRIMP_OPT_CONST_FOLD = 1,
+    SHRIMP_OPT_DEAD_CODE  = 2,
+    SHRIMP_OPT_INLINE     = 4,
+    SHRIMP_OPT_SCCP       = 8,
+    SHRIMP_OPT_COPY_PROP  = 16,
+    SHRIMP_OPT_LOCAL_CSE  = 32,
+    SHRIMP_OPT_GLOBAL_CSE = 64,
+    SHRIMP_OPT_LICM       = 128,
+    SHRIMP_OPT_STRENGTH   = 256,
+    SHRIMP_OPT_IV         = 512,
+    SHRIMP_OPT_UNROLL     = 1024,
+    SHRIMP_OPT_SCEV       = 2048,
+    SHRIMP_OPT_EVAL       = 4096,
+    SHRIMP_OPT_SIMPLIFY_CFG = 8192,
+    SHRIMP_OPT_ROTATE     = 16384,
+    SHRIMP_OPT_ALGEBRA    = 32768,
+    SHRIMP_OPT_LAYOUT     = 65536,
+    SHRIMP_OPT_RANGE      = 131072,
+    SHRIMP_OPT_TAIL_REC   = 262144,
+    SHRIMP_OPT_UNSWITCH   = 524288,
+    SHRIMP_OPT_DROP_UNUSED = 1048576,
+} Shrimp_OptFlags;
+
+typedef enum {
+    SHRIMP_O0,
+    SHRIMP_O1,
+    SHRIMP_O2,
+    // like O2 but without the passes that trade size for speed
+    SHRIMP_OS,
+} Shrimp_OptLevel;
+
+typedef struct {
+    Shrimp_Target target;
+    Shrimp_OutputKind output_kind;
+    Shrimp_OptFlags opts;
+    // Comma separated pass names run in that order instead of the default pipeline built from `opts`
+    // Passes inside of [] are rerun as a group until none of them changes anything
+    const char* passes;
+    // Print the time and the change in instruction count of every pass to stderr
+    bool time_passes;
+    // How many instructions a loop may grow to by unrolling it, 0 for the default
+    size_t unroll_threshold;
+    // How many instructions a function may run at compile time to be replaced by its result, 0 for the default
+    size_t eval_fuel;
+    // How many instructions a function may have to be inlined into its callers, 0 for the default
+    size_t inline_threshold;
+    // How many instructions unswitching loops may add to a function, 0 for the default
+    size_t unswitch_threshold;
+    // Builds the program unoptimized with counters on every block and branch that get written to this file
+    // when it exits, so that the counters line up with the IR a later build reads them back into
+    const char* profile_generate;
+    // A profile written by a -fprofile-generate build of the same program, read into the branch weights
+    const char* profile_use;
+    // TODO: bool emit_debug_info;
+    const char* output_name;
+    // if set the module gets written here as bytecode after optimizing
+    const char* bytecode_output;
+} Shrimp_CompOptions;
+
+// user facing code (generating the IR)
+Shrimp_Module Shrimp_module_new(const char* name);
+void Shrimp_module_cleanup(Shrimp_Module mod);
+Shrimp_Function* Shrimp_module_new_function(Shrimp_Module* mod, const char* name);
+// Index of the function with that name, SHRIMP_NO_FUNCTION if there's none
+#define SHRIMP_NO_FUNCTION UINT32_MAX
+uint32_t Shrimp_module_find_function(const Shrimp_Module* mod, const char* name);
+// Params have to be added before anything else allocates a temp
+Shrimp_Value Shrimp_function_add_param(Shrimp_Function* func);
+Shrimp_Label Shrimp_function_label_alloc(Shrimp_Function* func);
+void Shrimp_function_label_push(Shrimp_Function* func, Shrimp_Label label);
+void Shrimp_function_return(Shrimp_Function* func, Shrimp_Value value);
+Shrimp_Value Shrimp_function_add(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
+Shrimp_Value Shrimp_function_sub(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
+Shrimp_Value Shrimp_function_mul(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
+Shrimp_Value Shrimp_function_div(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
+Shrimp_Value Shrimp_function_cmp_lt(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
+Shrimp_Value Shrimp_function_cmp_mt(Shrimp_Function* func, Shrimp_Value l, Shrimp_Value r);
+void Shrimp_function_jump_if_not(Shrimp_Function* func, Shrimp_Value v, Shrimp_Label l);
+void Shrimp_function_jump(Shrimp_Function* func, Shrimp_Label l);
+Shrimp_Value Shrimp_function_alloc_temp(Shrimp_Function* func, size_t size);
+void Shrimp_function_assign_temp(Shrimp_Function* func, Shrimp_Value target, Shrimp_Value value);
+// Calls the function at index `callee` of the module, which has to take `argc` params
+Shrimp_Value Shrimp_function_call(Shrimp_Function* func, uint32_t callee, const Shrimp_Value* args, size_t argc);
+Shrimp_Value Shrimp_value_make_const(uint64_t num);
+
+// packed operand helpers
+Shrimp_Ref Shrimp_function_ref(Shrimp_Function* func, Shrimp_Value value);
+Shrimp_Ref Shrimp_function_const_ref(Shrimp_Function* func, uint64_t c);
+uint64_t Shrimp_function_const(const Shrimp_Function* func, Shrimp_Ref ref);
+const Shrimp_Temp* Shrimp_function_temp(const Shrimp_Function* func, uint32_t index);
+// Forgets the temps allocated after the first `count`, nothing may refer to them anymore
+void Shrimp_function_truncate_temps(Shrimp_Function* func, size_t count);
+// Drops the constants no instruction refers to anymore and renumbers the refs to the rest
+void Shrimp_function_compact_consts(Shrimp_Function* func);
+// Drops the temps no instruction reads or writes anymore, the rest (params first) get renumbered in order and
+// laid out again so they take up no more of the frame than needed
+void Shrimp_function_compact_temps(Shrimp_Function* func);
+
+// def-use chains
+// The builders keep them up to date, passes that edit instructions should go through Shrimp_function_set_instr
+// Functions mapped in from bytecode don't have them until Shrimp_function_build_uses is called
+bool Shrimp_function_has_uses(const Shrimp_Function* func);
+void Shrimp_function_build_uses(Shrimp_Function* func);
+void Shrimp_function_free_uses(Shrimp_Function* func);
+void Shrimp_function_push(Shrimp_Function* func, Shrimp_Instr instr);
+void Shrimp_function_set_instr(Shrimp_Function* func, size_t index, Shrimp_Instr instr);
+void Shrimp_function_remove_instr(Shrimp_Function* func, size_t index);
+// Drops the removed instructions, this renumbers the body so the chains get rebuilt
+void Shrimp_function_compact(Shrimp_Function* func);
+// Inserts the instructions before `index`, this renumbers the body as well
+void Shrimp_function_insert(Shrimp_Function* func, size_t index, const Shrimp_Instr* instrs, size_t count);
+void Shrimp_function_replace_uses(Shrimp_Function* func, uint32_t temp, Shrimp_Ref with);
+bool Shrimp_function_temp_is_dead(const Shrimp_Function* func, uint32_t temp);
+// The only instruction writing to the temp or SHRIMP_NO_INSTR if there are none or several
+// Params are written on entry as well, so they never have one
+uint32_t Shrimp_function_temp_def(const Shrimp_Function* func, uint32_t temp);
+
+// Points `out` at the operands the instruction reads and returns how many there are
+size_t Shrimp_instr_operands(Shrimp_Instr* instr, Shrimp_Ref* out[2]);
+// Returns true and sets `out` if the instruction writes to a temp
+bool Shrimp_instr_def(const Shrimp_Instr* instr, uint32_t* out);
+
+void Shrimp_module_dump(FILE* file, Shrimp_Module mod);
+void Shrimp_ref_dump(FILE* file, const Shrimp_Function* func, Shrimp_Ref ref);
+
+// Parses the textual form printed by Shrimp_module_dump back into a module, path is only used for errors
+bool Shrimp_module_parse(const char* path, const char* text, size_t len, Shrimp_Module* out);
+
+// Bytecode
+// A versioned binary image of a module, laid out so that it can be mapped back in without any parsing
+// The layout is native (endianness and the in memory Shrimp_Instr), both are checked on load
+#define SHRIMP_BYTECODE_MAGIC "SHRIMPBC"
+#define SHRIMP_BYTECODE_VERSION 4
+bool Shrimp_module_write_bytecode(const Shrimp_Module* mod, const char* path);
+// The mapping is private so optimizing a mapped module is fine, it is released by Shrimp_module_cleanup
+bool Shrimp_module_map_bytecode(const char* path, Shrimp_Module* out);
+
+bool Shrimp_module_verify(const Shrimp_Module* mod);
+bool Shrimp_module_compile(Shrimp_Module* mod, Shrimp_CompOptions opts);
+
+// Pass manager
+// Every pass returns whether it changed anything, which is what the [] groups iterate on
+typedef bool (*Shrimp_PassFn)(Shrimp_Module* mod);
+typedef struct {
+    const char* name;
+    // the flag that enables it in the default pipeline
+    Shrimp_OptFlags flag;
+    Shrimp_PassFn run;
+} Shrimp_Pass;
+
+Shrimp_OptFlags Shrimp_opt_level_flags(Shrimp_OptLevel level);
+const Shrimp_Pass* Shrimp_pass_find(const char* name, size_t len);
+bool Shrimp_module_optimize(Shrimp_Module* mod, Shrimp_CompOptions opts);
+bool Shrimp_module_run_passes(Shrimp_Module* mod, const char* pipeline, bool time_passes);
+// number of instructions in the module, what the pass statistics measure
+size_t Shrimp_module_instr_count(const Shrimp_Module* mod);
+
+// Passes
+bool Shrimp_module_const_fold(Shrimp_Module* mod);
+// Applies algebraic identities, puts operands in a canonical order and reassociates chains with constants
+bool Shrimp_module_algebra(Shrimp_Module* mod);
+// Runs functions at compile time and replaces the ones that return within the fuel by returning the result
+bool Shrimp_module_eval(Shrimp_Module* mod);
+// Sparse conditional constant propagation, also removes the code in blocks that can't be reached
+bool Shrimp_module_sccp(Shrimp_Module* mod);
+// Removes unreachable blocks, unused labels and stores to temps that are never read again
+bool Shrimp_module_dce(Shrimp_Module* mod);
+// Threads jumps to where they end up, folds constant branches and merges blocks only reached by one jump
+bool Shrimp_module_simplify_cfg(Shrimp_Module* mod);
+// Makes instructions write straight into the temp their result gets copied to and reads of copies read the original
+bool Shrimp_module_copy_prop(Shrimp_Module* mod);
+// Value numbering, turns recomputations of a binop whose result is still around into copies of it
+// lvn only looks inside of single blocks, gvn also at what the dominators computed
+bool Shrimp_module_lvn(Shrimp_Module* mod);
+bool Shrimp_module_gvn(Shrimp_Module* mod);
+// Moves computations that give the same result in every iteration in front of the loop
+bool Shrimp_module_licm(Shrimp_Module* mod);
+// Turns multiplications and divisions by constants into shifts and multiplications by magic numbers
+bool Shrimp_module_strength_reduce(Shrimp_Module* mod);
+// Turns multiplications of a loop's counters into additions in step with them and drops counters that are left unused
+bool Shrimp_module_iv(Shrimp_Module* mod);
+// Replaces loops that only sum up affine functions of their counter by the closed form of what they leave behind
+bool Shrimp_module_scev(Shrimp_Module* mod);
+// Unrolls counted loops, completely if the trip count is known and small enough, otherwise by a factor
+bool Shrimp_module_unroll(Shrimp_Module* mod);
+// Moves the test of while loops to the bottom behind a copy of it guarding the loop, saving a jump per round
+bool Shrimp_module_rotate(Shrimp_Module* mod);
+// Takes tests of conditions a loop never changes out of it, the loop is duplicated for either outcome
+bool Shrimp_module_unswitch(Shrimp_Module* mod);
+// Replaces calls to small functions by their body
+bool Shrimp_module_inline(Shrimp_Module* mod);
+// Drops the functions that can't be called anymore from the entry or an exported function
+bool Shrimp_module_drop_unused(Shrimp_Module* mod);
+// Turns calls of functions to themselves in tail position into jumps back to their start
+bool Shrimp_module_tailrec(Shrimp_Module* mod);
+// Moves the code a branch mostly jumps around to the end of the function so the likely way falls through
+// Only does anything with branch weights from a profile
+bool Shrimp_module_layout(Shrimp_Module* mod);
+// Works out the range of values every temp can hold, folds the comparisons that decides and narrows temps to 32 bits
+bool Shrimp_module_range(Shrimp_Module* mod);
+
+// Profiles
+// Reads what an instrumented build wrote into the weights of the branches, the module has to be the same
+// unoptimized IR that build was made from, functions that don't match keep no weights
+bool Shrimp_module_profile_use(Shrimp_Module* mod, const char* path);
+bool Shrimp_module_x86_64_nasm_linux_compile(const Shrimp_Module* mod, Shrimp_CompOptions opts);
+
+// codegen part ( TODO: add function to generate code according to the supported targets )
+bool Shrimp_module_x86_64_dump_nasm_mod(const Shrimp_Module* mod, FILE* file);
+
+#endif
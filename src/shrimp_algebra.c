@@ -0,0 +1,178 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Algebraic simplification
+// Works on every binop by itself, unlike the folders it doesn't need both operands to be known:
+//   - both operands constant: folded, except for division by zero which is left to trap at runtime
+//   - canonical operand order: constants go right in commutative operations and `c < x` becomes `x > c`,
+//     two temps go in index order so value numbering sees `a + b` and `b + a` as the same
+//   - the identities in the rule table below
+//   - chains with constants are reassociated, `(x + 1) + 2` -> `x + 3`, when the inner result is computed
+//     earlier in the same block and x isn't written in between
+
+typedef enum {
+    SHRIMP_ALGEBRA_R_CONST,
+    SHRIMP_ALGEBRA_L_CONST,
+    SHRIMP_ALGEBRA_SAME,
+} Shrimp_AlgebraMatch;
+
+typedef enum {
+    SHRIMP_ALGEBRA_GIVES_L,
+    SHRIMP_ALGEBRA_GIVES_CONST,
+} Shrimp_AlgebraGives;
+
+typedef struct {
+    uint8_t t;
+    Shrimp_AlgebraMatch match;
+    // the constant the operand has to be for R_CONST and L_CONST
+    uint64_t c;
+    Shrimp_AlgebraGives gives;
+    // the result for GIVES_CONST
+    uint64_t value;
+} Shrimp_AlgebraRule;
+
+// Looked at after canonicalizing, so a constant of a commutative operation or comparison is always on the right
+static const Shrimp_AlgebraRule shrimp_algebra_rules[] = {
+    {SHRIMP_IT_ADD,    SHRIMP_ALGEBRA_R_CONST, 0, SHRIMP_ALGEBRA_GIVES_L,     0},
+    {SHRIMP_IT_SUB,    SHRIMP_ALGEBRA_R_CONST, 0, SHRIMP_ALGEBRA_GIVES_L,     0},
+    {SHRIMP_IT_SUB,    SHRIMP_ALGEBRA_SAME,    0, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    {SHRIMP_IT_MUL,    SHRIMP_ALGEBRA_R_CONST, 0, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    {SHRIMP_IT_MUL,    SHRIMP_ALGEBRA_R_CONST, 1, SHRIMP_ALGEBRA_GIVES_L,     0},
+    {SHRIMP_IT_DIV,    SHRIMP_ALGEBRA_R_CONST, 1, SHRIMP_ALGEBRA_GIVES_L,     0},
+    {SHRIMP_IT_SHL,    SHRIMP_ALGEBRA_R_CONST, 0, SHRIMP_ALGEBRA_GIVES_L,     0},
+    {SHRIMP_IT_SHL,    SHRIMP_ALGEBRA_L_CONST, 0, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    {SHRIMP_IT_SHR,    SHRIMP_ALGEBRA_R_CONST, 0, SHRIMP_ALGEBRA_GIVES_L,     0},
+    {SHRIMP_IT_SHR,    SHRIMP_ALGEBRA_L_CONST, 0, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    {SHRIMP_IT_MULHU,  SHRIMP_ALGEBRA_R_CONST, 0, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    {SHRIMP_IT_MULHU,  SHRIMP_ALGEBRA_R_CONST, 1, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    {SHRIMP_IT_CMP_LT, SHRIMP_ALGEBRA_SAME,    0, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    // nothing is below 0 or above the largest value
+    {SHRIMP_IT_CMP_LT, SHRIMP_ALGEBRA_R_CONST, 0, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    {SHRIMP_IT_CMP_MT, SHRIMP_ALGEBRA_SAME,    0, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+    {SHRIMP_IT_CMP_MT, SHRIMP_ALGEBRA_R_CONST, UINT64_MAX, SHRIMP_ALGEBRA_GIVES_CONST, 0},
+};
+
+static bool Shrimp_algebra_is_const(const Shrimp_Function* f, Shrimp_Ref ref, uint64_t c) {
+    return SHRIMP_REF_IS_CONST(ref) && Shrimp_function_const(f, ref) == c;
+}
+
+static Shrimp_Instr Shrimp_algebra_assign(uint32_t into, Shrimp_Ref v) {
+    return (Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = into, .v = v}};
+}
+
+static void Shrimp_algebra_canonicalize(Shrimp_Instr* instr) {
+    Shrimp_Ref l = instr->binop.l;
+    Shrimp_Ref r = instr->binop.r;
+    bool l_const = SHRIMP_REF_IS_CONST(l);
+    bool r_const = SHRIMP_REF_IS_CONST(r);
+    bool swap = (l_const && !r_const) || (!l_const && !r_const && l > r);
+    switch (instr->t) {
+        case SHRIMP_IT_ADD: case SHRIMP_IT_MUL: case SHRIMP_IT_MULHU: break;
+        case SHRIMP_IT_CMP_LT: case SHRIMP_IT_CMP_MT: {
+            if (!swap) return;
+            instr->t = instr->t == SHRIMP_IT_CMP_LT ? SHRIMP_IT_CMP_MT : SHRIMP_IT_CMP_LT;
+            break;
+        }
+        default: return;
+    }
+    if (!swap) return;
+    instr->binop.l = r;
+    instr->binop.r = l;
+}
+
+// What the temp holds at `at` if it's `x op c` computed earlier in the same block, with x unchanged since
+static bool Shrimp_algebra_inner(const Shrimp_Function* f, uint32_t temp, uint32_t at, Shrimp_Instr* out) {
+    uint32_t def = Shrimp_function_temp_def(f, temp);
+    if (def == SHRIMP_NO_INSTR || def >= at) return false;
+    Shrimp_Instr inner = f->items[def];
+    if (!Shrimp_instr_is_binop(inner.t) || !SHRIMP_REF_IS_CONST(inner.binop.r) || SHRIMP_REF_IS_CONST(inner.binop.l)) return false;
+    for (uint32_t i = def + 1; i < at; i++) {
+        const Shrimp_Instr* between = &f->items[i];
+        uint32_t written;
+        if (between->t == SHRIMP_IT_LABEL || between->t == SHRIMP_IT_JUMP || between->t == SHRIMP_IT_RETURN || Shrimp_instr_is_branch(between->t)) return false;
+        if (Shrimp_instr_def(between, &written) && written == inner.binop.l) return false;
+    }
+    *out = inner;
+    return true;
+}
+
+// `(x op1 a) op2 b` as a single operation on x, returns false if there's no such thing
+static bool Shrimp_algebra_reassociate(Shrimp_Function* f, const Shrimp_Instr* inner, const Shrimp_Instr* outer, Shrimp_Instr* out) {
+    uint64_t a = Shrimp_function_const(f, inner->binop.r);
+    uint64_t b = Shrimp_function_const(f, outer->binop.r);
+    Shrimp_Ref x = inner->binop.l;
+    uint32_t result = outer->binop.result;
+    bool additive = inner->t == SHRIMP_IT_ADD || inner->t == SHRIMP_IT_SUB;
+    if (additive && (outer->t == SHRIMP_IT_ADD || outer->t == SHRIMP_IT_SUB)) {
+        uint64_t k = (inner->t == SHRIMP_IT_ADD ? a : -a) + (outer->t == SHRIMP_IT_ADD ? b : -b);
+        // whichever of `x + k` and `x - (-k)` has the smaller constant
+        bool sub = -k < k;
+        *out = (Shrimp_Instr){.t = sub ? SHRIMP_IT_SUB : SHRIMP_IT_ADD, .binop = {.l = x, .r = Shrimp_function_const_ref(f, sub ? -k : k), .result = result}};
+        return true;
+    }
+    if (inner->t == SHRIMP_IT_MUL && outer->t == SHRIMP_IT_MUL) {
+        *out = (Shrimp_Instr){.t = SHRIMP_IT_MUL, .binop = {.l = x, .r = Shrimp_function_const_ref(f, a * b), .result = result}};
+        return true;
+    }
+    if ((inner->t == SHRIMP_IT_SHL || inner->t == SHRIMP_IT_SHR) && outer->t == inner->t) {
+        // the amounts are taken modulo 64, together they might shift everything out
+        uint64_t shift = (a & 63) + (b & 63);
+        if (shift >= 64) *out = Shrimp_algebra_assign(result, Shrimp_function_const_ref(f, 0));
+        else *out = (Shrimp_Instr){.t = inner->t, .binop = {.l = x, .r = Shrimp_function_const_ref(f, shift), .result = result}};
+        return true;
+    }
+    return false;
+}
+
+// Returns whether the instruction at `index` was changed
+static bool Shrimp_algebra_instr(Shrimp_Function* f, uint32_t index) {
+    Shrimp_Instr instr = f->items[index];
+    if (!Shrimp_instr_is_binop(instr.t)) return false;
+    uint32_t result = instr.binop.result;
+    Shrimp_Instr out = instr;
+
+    if (SHRIMP_REF_IS_CONST(instr.binop.l) && SHRIMP_REF_IS_CONST(instr.binop.r)) {
+        uint64_t value;
+        if (!Shrimp_eval_binop(instr.t, Shrimp_function_const(f, instr.binop.l), Shrimp_function_const(f, instr.binop.r), &value)) return false;
+        Shrimp_function_set_instr(f, index, Shrimp_algebra_assign(result, Shrimp_function_const_ref(f, value)));
+        return true;
+    }
+
+    Shrimp_algebra_canonicalize(&out);
+    for (size_t i = 0; i < sizeof(shrimp_algebra_rules) / sizeof(shrimp_algebra_rules[0]); i++) {
+        const Shrimp_AlgebraRule* rule = &shrimp_algebra_rules[i];
+        if (rule->t != out.t) continue;
+        bool matches = false;
+        switch (rule->match) {
+            case SHRIMP_ALGEBRA_R_CONST: matches = Shrimp_algebra_is_const(f, out.binop.r, rule->c); break;
+            case SHRIMP_ALGEBRA_L_CONST: matches = Shrimp_algebra_is_const(f, out.binop.l, rule->c); break;
+            case SHRIMP_ALGEBRA_SAME: matches = out.binop.l == out.binop.r; break;
+        }
+        if (!matches) continue;
+        Shrimp_Ref v = rule->gives == SHRIMP_ALGEBRA_GIVES_L ? out.binop.l : Shrimp_function_const_ref(f, rule->value);
+        Shrimp_function_set_instr(f, index, Shrimp_algebra_assign(result, v));
+        return true;
+    }
+
+    Shrimp_Instr inner;
+    if (SHRIMP_REF_IS_CONST(out.binop.r) && !SHRIMP_REF_IS_CONST(out.binop.l) && Shrimp_algebra_inner(f, out.binop.l, index, &inner)) {
+        Shrimp_Instr combined;
+        if (Shrimp_algebra_reassociate(f, &inner, &out, &combined)) out = combined;
+    }
+
+    if (out.t == instr.t && out.binop.l == instr.binop.l && out.binop.r == instr.binop.r) return false;
+    Shrimp_function_set_instr(f, index, out);
+    return true;
+}
+
+bool Shrimp_module_algebra(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        for (uint32_t j = 0; j < f->count; j++) changed |= Shrimp_algebra_instr(f, j);
+    }
+    return changed;
+}
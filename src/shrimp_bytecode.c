@@ -0,0 +1,234 @@
+#include "shrimp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout (every section starts 8 byte aligned):
+//   Shrimp_BytecodeHeader
+//   Shrimp_BytecodeFunction[function_count]
+//   per function: temps, constants, instructions
+//   strings (null terminated names)
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t instr_size;
+    uint32_t function_count;
+    uint64_t name_offset;
+} Shrimp_BytecodeHeader;
+
+typedef struct {
+    uint64_t name_offset;
+    int64_t current_offset;
+    uint64_t last_allocated_size;
+    uint32_t label_count;
+    uint32_t param_count;
+    uint32_t exported;
+    uint32_t reserved;
+    uint64_t temps_offset;
+    uint64_t temps_count;
+    uint64_t consts_offset;
+    uint64_t consts_count;
+    uint64_t instrs_offset;
+    uint64_t instrs_count;
+} Shrimp_BytecodeFunction;
+
+#define SHRIMP_BYTECODE_BYTE_ORDER 0x01020304u
+
+static size_t Shrimp_bytecode_align(size_t offset) {
+    return (offset + 7) & ~(size_t)7;
+}
+
+static bool Shrimp_bytecode_write_at(FILE* file, size_t offset, const void* data, size_t size) {
+    if (fseek(file, offset, SEEK_SET) != 0) return false;
+    return fwrite(data, 1, size, file) == size;
+}
+
+// How many of the operand words an instruction actually uses, the rest is written out as zeroes
+// so that the same module always gives the same bytes
+static size_t Shrimp_bytecode_used_ops(uint8_t t) {
+    switch (t) {
+        case SHRIMP_IT_ADD: case SHRIMP_IT_SUB: case SHRIMP_IT_MUL: case SHRIMP_IT_DIV:
+        case SHRIMP_IT_CMP_LT: case SHRIMP_IT_CMP_MT: case SHRIMP_IT_SHL: case SHRIMP_IT_SHR: case SHRIMP_IT_MULHU: return 3;
+        // the third word holds the weights
+        case SHRIMP_IT_JUMP_IF_NOT: case SHRIMP_IT_JUMP_IF: return 3;
+        case SHRIMP_IT_ASSIGN: return 2;
+        case SHRIMP_IT_CALL: return 3;
+        case SHRIMP_IT_RETURN: case SHRIMP_IT_JUMP: case SHRIMP_IT_LABEL: case SHRIMP_IT_ARG: return 1;
+        case SHRIMP_IT_NOP: return 0;
+        default: return 3;
+    }
+}
+
+bool Shrimp_module_write_bytecode(const Shrimp_Module* mod, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]: Failed to open %s for writing: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    size_t offset = Shrimp_bytecode_align(sizeof(Shrimp_BytecodeHeader));
+    size_t funcs_offset = offset;
+    offset = Shrimp_bytecode_align(offset + sizeof(Shrimp_BytecodeFunction) * mod->count);
+
+    bool ok = true;
+    for (size_t i = 0; i < mod->count && ok; i++) {
+        const Shrimp_Function* f = &mod->items[i];
+        Shrimp_BytecodeFunction record = {
+            .current_offset = f->current_offset,
+            .last_allocated_size = f->last_allocated_size,
+            .label_count = f->label_count,
+            .param_count = f->param_count,
+            .exported = f->exported,
+            .temps_count = f->temps.count,
+            .consts_count = f->consts.count,
+            .instrs_count = f->count,
+        };
+        record.temps_offset = offset;
+        ok = ok && Shrimp_bytecode_write_at(file, offset, f->temps.items, sizeof(Shrimp_Temp) * f->temps.count);
+        offset = Shrimp_bytecode_align(offset + sizeof(Shrimp_Temp) * f->temps.count);
+
+        record.consts_offset = offset;
+        ok = ok && Shrimp_bytecode_write_at(file, offset, f->consts.items, sizeof(uint64_t) * f->consts.count);
+        offset = Shrimp_bytecode_align(offset + sizeof(uint64_t) * f->consts.count);
+
+        record.instrs_offset = offset;
+        for (size_t j = 0; j < f->count && ok; j++) {
+            Shrimp_Instr instr;
+            memset(&instr, 0, sizeof(instr));
+            instr.t = f->items[j].t;
+            memcpy(instr.ops, f->items[j].ops, sizeof(uint32_t) * Shrimp_bytecode_used_ops(instr.t));
+            ok = Shrimp_bytecode_write_at(file, offset + j * sizeof(Shrimp_Instr), &instr, sizeof(instr));
+        }
+        offset = Shrimp_bytecode_align(offset + sizeof(Shrimp_Instr) * f->count);
+
+        // names are only written at the end, remember where this function's one will go
+        ok = ok && Shrimp_bytecode_write_at(file, funcs_offset + i * sizeof(record), &record, sizeof(record));
+    }
+
+    Shrimp_BytecodeHeader header = {
+        .version = SHRIMP_BYTECODE_VERSION,
+        .byte_order = SHRIMP_BYTECODE_BYTE_ORDER,
+        .instr_size = sizeof(Shrimp_Instr),
+        .function_count = mod->count,
+    };
+    memcpy(header.magic, SHRIMP_BYTECODE_MAGIC, sizeof(header.magic));
+
+    const char* mod_name = mod->name ? mod->name : "";
+    header.name_offset = offset;
+    ok = ok && Shrimp_bytecode_write_at(file, offset, mod_name, strlen(mod_name) + 1);
+    offset += strlen(mod_name) + 1;
+    for (size_t i = 0; i < mod->count && ok; i++) {
+        const char* name = mod->items[i].name ? mod->items[i].name : "";
+        uint64_t name_offset = offset;
+        ok = Shrimp_bytecode_write_at(file, offset, name, strlen(name) + 1) &&
+             Shrimp_bytecode_write_at(file, funcs_offset + i * sizeof(Shrimp_BytecodeFunction) + offsetof(Shrimp_BytecodeFunction, name_offset), &name_offset, sizeof(name_offset));
+        offset += strlen(name) + 1;
+    }
+    ok = ok && Shrimp_bytecode_write_at(file, 0, &header, sizeof(header));
+
+    if (fclose(file) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "[ERROR]: Failed to write bytecode to %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool Shrimp_bytecode_in_bounds(size_t file_size, uint64_t offset, uint64_t count, size_t elem_size) {
+    if (offset > file_size) return false;
+    if (elem_size != 0 && count > (file_size - offset) / elem_size) return false;
+    return true;
+}
+
+static bool Shrimp_bytecode_string_in_bounds(const uint8_t* base, size_t file_size, uint64_t offset) {
+    return offset < file_size && memchr(base + offset, 0, file_size - offset) != NULL;
+}
+
+bool Shrimp_module_map_bytecode(const char* path, Shrimp_Module* out) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "[ERROR]: Failed to open bytecode file %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        fprintf(stderr, "[ERROR]: Failed to get the size of bytecode file %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(Shrimp_BytecodeHeader)) {
+        fprintf(stderr, "[ERROR]: %s is too small to be a Shrimp bytecode file\n", path);
+        close(fd);
+        return false;
+    }
+    uint8_t* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "[ERROR]: Failed to map bytecode file %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    const Shrimp_BytecodeHeader* header = (const Shrimp_BytecodeHeader*)base;
+    const char* error = NULL;
+    if (memcmp(header->magic, SHRIMP_BYTECODE_MAGIC, sizeof(header->magic)) != 0) error = "not a Shrimp bytecode file";
+    else if (header->version != SHRIMP_BYTECODE_VERSION) error = "unsupported bytecode version";
+    else if (header->byte_order != SHRIMP_BYTECODE_BYTE_ORDER) error = "written on a machine with a different byte order";
+    else if (header->instr_size != sizeof(Shrimp_Instr)) error = "written with a different instruction layout";
+    else if (!Shrimp_bytecode_in_bounds(size, Shrimp_bytecode_align(sizeof(*header)), header->function_count, sizeof(Shrimp_BytecodeFunction))) error = "truncated function table";
+    else if (!Shrimp_bytecode_string_in_bounds(base, size, header->name_offset)) error = "module name out of bounds";
+    if (error != NULL) {
+        fprintf(stderr, "[ERROR]: Failed to load %s: %s\n", path, error);
+        munmap(base, size);
+        return false;
+    }
+
+    Shrimp_Module mod = Shrimp_module_new((const char*)base + header->name_offset);
+    mod.mapping = base;
+    mod.mapping_size = size;
+    mod.count = header->function_count;
+    mod.capacity = header->function_count;
+    mod.items = calloc(mod.count ? mod.count : 1, sizeof(Shrimp_Function));
+
+    const Shrimp_BytecodeFunction* records = (const Shrimp_BytecodeFunction*)(base + Shrimp_bytecode_align(sizeof(*header)));
+    for (size_t i = 0; i < mod.count; i++) {
+        const Shrimp_BytecodeFunction* r = &records[i];
+        if (!Shrimp_bytecode_string_in_bounds(base, size, r->name_offset) ||
+            !Shrimp_bytecode_in_bounds(size, r->temps_offset, r->temps_count, sizeof(Shrimp_Temp)) ||
+            !Shrimp_bytecode_in_bounds(size, r->consts_offset, r->consts_count, sizeof(uint64_t)) ||
+            !Shrimp_bytecode_in_bounds(size, r->instrs_offset, r->instrs_count, sizeof(Shrimp_Instr)) ||
+            r->temps_offset % 8 != 0 || r->consts_offset % 8 != 0 || r->instrs_offset % 8 != 0) {
+            fprintf(stderr, "[ERROR]: Failed to load %s: function %zu is out of bounds\n", path, i);
+            Shrimp_module_cleanup(mod);
+            return false;
+        }
+        // capacity stays 0, the arrays are borrowed from the mapping
+        mod.items[i] = (Shrimp_Function) {
+            .name = (const char*)base + r->name_offset,
+            .current_offset = r->current_offset,
+            .last_allocated_size = r->last_allocated_size,
+            .label_count = r->label_count,
+            .param_count = r->param_count,
+            .exported = r->exported != 0,
+            .temps = {.items = (Shrimp_Temp*)(base + r->temps_offset), .count = r->temps_count},
+            .consts = {.items = (uint64_t*)(base + r->consts_offset), .count = r->consts_count},
+            .items = (Shrimp_Instr*)(base + r->instrs_offset),
+            .count = r->instrs_count,
+        };
+    }
+
+    if (!Shrimp_module_verify(&mod)) {
+        fprintf(stderr, "[ERROR]: Failed to load %s: the module is malformed\n", path);
+        Shrimp_module_cleanup(mod);
+        return false;
+    }
+    *out = mod;
+    return true;
+}
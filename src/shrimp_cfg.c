@@ -0,0 +1,468 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool Shrimp_instr_ends_block(uint8_t t) {
+    return t == SHRIMP_IT_JUMP || Shrimp_instr_is_branch(t) || t == SHRIMP_IT_RETURN;
+}
+
+static void Shrimp_cfg_compute_rpo(Shrimp_CFG* cfg);
+static uint32_t Shrimp_cfg_intersect(const Shrimp_CFG* cfg, const uint32_t* order, uint32_t a, uint32_t b);
+
+static void Shrimp_cfg_add_edge(Shrimp_CFG* cfg, uint32_t from, uint32_t to) {
+    Shrimp_Block* b = &cfg->items[from];
+    for (size_t i = 0; i < b->succ_count; i++) {
+        if (b->succs[i] == to) return;
+    }
+    b->succs[b->succ_count++] = to;
+    Shrimp_da_push(&cfg->items[to].preds, from);
+}
+
+void Shrimp_cfg_build(const Shrimp_Function* func, Shrimp_CFG* out) {
+    *out = (Shrimp_CFG){0};
+    out->label_block = malloc(sizeof(uint32_t) * (func->label_count ? func->label_count : 1));
+    for (size_t i = 0; i < func->label_count; i++) out->label_block[i] = SHRIMP_NO_BLOCK;
+    out->instr_block = malloc(sizeof(uint32_t) * (func->count ? func->count : 1));
+
+    uint32_t begin = 0;
+    for (uint32_t i = 0; i < func->count; i++) {
+        uint8_t t = func->items[i].t;
+        if (t == SHRIMP_IT_LABEL && i != begin) {
+            Shrimp_Block b = {.begin = begin, .end = i};
+            Shrimp_da_push(out, b);
+            begin = i;
+        }
+        if (Shrimp_instr_ends_block(t)) {
+            Shrimp_Block b = {.begin = begin, .end = i + 1};
+            Shrimp_da_push(out, b);
+            begin = i + 1;
+        }
+    }
+    if (begin < func->count || out->count == 0) {
+        Shrimp_Block b = {.begin = begin, .end = func->count};
+        Shrimp_da_push(out, b);
+    }
+
+    for (uint32_t b = 0; b < out->count; b++) {
+        for (uint32_t i = out->items[b].begin; i < out->items[b].end; i++) {
+            out->instr_block[i] = b;
+            if (func->items[i].t == SHRIMP_IT_LABEL) out->label_block[func->items[i].label] = b;
+        }
+    }
+
+    for (uint32_t b = 0; b < out->count; b++) {
+        const Shrimp_Instr* last = Shrimp_cfg_terminator(func, out, b);
+        uint32_t next = Shrimp_cfg_fallthrough(out, b);
+        if (last == NULL) {
+            if (next != SHRIMP_NO_BLOCK) Shrimp_cfg_add_edge(out, b, next);
+            continue;
+        }
+        switch (last->t) {
+            case SHRIMP_IT_JUMP: {
+                assert(out->label_block[last->jmp.to] != SHRIMP_NO_BLOCK);
+                Shrimp_cfg_add_edge(out, b, out->label_block[last->jmp.to]);
+                break;
+            }
+            case SHRIMP_IT_JUMP_IF_NOT: case SHRIMP_IT_JUMP_IF: {
+                assert(out->label_block[last->jmp_if_not.to] != SHRIMP_NO_BLOCK);
+                if (next != SHRIMP_NO_BLOCK) Shrimp_cfg_add_edge(out, b, next);
+                Shrimp_cfg_add_edge(out, b, out->label_block[last->jmp_if_not.to]);
+                break;
+            }
+            default: break;
+        }
+    }
+}
+
+void Shrimp_cfg_free(Shrimp_CFG* cfg) {
+    for (size_t i = 0; i < cfg->count; i++) Shrimp_da_free(&cfg->items[i].preds);
+    Shrimp_da_free(cfg);
+    free(cfg->label_block);
+    free(cfg->instr_block);
+    free(cfg->rpo);
+    free(cfg->idom);
+    free(cfg->dom_child);
+    free(cfg->dom_sibling);
+    *cfg = (Shrimp_CFG){0};
+}
+
+uint32_t Shrimp_cfg_fallthrough(const Shrimp_CFG* cfg, uint32_t block) {
+    return block + 1 < cfg->count ? block + 1 : SHRIMP_NO_BLOCK;
+}
+
+const Shrimp_Instr* Shrimp_cfg_terminator(const Shrimp_Function* func, const Shrimp_CFG* cfg, uint32_t block) {
+    const Shrimp_Block* b = &cfg->items[block];
+    if (b->end == b->begin) return NULL;
+    const Shrimp_Instr* last = &func->items[b->end - 1];
+    return Shrimp_instr_ends_block(last->t) ? last : NULL;
+}
+
+static void Shrimp_cfg_compute_rpo(Shrimp_CFG* cfg) {
+    cfg->rpo = malloc(sizeof(uint32_t) * cfg->count);
+    cfg->rpo_count = 0;
+    // iterative dfs, next[b] is the successor of b to look at next
+    uint8_t* next = calloc(cfg->count, 1);
+    bool* seen = calloc(cfg->count, sizeof(bool));
+    uint32_t* stack = malloc(sizeof(uint32_t) * cfg->count);
+    size_t stack_count = 0;
+    uint32_t* post = malloc(sizeof(uint32_t) * cfg->count);
+    size_t post_count = 0;
+    seen[0] = true;
+    stack[stack_count++] = 0;
+    while (stack_count != 0) {
+        uint32_t b = stack[stack_count - 1];
+        if (next[b] < cfg->items[b].succ_count) {
+            uint32_t s = cfg->items[b].succs[next[b]++];
+            if (seen[s]) continue;
+            seen[s] = true;
+            stack[stack_count++] = s;
+            continue;
+        }
+        post[post_count++] = b;
+        stack_count--;
+    }
+    for (size_t i = post_count; i-- > 0;) cfg->rpo[cfg->rpo_count++] = post[i];
+    free(post);
+    free(stack);
+    free(seen);
+    free(next);
+}
+
+static uint32_t Shrimp_cfg_intersect(const Shrimp_CFG* cfg, const uint32_t* order, uint32_t a, uint32_t b) {
+    while (a != b) {
+        while (order[a] > order[b]) a = cfg->idom[a];
+        while (order[b] > order[a]) b = cfg->idom[b];
+    }
+    return a;
+}
+
+// "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy
+void Shrimp_cfg_dominators(Shrimp_CFG* cfg) {
+    if (cfg->idom != NULL) return;
+    Shrimp_cfg_compute_rpo(cfg);
+    uint32_t* order = malloc(sizeof(uint32_t) * cfg->count);
+    cfg->idom = malloc(sizeof(uint32_t) * cfg->count);
+    for (size_t b = 0; b < cfg->count; b++) {
+        order[b] = UINT32_MAX;
+        cfg->idom[b] = SHRIMP_NO_BLOCK;
+    }
+    for (size_t i = 0; i < cfg->rpo_count; i++) order[cfg->rpo[i]] = i;
+
+    // the entry is its own dominator while iterating so the walk up in intersect stops there
+    cfg->idom[0] = 0;
+    bool changed;
+    do {
+        changed = false;
+        for (size_t i = 1; i < cfg->rpo_count; i++) {
+            uint32_t b = cfg->rpo[i];
+            const Shrimp_Block* block = &cfg->items[b];
+            uint32_t idom = SHRIMP_NO_BLOCK;
+            for (size_t p = 0; p < block->preds.count; p++) {
+                uint32_t pred = block->preds.items[p];
+                if (cfg->idom[pred] == SHRIMP_NO_BLOCK) continue;
+                idom = idom == SHRIMP_NO_BLOCK ? pred : Shrimp_cfg_intersect(cfg, order, pred, idom);
+            }
+            if (cfg->idom[b] != idom) {
+                cfg->idom[b] = idom;
+                changed = true;
+            }
+        }
+    } while (changed);
+    cfg->idom[0] = SHRIMP_NO_BLOCK;
+
+    cfg->dom_child = malloc(sizeof(uint32_t) * cfg->count);
+    cfg->dom_sibling = malloc(sizeof(uint32_t) * cfg->count);
+    for (size_t b = 0; b < cfg->count; b++) cfg->dom_child[b] = cfg->dom_sibling[b] = SHRIMP_NO_BLOCK;
+    // backwards so the children end up in reverse post order
+    for (size_t i = cfg->rpo_count; i-- > 1;) {
+        uint32_t b = cfg->rpo[i];
+        cfg->dom_sibling[b] = cfg->dom_child[cfg->idom[b]];
+        cfg->dom_child[cfg->idom[b]] = b;
+    }
+    free(order);
+}
+
+bool Shrimp_cfg_dominates(const Shrimp_CFG* cfg, uint32_t a, uint32_t b) {
+    while (b != SHRIMP_NO_BLOCK) {
+        if (a == b) return true;
+        b = cfg->idom[b];
+    }
+    return false;
+}
+
+void Shrimp_cfg_loops(const Shrimp_CFG* cfg, Shrimp_Loops* out) {
+    *out = (Shrimp_Loops){0};
+    uint32_t* stack = malloc(sizeof(uint32_t) * cfg->count);
+    for (size_t i = 0; i < cfg->rpo_count; i++) {
+        uint32_t header = cfg->rpo[i];
+        Shrimp_Loop loop = {.header = header, .parent = SHRIMP_NO_BLOCK};
+        // everything that reaches a back edge into the header without going through the header
+        size_t stack_count = 0;
+        for (size_t p = 0; p < cfg->items[header].preds.count; p++) {
+            uint32_t latch = cfg->items[header].preds.items[p];
+            if (!Shrimp_cfg_dominates(cfg, header, latch)) continue;
+            if (loop.contains == NULL) {
+                loop.contains = calloc(cfg->count, sizeof(bool));
+                loop.contains[header] = true;
+                Shrimp_da_push(&loop.blocks, header);
+            }
+            if (loop.contains[latch]) continue;
+            loop.contains[latch] = true;
+            Shrimp_da_push(&loop.blocks, latch);
+            stack[stack_count++] = latch;
+        }
+        while (stack_count != 0) {
+            const Shrimp_Block* b = &cfg->items[stack[--stack_count]];
+            for (size_t p = 0; p < b->preds.count; p++) {
+                uint32_t pred = b->preds.items[p];
+                // unreachable blocks can jump into a loop without being part of it
+                if (loop.contains[pred] || (cfg->idom[pred] == SHRIMP_NO_BLOCK && pred != 0)) continue;
+                loop.contains[pred] = true;
+                Shrimp_da_push(&loop.blocks, pred);
+                stack[stack_count++] = pred;
+            }
+        }
+        if (loop.contains != NULL) Shrimp_da_push(out, loop);
+    }
+    free(stack);
+
+    // a loop inside of another one has fewer blocks, so sorting by size puts the inner ones first
+    for (size_t i = 1; i < out->count; i++) {
+        Shrimp_Loop loop = out->items[i];
+        size_t j = i;
+        for (; j > 0 && out->items[j - 1].blocks.count > loop.blocks.count; j--) out->items[j] = out->items[j - 1];
+        out->items[j] = loop;
+    }
+    for (size_t i = 0; i < out->count; i++) {
+        for (size_t j = i + 1; j < out->count; j++) {
+            if (!out->items[j].contains[out->items[i].header]) continue;
+            out->items[i].parent = j;
+            break;
+        }
+    }
+}
+
+void Shrimp_loops_free(Shrimp_Loops* loops) {
+    for (size_t i = 0; i < loops->count; i++) {
+        Shrimp_da_free(&loops->items[i].blocks);
+        free(loops->items[i].contains);
+    }
+    Shrimp_da_free(loops);
+    *loops = (Shrimp_Loops){0};
+}
+
+// The block before the header falls into it unless it ends in a jump or a return
+static bool Shrimp_loop_falls_into(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop) {
+    if (loop->header == 0) return false;
+    const Shrimp_Instr* last = Shrimp_cfg_terminator(func, cfg, loop->header - 1);
+    return last == NULL || Shrimp_instr_is_branch(last->t);
+}
+
+static bool Shrimp_loop_jumped_into(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop) {
+    Shrimp_Label header_label = func->items[cfg->items[loop->header].begin].label;
+    const Shrimp_Block* header = &cfg->items[loop->header];
+    for (size_t p = 0; p < header->preds.count; p++) {
+        uint32_t pred = header->preds.items[p];
+        if (loop->contains[pred]) continue;
+        const Shrimp_Instr* last = Shrimp_cfg_terminator(func, cfg, pred);
+        if (last != NULL && last->t == SHRIMP_IT_JUMP && last->jmp.to == header_label) return true;
+        if (last != NULL && Shrimp_instr_is_branch(last->t) && last->jmp_if_not.to == header_label) return true;
+    }
+    return false;
+}
+
+bool Shrimp_loop_has_preheader(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop) {
+    if (func->items[cfg->items[loop->header].begin].t != SHRIMP_IT_LABEL) return false;
+    bool falls = Shrimp_loop_falls_into(func, cfg, loop) && !loop->contains[loop->header - 1];
+    return falls || Shrimp_loop_jumped_into(func, cfg, loop);
+}
+
+size_t Shrimp_loop_insert_preheader(Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop, const Shrimp_Instr* instrs, size_t count) {
+    if (!Shrimp_loop_has_preheader(func, cfg, loop)) return 0;
+    uint32_t begin = cfg->items[loop->header].begin;
+    Shrimp_Label header_label = func->items[begin].label;
+    bool falls = Shrimp_loop_falls_into(func, cfg, loop);
+
+    Shrimp_Instr* preheader = malloc(sizeof(Shrimp_Instr) * (count + 2));
+    size_t n = 0;
+    // the back edge from the block right before must skip the preheader
+    if (falls && loop->contains[loop->header - 1]) preheader[n++] = (Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = header_label}};
+    if (Shrimp_loop_jumped_into(func, cfg, loop)) {
+        Shrimp_Label label = Shrimp_function_label_alloc(func);
+        preheader[n++] = (Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = label};
+        for (size_t i = 0; i < func->count; i++) {
+            Shrimp_Instr instr = func->items[i];
+            if (loop->contains[cfg->instr_block[i]]) continue;
+            if (instr.t == SHRIMP_IT_JUMP && instr.jmp.to == header_label) instr.jmp.to = label;
+            else if (Shrimp_instr_is_branch(instr.t) && instr.jmp_if_not.to == header_label) instr.jmp_if_not.to = label;
+            else continue;
+            Shrimp_function_set_instr(func, i, instr);
+        }
+    }
+    memcpy(&preheader[n], instrs, sizeof(Shrimp_Instr) * count);
+    n += count;
+    Shrimp_function_insert(func, begin, preheader, n);
+    free(preheader);
+    return n;
+}
+
+static bool Shrimp_loop_defines(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop, uint32_t temp) {
+    const Shrimp_InstrList* defs = &func->uses.items[temp].defs;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (loop->contains[cfg->instr_block[defs->items[i]]]) return true;
+    }
+    return false;
+}
+
+// Whether the block is in the loop and not in one nested in it, inner loops come first so the first one is it
+static bool Shrimp_loop_innermost(const Shrimp_Loops* loops, const Shrimp_Loop* loop, uint32_t block) {
+    for (size_t l = 0; l < loops->count; l++) {
+        if (loops->items[l].contains[block]) return &loops->items[l] == loop;
+    }
+    return false;
+}
+
+bool Shrimp_loop_counted(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loops* loops, const Shrimp_Loop* loop, Shrimp_CountedLoop* out) {
+    const Shrimp_Block* header = &cfg->items[loop->header];
+    const Shrimp_Instr* last = Shrimp_cfg_terminator(func, cfg, loop->header);
+    if (last == NULL || last->t != SHRIMP_IT_JUMP_IF_NOT || SHRIMP_REF_IS_CONST(last->jmp_if_not.cond)) return false;
+    if (header->succ_count != 2 || loop->contains[cfg->label_block[last->jmp_if_not.to]]) return false;
+    uint32_t other = header->succs[0] == cfg->label_block[last->jmp_if_not.to] ? header->succs[1] : header->succs[0];
+    if (!loop->contains[other]) return false;
+
+    // the last write of the condition in the header has to be the test
+    uint32_t cond = last->jmp_if_not.cond;
+    uint32_t test = SHRIMP_NO_INSTR;
+    for (uint32_t i = header->end - 1; i-- > header->begin && test == SHRIMP_NO_INSTR;) {
+        uint32_t def;
+        if (Shrimp_instr_def(&func->items[i], &def) && def == cond) test = i;
+    }
+    if (test == SHRIMP_NO_INSTR) return false;
+    Shrimp_Instr instr = func->items[test];
+    Shrimp_Ref counter, limit;
+    if (instr.t == SHRIMP_IT_CMP_LT) {
+        counter = instr.binop.l;
+        limit = instr.binop.r;
+    } else if (instr.t == SHRIMP_IT_CMP_MT) {
+        counter = instr.binop.r;
+        limit = instr.binop.l;
+    } else {
+        return false;
+    }
+    if (SHRIMP_REF_IS_CONST(counter) || counter == limit) return false;
+    if (!SHRIMP_REF_IS_CONST(limit) && Shrimp_loop_defines(func, cfg, loop, limit)) return false;
+
+    const Shrimp_InstrList* defs = &func->uses.items[counter].defs;
+    uint32_t step_instr = SHRIMP_NO_INSTR;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (!loop->contains[cfg->instr_block[defs->items[i]]]) continue;
+        if (step_instr != SHRIMP_NO_INSTR) return false;
+        step_instr = defs->items[i];
+    }
+    if (step_instr == SHRIMP_NO_INSTR) return false;
+    Shrimp_Instr step = func->items[step_instr];
+    if (step.t != SHRIMP_IT_ADD) return false;
+    Shrimp_Ref by = step.binop.l == counter ? step.binop.r : step.binop.l;
+    if ((step.binop.l != counter && step.binop.r != counter) || !SHRIMP_REF_IS_CONST(by)) return false;
+    uint64_t c = Shrimp_function_const(func, by);
+    // stepping by a huge amount is really stepping down
+    if (c == 0 || c >> 32) return false;
+    uint32_t step_block = cfg->instr_block[step_instr];
+    // the test sees start + rounds * step only when the step comes after it
+    if (step_block == loop->header || !Shrimp_loop_innermost(loops, loop, step_block)) return false;
+
+    bool every_round = true;
+    for (size_t p = 0; p < header->preds.count; p++) {
+        uint32_t pred = header->preds.items[p];
+        if (loop->contains[pred] && !Shrimp_cfg_dominates(cfg, step_block, pred)) every_round = false;
+    }
+    *out = (Shrimp_CountedLoop){
+        .counter = counter,
+        .step_instr = step_instr,
+        .step = c,
+        .limit = limit,
+        .test_instr = test,
+        .every_round = every_round,
+    };
+    return true;
+}
+
+bool Shrimp_loop_entry_const(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop, uint32_t temp, uint64_t* out) {
+    const Shrimp_InstrList* defs = &func->uses.items[temp].defs;
+    uint32_t outside = SHRIMP_NO_INSTR;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (loop->contains[cfg->instr_block[defs->items[i]]]) continue;
+        if (outside != SHRIMP_NO_INSTR) return false;
+        outside = defs->items[i];
+    }
+    if (outside == SHRIMP_NO_INSTR) return false;
+    Shrimp_Instr instr = func->items[outside];
+    if (instr.t != SHRIMP_IT_ASSIGN || !SHRIMP_REF_IS_CONST(instr.assign.v)) return false;
+    if (!Shrimp_cfg_dominates(cfg, cfg->instr_block[outside], loop->header)) return false;
+    *out = Shrimp_function_const(func, instr.assign.v);
+    return true;
+}
+
+bool Shrimp_loop_trip_count(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop, const Shrimp_CountedLoop* counted, uint64_t* out) {
+    uint64_t start;
+    if (!counted->every_round || !SHRIMP_REF_IS_CONST(counted->limit)) return false;
+    if (!Shrimp_loop_entry_const(func, cfg, loop, counted->counter, &start)) return false;
+    uint64_t limit = Shrimp_function_const(func, counted->limit);
+    if (start >= limit) {
+        *out = 0;
+        return true;
+    }
+    uint64_t rounds = (uint64_t)(((unsigned __int128)(limit - start) + counted->step - 1) / counted->step);
+    // the counter wrapping around on the last step would keep the loop going
+    if (((unsigned __int128)start + (unsigned __int128)rounds * counted->step) >> 64) return false;
+    *out = rounds;
+    return true;
+}
+
+void Shrimp_liveness_step(const Shrimp_Instr* instr, uint64_t* live) {
+    Shrimp_Instr copy = *instr;
+    uint32_t def;
+    if (Shrimp_instr_def(&copy, &def)) live[SHRIMP_BITS_WORD(def)] &= ~SHRIMP_BITS_MASK(def);
+    Shrimp_Ref* ops[2];
+    size_t n = Shrimp_instr_operands(&copy, ops);
+    for (size_t i = 0; i < n; i++) {
+        if (SHRIMP_REF_IS_CONST(*ops[i])) continue;
+        live[SHRIMP_BITS_WORD(*ops[i])] |= SHRIMP_BITS_MASK(*ops[i]);
+    }
+}
+
+void Shrimp_liveness_out(const Shrimp_CFG* cfg, const Shrimp_Liveness* liveness, uint32_t block, uint64_t* live) {
+    memset(live, 0, sizeof(uint64_t) * liveness->words);
+    for (uint32_t s = 0; s < cfg->items[block].succ_count; s++) {
+        const uint64_t* in = &liveness->live_in[cfg->items[block].succs[s] * liveness->words];
+        for (size_t w = 0; w < liveness->words; w++) live[w] |= in[w];
+    }
+}
+
+void Shrimp_liveness_compute(const Shrimp_Function* func, const Shrimp_CFG* cfg, Shrimp_Liveness* out) {
+    out->words = func->temps.count / 64 + 1;
+    out->live_in = calloc(cfg->count * out->words, sizeof(uint64_t));
+    uint64_t* live = malloc(sizeof(uint64_t) * out->words);
+    // live out of a block is the union of live in of its successors, iterate backwards until it settles
+    bool changed;
+    do {
+        changed = false;
+        for (uint32_t b = cfg->count; b-- > 0;) {
+            Shrimp_liveness_out(cfg, out, b, live);
+            for (uint32_t i = cfg->items[b].end; i-- > cfg->items[b].begin;) Shrimp_liveness_step(&func->items[i], live);
+            uint64_t* in = &out->live_in[b * out->words];
+            if (memcmp(in, live, sizeof(uint64_t) * out->words) != 0) {
+                memcpy(in, live, sizeof(uint64_t) * out->words);
+                changed = true;
+            }
+        }
+    } while (changed);
+    free(live);
+}
+
+void Shrimp_liveness_free(Shrimp_Liveness* liveness) {
+    free(liveness->live_in);
+    *liveness = (Shrimp_Liveness){0};
+}
@@ -0,0 +1,210 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Copy propagation and coalescing
+//
+// The frontend puts every literal into a temp of its own and computes every reassignment into a fresh temp
+// that then gets copied into the variable. So first the copies out of temps that are used only by them get
+// coalesced (the instruction computing the temp writes straight to the copy's target), then every read of a
+// temp that holds a copy of a constant or of another temp reads that instead. The copies left without readers
+// are up to the dce pass.
+//
+// Which copies hold at a point is a forward data flow problem: `x <- v` makes x a copy of v until x or v
+// is written again, and at a join a copy only holds if it holds on every edge coming in.
+//
+// The states take a copy per temp and block, functions where that gets too big only get coalesced.
+
+#define SHRIMP_COPY_MAX_CELLS (1 << 20)
+// no copy is known for the temp
+#define SHRIMP_COPY_NONE UINT32_MAX
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    size_t temps;
+    // temps cells per block, what every temp is a copy of at the end of it
+    Shrimp_Ref* out;
+    bool* visited;
+    // the temps some assign copies temp t into are copied_into[copied_from[t]..copied_from[t + 1]), only
+    // those can be copies of t when it's written
+    uint32_t* copied_from;
+    uint32_t* copied_into;
+} Shrimp_CopyProp;
+
+static bool Shrimp_instr_touches(Shrimp_Instr instr, uint32_t temp) {
+    uint32_t def;
+    if (Shrimp_instr_def(&instr, &def) && def == temp) return true;
+    Shrimp_Ref* ops[2];
+    size_t n = Shrimp_instr_operands(&instr, ops);
+    for (size_t i = 0; i < n; i++) {
+        if (*ops[i] == temp) return true;
+    }
+    return false;
+}
+
+static bool Shrimp_function_coalesce(Shrimp_Function* f) {
+    bool changed = false;
+    for (uint32_t t = 0; t < f->temps.count; t++) {
+        uint32_t def = Shrimp_function_temp_def(f, t);
+        const Shrimp_InstrList* uses = &f->uses.items[t].uses;
+        if (def == SHRIMP_NO_INSTR || uses->count != 1 || uses->items[0] <= def) continue;
+        uint32_t copy = uses->items[0];
+        Shrimp_Instr use = f->items[copy];
+        if (use.t != SHRIMP_IT_ASSIGN || use.assign.v != t || use.assign.into == t) continue;
+        uint32_t into = use.assign.into;
+        if (Shrimp_function_temp(f, into)->size != Shrimp_function_temp(f, t)->size) continue;
+
+        // the target can't be looked at in between and both have to be in the same block
+        bool ok = true;
+        for (uint32_t i = def + 1; i < copy && ok; i++) {
+            Shrimp_Instr instr = f->items[i];
+            if (instr.t == SHRIMP_IT_LABEL || instr.t == SHRIMP_IT_JUMP || Shrimp_instr_is_branch(instr.t) || instr.t == SHRIMP_IT_RETURN) ok = false;
+            else if (Shrimp_instr_touches(instr, into)) ok = false;
+        }
+        if (!ok) continue;
+
+        Shrimp_Instr instr = f->items[def];
+        Shrimp_instr_set_def(&instr, into);
+        Shrimp_function_set_instr(f, def, instr);
+        Shrimp_function_remove_instr(f, copy);
+        changed = true;
+    }
+    return changed;
+}
+
+// What `ref` can be replaced with, following copies of copies
+static Shrimp_Ref Shrimp_copyprop_resolve(const Shrimp_CopyProp* cp, const Shrimp_Ref* state, Shrimp_Ref ref) {
+    for (size_t depth = 0; depth < cp->temps && !SHRIMP_REF_IS_CONST(ref) && state[ref] != SHRIMP_COPY_NONE; depth++) {
+        ref = state[ref];
+    }
+    return ref;
+}
+
+static void Shrimp_copyprop_transfer(const Shrimp_CopyProp* cp, Shrimp_Ref* state, const Shrimp_Instr* instr) {
+    uint32_t def;
+    if (!Shrimp_instr_def(instr, &def)) return;
+    state[def] = SHRIMP_COPY_NONE;
+    for (uint32_t c = cp->copied_from[def]; c < cp->copied_from[def + 1]; c++) {
+        if (state[cp->copied_into[c]] == def) state[cp->copied_into[c]] = SHRIMP_COPY_NONE;
+    }
+    if (instr->t == SHRIMP_IT_ASSIGN && instr->assign.v != def) state[def] = instr->assign.v;
+}
+
+// Meets the ends of the predecessors that were looked at already, returns false if there are none
+static bool Shrimp_copyprop_in(const Shrimp_CopyProp* cp, uint32_t b, Shrimp_Ref* state) {
+    const Shrimp_Block* block = &cp->cfg.items[b];
+    bool any = false;
+    for (size_t i = 0; i < cp->temps; i++) state[i] = SHRIMP_COPY_NONE;
+    for (size_t p = 0; p < block->preds.count; p++) {
+        uint32_t pred = block->preds.items[p];
+        if (!cp->visited[pred]) continue;
+        const Shrimp_Ref* out = &cp->out[(size_t)pred * cp->temps];
+        if (!any) memcpy(state, out, sizeof(Shrimp_Ref) * cp->temps);
+        else for (size_t i = 0; i < cp->temps; i++) {
+            if (state[i] != out[i]) state[i] = SHRIMP_COPY_NONE;
+        }
+        any = true;
+    }
+    // nothing is a copy of anything on entry
+    if (b == 0) {
+        for (size_t i = 0; i < cp->temps; i++) state[i] = SHRIMP_COPY_NONE;
+        any = true;
+    }
+    return any;
+}
+
+// Fills in copied_from and copied_into from the assigns as they are before anything gets replaced
+static void Shrimp_copyprop_index(Shrimp_CopyProp* cp) {
+    Shrimp_Function* f = cp->func;
+    cp->copied_from = calloc(cp->temps + 2, sizeof(uint32_t));
+    size_t copies = 0;
+    for (uint32_t i = 0; i < f->count; i++) {
+        Shrimp_Instr instr = f->items[i];
+        if (instr.t != SHRIMP_IT_ASSIGN || SHRIMP_REF_IS_CONST(instr.assign.v)) continue;
+        cp->copied_from[instr.assign.v + 2]++;
+        copies++;
+    }
+    for (size_t t = 0; t < cp->temps; t++) cp->copied_from[t + 2] += cp->copied_from[t + 1];
+    cp->copied_into = malloc(sizeof(uint32_t) * (copies + 1));
+    // counts up to where the next one goes, which ends at the start of the temp after it
+    for (uint32_t i = 0; i < f->count; i++) {
+        Shrimp_Instr instr = f->items[i];
+        if (instr.t != SHRIMP_IT_ASSIGN || SHRIMP_REF_IS_CONST(instr.assign.v)) continue;
+        cp->copied_into[cp->copied_from[instr.assign.v + 1]++] = instr.assign.into;
+    }
+}
+
+static bool Shrimp_function_copyprop(Shrimp_Function* f) {
+    Shrimp_CopyProp cp = {.func = f, .temps = f->temps.count};
+    Shrimp_cfg_build(f, &cp.cfg);
+    if ((size_t)cp.cfg.count * cp.temps > SHRIMP_COPY_MAX_CELLS) {
+        Shrimp_cfg_free(&cp.cfg);
+        return false;
+    }
+    Shrimp_copyprop_index(&cp);
+    cp.out = malloc(sizeof(Shrimp_Ref) * (cp.cfg.count * cp.temps + 1));
+    cp.visited = calloc(cp.cfg.count, sizeof(bool));
+    Shrimp_Ref* state = malloc(sizeof(Shrimp_Ref) * (cp.temps + 1));
+
+    bool changed;
+    do {
+        changed = false;
+        for (uint32_t b = 0; b < cp.cfg.count; b++) {
+            if (!Shrimp_copyprop_in(&cp, b, state)) continue;
+            for (uint32_t i = cp.cfg.items[b].begin; i < cp.cfg.items[b].end; i++) Shrimp_copyprop_transfer(&cp, state, &f->items[i]);
+            Shrimp_Ref* out = &cp.out[(size_t)b * cp.temps];
+            if (!cp.visited[b] || memcmp(out, state, sizeof(Shrimp_Ref) * cp.temps) != 0) {
+                memcpy(out, state, sizeof(Shrimp_Ref) * cp.temps);
+                cp.visited[b] = true;
+                changed = true;
+            }
+        }
+    } while (changed);
+
+    for (uint32_t b = 0; b < cp.cfg.count; b++) {
+        if (!cp.visited[b]) continue;
+        Shrimp_copyprop_in(&cp, b, state);
+        for (uint32_t i = cp.cfg.items[b].begin; i < cp.cfg.items[b].end; i++) {
+            Shrimp_Instr instr = f->items[i];
+            bool modified = false;
+            Shrimp_Ref* ops[2];
+            size_t n = Shrimp_instr_operands(&instr, ops);
+            for (size_t j = 0; j < n; j++) {
+                Shrimp_Ref with = Shrimp_copyprop_resolve(&cp, state, *ops[j]);
+                if (with == *ops[j]) continue;
+                *ops[j] = with;
+                modified = true;
+            }
+            // the state moves on with the original, it describes the same values
+            Shrimp_copyprop_transfer(&cp, state, &f->items[i]);
+            if (instr.t == SHRIMP_IT_ASSIGN && instr.assign.v == instr.assign.into) {
+                Shrimp_function_remove_instr(f, i);
+                changed = true;
+            } else if (modified) {
+                Shrimp_function_set_instr(f, i, instr);
+                changed = true;
+            }
+        }
+    }
+
+    free(state);
+    free(cp.copied_into);
+    free(cp.copied_from);
+    free(cp.visited);
+    free(cp.out);
+    Shrimp_cfg_free(&cp.cfg);
+    return changed;
+}
+
+bool Shrimp_module_copy_prop(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        changed |= Shrimp_function_coalesce(f);
+        changed |= Shrimp_function_copyprop(f);
+    }
+    return changed;
+}
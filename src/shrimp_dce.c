@@ -0,0 +1,120 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Dead code elimination
+//   - blocks no path from the entry reaches are dropped as a whole
+//   - jumps to the instruction right after them and labels nothing jumps to are dropped
+//   - instructions whose result is overwritten or never read before the function returns are dropped,
+//     which needs liveness since the same temp is written in several places
+// A dead instruction can go unless it does more than write its temp: calls are kept since the callee might never
+// return and divisions that may be by 0 since they trap at runtime
+
+static bool Shrimp_dce_dead_defs(Shrimp_Function* func);
+
+bool Shrimp_dce_unreachable(Shrimp_Function* func) {
+    Shrimp_CFG cfg;
+    Shrimp_cfg_build(func, &cfg);
+    bool* reached = calloc(cfg.count, sizeof(bool));
+    uint32_t* stack = malloc(sizeof(uint32_t) * cfg.count);
+    size_t stack_count = 0;
+    reached[0] = true;
+    stack[stack_count++] = 0;
+    while (stack_count != 0) {
+        const Shrimp_Block* b = &cfg.items[stack[--stack_count]];
+        for (uint32_t i = 0; i < b->succ_count; i++) {
+            if (reached[b->succs[i]]) continue;
+            reached[b->succs[i]] = true;
+            stack[stack_count++] = b->succs[i];
+        }
+    }
+
+    bool changed = false;
+    for (uint32_t b = 0; b < cfg.count; b++) {
+        if (reached[b]) continue;
+        // anything jumping here is unreachable as well, so the labels can go too
+        for (uint32_t i = cfg.items[b].begin; i < cfg.items[b].end; i++) {
+            if (func->items[i].t == SHRIMP_IT_NOP) continue;
+            Shrimp_function_remove_instr(func, i);
+            changed = true;
+        }
+    }
+    free(stack);
+    free(reached);
+    Shrimp_cfg_free(&cfg);
+    return changed;
+}
+
+bool Shrimp_dce_labels(Shrimp_Function* func) {
+    bool changed = false;
+    // a jump to where control goes anyway, nops in between don't count
+    for (size_t i = 0; i < func->count; i++) {
+        Shrimp_Instr instr = func->items[i];
+        if (instr.t != SHRIMP_IT_JUMP && !Shrimp_instr_is_branch(instr.t)) continue;
+        Shrimp_Label to = instr.t == SHRIMP_IT_JUMP ? instr.jmp.to : instr.jmp_if_not.to;
+        for (size_t j = i + 1; j < func->count; j++) {
+            if (func->items[j].t == SHRIMP_IT_NOP) continue;
+            if (func->items[j].t != SHRIMP_IT_LABEL) break;
+            if (func->items[j].label != to) continue;
+            Shrimp_function_remove_instr(func, i);
+            changed = true;
+            break;
+        }
+    }
+
+    bool* used = calloc(func->label_count ? func->label_count : 1, sizeof(bool));
+    for (size_t i = 0; i < func->count; i++) {
+        Shrimp_Instr instr = func->items[i];
+        if (instr.t == SHRIMP_IT_JUMP) used[instr.jmp.to] = true;
+        if (Shrimp_instr_is_branch(instr.t)) used[instr.jmp_if_not.to] = true;
+    }
+    for (size_t i = 0; i < func->count; i++) {
+        if (func->items[i].t != SHRIMP_IT_LABEL || used[func->items[i].label]) continue;
+        Shrimp_function_remove_instr(func, i);
+        changed = true;
+    }
+    free(used);
+    return changed;
+}
+
+static bool Shrimp_dce_dead_defs(Shrimp_Function* func) {
+    Shrimp_CFG cfg;
+    Shrimp_cfg_build(func, &cfg);
+    Shrimp_Liveness liveness;
+    Shrimp_liveness_compute(func, &cfg, &liveness);
+    uint64_t* live = malloc(sizeof(uint64_t) * liveness.words);
+
+    bool changed = false;
+    for (uint32_t b = 0; b < cfg.count; b++) {
+        Shrimp_liveness_out(&cfg, &liveness, b, live);
+        for (uint32_t i = cfg.items[b].end; i-- > cfg.items[b].begin;) {
+            uint32_t def;
+            const Shrimp_Instr* instr = &func->items[i];
+            bool removable = instr->t != SHRIMP_IT_CALL && !Shrimp_instr_may_trap(func, instr);
+            if (removable && Shrimp_instr_def(instr, &def) && !SHRIMP_BITS_TEST(live, def)) {
+                Shrimp_function_remove_instr(func, i);
+                changed = true;
+                continue;
+            }
+            Shrimp_liveness_step(&func->items[i], live);
+        }
+    }
+
+    free(live);
+    Shrimp_liveness_free(&liveness);
+    Shrimp_cfg_free(&cfg);
+    return changed;
+}
+
+bool Shrimp_module_dce(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* func = &mod->items[i];
+        changed |= Shrimp_dce_unreachable(func);
+        changed |= Shrimp_dce_labels(func);
+        // removing a dead definition can make the ones feeding it dead, which only shows up on the next round
+        while (Shrimp_dce_dead_defs(func)) changed = true;
+    }
+    return changed;
+}
@@ -0,0 +1,167 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Compile time evaluation
+//
+// A function without params doesn't take any input, so running it always gives the same result. It gets
+// interpreted with a budget of instructions (the fuel) and if it returns before that runs out its body becomes
+// `return <result>`. Calls are interpreted as well and share the fuel of the function they're made from, up to
+// a depth past which it gives up. Whatever the interpreter can't be sure the generated code agrees with makes it
+// give up and leave the function alone: reading a temp before anything was written to it, dividing by zero,
+// running off the end of the body and jumping to a label that isn't placed. Temps narrower than 8 bytes keep
+// only their low bytes like the stores of the generated code do.
+
+// how many instructions the interpreter runs per function when the options don't say
+#define SHRIMP_EVAL_FUEL (1 << 20)
+// how deep calls may nest before the interpreter gives up
+#define SHRIMP_EVAL_MAX_DEPTH 256
+
+typedef struct {
+    const Shrimp_Module* mod;
+    // where every label of a function is placed, only filled in once the function is run
+    uint32_t** targets;
+    size_t fuel;
+} Shrimp_EvalModule;
+
+typedef struct {
+    const Shrimp_Function* func;
+    uint64_t* values;
+    bool* written;
+} Shrimp_Eval;
+
+static bool Shrimp_eval_ref(const Shrimp_Eval* e, Shrimp_Ref ref, uint64_t* out) {
+    if (SHRIMP_REF_IS_CONST(ref)) {
+        *out = Shrimp_function_const(e->func, ref);
+        return true;
+    }
+    if (!e->written[ref]) return false;
+    *out = e->values[ref];
+    return true;
+}
+
+static void Shrimp_eval_store(Shrimp_Eval* e, uint32_t temp, uint64_t value) {
+    size_t size = e->func->temps.items[temp].size;
+    if (size < 8) value &= ((uint64_t)1 << (size * 8)) - 1;
+    e->values[temp] = value;
+    e->written[temp] = true;
+}
+
+static const uint32_t* Shrimp_eval_targets(Shrimp_EvalModule* em, uint32_t index) {
+    if (em->targets[index] != NULL) return em->targets[index];
+    const Shrimp_Function* f = &em->mod->items[index];
+    uint32_t* targets = malloc(sizeof(uint32_t) * (f->label_count + 1));
+    for (Shrimp_Label l = 0; l < f->label_count; l++) targets[l] = SHRIMP_NO_INSTR;
+    for (size_t i = 0; i < f->count; i++) {
+        if (f->items[i].t == SHRIMP_IT_LABEL) targets[f->items[i].label] = i;
+    }
+    em->targets[index] = targets;
+    return targets;
+}
+
+// Runs the function with its params set to `args`, returns whether it returned before the fuel ran out and what with
+static bool Shrimp_eval_run(Shrimp_EvalModule* em, uint32_t index, const uint64_t* args, size_t depth, uint64_t* result) {
+    const Shrimp_Function* f = &em->mod->items[index];
+    const uint32_t* targets = Shrimp_eval_targets(em, index);
+    Shrimp_Eval e = {
+        .func = f,
+        .values = malloc(sizeof(uint64_t) * (f->temps.count + 1)),
+        .written = calloc(f->temps.count + 1, sizeof(bool)),
+    };
+    for (uint32_t p = 0; p < f->param_count; p++) Shrimp_eval_store(&e, p, args[p]);
+    // the arguments of the call coming up
+    uint64_t* pending = malloc(sizeof(uint64_t) * (f->count + 1));
+    size_t pending_count = 0;
+
+    bool returned = false;
+    size_t pc = 0;
+    for (; pc < f->count && em->fuel != 0; em->fuel--) {
+        const Shrimp_Instr* instr = &f->items[pc++];
+        uint64_t l, r;
+        if (Shrimp_instr_is_binop(instr->t)) {
+            if (!Shrimp_eval_ref(&e, instr->binop.l, &l) || !Shrimp_eval_ref(&e, instr->binop.r, &r)) break;
+            uint64_t value;
+            if (!Shrimp_eval_binop(instr->t, l, r, &value)) break;
+            Shrimp_eval_store(&e, instr->binop.result, value);
+            continue;
+        }
+        switch (instr->t) {
+            case SHRIMP_IT_ASSIGN: {
+                if (!Shrimp_eval_ref(&e, instr->assign.v, &l)) goto done;
+                Shrimp_eval_store(&e, instr->assign.into, l);
+                break;
+            }
+            case SHRIMP_IT_RETURN: {
+                returned = Shrimp_eval_ref(&e, instr->ret, result);
+                goto done;
+            }
+            case SHRIMP_IT_JUMP: {
+                if (targets[instr->jmp.to] == SHRIMP_NO_INSTR) goto done;
+                pc = targets[instr->jmp.to];
+                break;
+            }
+            case SHRIMP_IT_JUMP_IF_NOT:
+            case SHRIMP_IT_JUMP_IF: {
+                if (!Shrimp_eval_ref(&e, instr->jmp_if_not.cond, &l)) goto done;
+                if ((l == 0) != (instr->t == SHRIMP_IT_JUMP_IF_NOT)) break;
+                if (targets[instr->jmp_if_not.to] == SHRIMP_NO_INSTR) goto done;
+                pc = targets[instr->jmp_if_not.to];
+                break;
+            }
+            case SHRIMP_IT_ARG: {
+                if (!Shrimp_eval_ref(&e, instr->arg, &pending[pending_count])) goto done;
+                pending_count++;
+                break;
+            }
+            case SHRIMP_IT_CALL: {
+                if (depth >= SHRIMP_EVAL_MAX_DEPTH) goto done;
+                if (!Shrimp_eval_run(em, instr->call.func, pending, depth + 1, &l)) goto done;
+                pending_count = 0;
+                Shrimp_eval_store(&e, instr->call.result, l);
+                break;
+            }
+            case SHRIMP_IT_LABEL:
+            case SHRIMP_IT_NOP:
+                break;
+            default:
+                goto done;
+        }
+    }
+done:
+    free(pending);
+    free(e.written);
+    free(e.values);
+    return returned;
+}
+
+bool Shrimp_module_eval(Shrimp_Module* mod) {
+    size_t fuel = mod->eval_fuel != 0 ? mod->eval_fuel : SHRIMP_EVAL_FUEL;
+    Shrimp_EvalModule em = {.mod = mod, .targets = calloc(mod->count + 1, sizeof(uint32_t*))};
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        uint64_t result;
+        // what a function with params returns depends on its caller
+        if (f->param_count != 0) continue;
+        em.fuel = fuel;
+        if (!Shrimp_eval_run(&em, i, NULL, 0, &result)) continue;
+        // already as small as it gets
+        if (f->count == 1 && f->items[0].t == SHRIMP_IT_RETURN && SHRIMP_REF_IS_CONST(f->items[0].ret)) continue;
+
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        for (size_t j = 0; j < f->count; j++) {
+            if (f->items[j].t != SHRIMP_IT_NOP) Shrimp_function_remove_instr(f, j);
+        }
+        Shrimp_function_compact(f);
+        Shrimp_function_truncate_temps(f, 0);
+        Shrimp_function_push(f, (Shrimp_Instr){.t = SHRIMP_IT_RETURN, .ret = Shrimp_function_const_ref(f, result)});
+        // the labels it had are gone
+        free(em.targets[i]);
+        em.targets[i] = NULL;
+        changed = true;
+    }
+    for (size_t i = 0; i < mod->count; i++) free(em.targets[i]);
+    free(em.targets);
+    return changed;
+}
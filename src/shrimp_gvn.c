@@ -0,0 +1,292 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Value numbering
+//
+// Every temp carries a value number for what it holds at the current point, equal numbers mean equal values.
+// Binops are hashed by their operator and the numbers of their operands, one that was computed before and
+// whose result is still held by the temp it was written to becomes a copy of that temp.
+//
+// The local variant starts over in every block. The global one walks the dominator tree and keeps the table
+// of what was computed in the dominators around. Since temps get written more than once the numbers are
+// only carried into a block as they are when it has a single predecessor. When it's a join, only temps
+// written exactly once by an instruction in a strict dominator keep theirs: whatever path led here,
+// they hold the value of the latest run of that instruction.
+//
+// Every block entered gets a stamp and every number the stamp of the block it was set in. Instead of giving
+// all temps new numbers at a join, a number set before the latest join on the way here is replaced when
+// it's read. Leaving a block of the dominator tree undoes what it set, so the numbers are those of its
+// immediate dominator again for the next child.
+
+typedef struct {
+    uint8_t op;
+    // value numbers of the operands, a constant is keyed as an assign of it
+    uint64_t l, r;
+} Shrimp_VNKey;
+
+typedef struct {
+    Shrimp_VNKey key;
+    uint32_t vn;
+    // the temp the result was written to, the entry is only good while it still holds `vn`
+    // constants don't need one and have SHRIMP_NO_INSTR here
+    uint32_t holder;
+    uint32_t next;
+} Shrimp_VNEntry;
+
+typedef struct {
+    uint32_t temp;
+    uint32_t vn;
+    uint32_t stamp;
+} Shrimp_VNUndo;
+
+typedef struct {
+    Shrimp_VNUndo* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_VNUndoLog;
+
+// the stamp of numbers set by the only instruction writing a temp, they are good in every block it dominates
+#define SHRIMP_VN_ALWAYS UINT32_MAX
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    bool global;
+    size_t temps;
+    uint32_t next_vn;
+    uint32_t* state;
+    // the stamp of the block each number in state was set in
+    uint32_t* stamp;
+    uint32_t current;
+    uint32_t next_stamp;
+    // the stamp of the latest join on the way from the entry to the current block
+    uint32_t valid_from;
+    // whether the temp is written by exactly one instruction
+    bool* once;
+    Shrimp_VNUndoLog undo;
+
+    uint32_t* buckets;
+    size_t bucket_mask;
+    Shrimp_VNEntry* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_VN;
+
+#define SHRIMP_VN_NO_ENTRY UINT32_MAX
+
+static uint32_t Shrimp_vn_lookup(Shrimp_VN* vn, Shrimp_VNKey key);
+static void Shrimp_vn_insert(Shrimp_VN* vn, Shrimp_VNKey key, uint32_t value, uint32_t holder);
+
+static uint64_t Shrimp_vn_hash(Shrimp_VNKey key) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    uint64_t parts[3] = {key.op, key.l, key.r};
+    for (size_t i = 0; i < 3; i++) {
+        h ^= parts[i];
+        h *= 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static bool Shrimp_vn_key_eq(Shrimp_VNKey a, Shrimp_VNKey b) {
+    return a.op == b.op && a.l == b.l && a.r == b.r;
+}
+
+static void Shrimp_vn_set(Shrimp_VN* vn, uint32_t temp, uint32_t value, uint32_t stamp) {
+    Shrimp_da_push(&vn->undo, ((Shrimp_VNUndo){.temp = temp, .vn = vn->state[temp], .stamp = vn->stamp[temp]}));
+    vn->state[temp] = value;
+    vn->stamp[temp] = stamp;
+}
+
+static void Shrimp_vn_def(Shrimp_VN* vn, uint32_t temp, uint32_t value) {
+    Shrimp_vn_set(vn, temp, value, vn->once[temp] ? SHRIMP_VN_ALWAYS : vn->current);
+}
+
+// The number the temp holds here, a new one if what it held may have been replaced on the way
+static uint32_t Shrimp_vn_temp(Shrimp_VN* vn, uint32_t temp) {
+    if (vn->stamp[temp] < vn->valid_from) Shrimp_vn_set(vn, temp, vn->next_vn++, vn->current);
+    return vn->state[temp];
+}
+
+static uint32_t Shrimp_vn_ref(Shrimp_VN* vn, Shrimp_Ref ref) {
+    if (!SHRIMP_REF_IS_CONST(ref)) return Shrimp_vn_temp(vn, ref);
+    Shrimp_VNKey key = {.op = SHRIMP_IT_ASSIGN, .l = Shrimp_function_const(vn->func, ref)};
+    uint32_t e = Shrimp_vn_lookup(vn, key);
+    if (e != SHRIMP_VN_NO_ENTRY) return vn->items[e].vn;
+    Shrimp_vn_insert(vn, key, vn->next_vn, SHRIMP_NO_INSTR);
+    return vn->next_vn++;
+}
+
+static Shrimp_VNKey Shrimp_vn_key(Shrimp_VN* vn, const Shrimp_Instr* instr) {
+    Shrimp_VNKey key = {
+        .op = instr->t,
+        .l = Shrimp_vn_ref(vn, instr->binop.l),
+        .r = Shrimp_vn_ref(vn, instr->binop.r),
+    };
+    // a > b is b < a and the order doesn't matter for + and *, bring them into one form
+    bool swap = false;
+    if (key.op == SHRIMP_IT_CMP_MT) {
+        key.op = SHRIMP_IT_CMP_LT;
+        swap = true;
+    } else if (key.op == SHRIMP_IT_ADD || key.op == SHRIMP_IT_MUL) {
+        swap = key.l > key.r;
+    }
+    if (swap) {
+        uint64_t v = key.l;
+        key.l = key.r;
+        key.r = v;
+    }
+    return key;
+}
+
+static uint32_t Shrimp_vn_lookup(Shrimp_VN* vn, Shrimp_VNKey key) {
+    for (uint32_t e = vn->buckets[Shrimp_vn_hash(key) & vn->bucket_mask]; e != SHRIMP_VN_NO_ENTRY; e = vn->items[e].next) {
+        const Shrimp_VNEntry* entry = &vn->items[e];
+        if (!Shrimp_vn_key_eq(entry->key, key)) continue;
+        if (entry->holder == SHRIMP_NO_INSTR || Shrimp_vn_temp(vn, entry->holder) == entry->vn) return e;
+    }
+    return SHRIMP_VN_NO_ENTRY;
+}
+
+static void Shrimp_vn_insert(Shrimp_VN* vn, Shrimp_VNKey key, uint32_t value, uint32_t holder) {
+    uint32_t* bucket = &vn->buckets[Shrimp_vn_hash(key) & vn->bucket_mask];
+    Shrimp_VNEntry entry = {.key = key, .vn = value, .holder = holder, .next = *bucket};
+    *bucket = vn->count;
+    Shrimp_da_push(vn, entry);
+}
+
+typedef struct {
+    size_t entries;
+    size_t undo;
+    uint32_t valid_from;
+} Shrimp_VNScope;
+
+static Shrimp_VNScope Shrimp_vn_scope(const Shrimp_VN* vn) {
+    return (Shrimp_VNScope){.entries = vn->count, .undo = vn->undo.count, .valid_from = vn->valid_from};
+}
+
+// Entries are pushed to the front of their bucket, so dropping them newest first restores the table
+static void Shrimp_vn_pop_to(Shrimp_VN* vn, Shrimp_VNScope scope) {
+    while (vn->count > scope.entries) {
+        const Shrimp_VNEntry* entry = &vn->items[--vn->count];
+        vn->buckets[Shrimp_vn_hash(entry->key) & vn->bucket_mask] = entry->next;
+    }
+    while (vn->undo.count > scope.undo) {
+        const Shrimp_VNUndo* undo = &vn->undo.items[--vn->undo.count];
+        vn->state[undo->temp] = undo->vn;
+        vn->stamp[undo->temp] = undo->stamp;
+    }
+    vn->valid_from = scope.valid_from;
+}
+
+static void Shrimp_vn_enter_block(Shrimp_VN* vn, uint32_t b) {
+    uint32_t idom = vn->global ? vn->cfg.idom[b] : SHRIMP_NO_BLOCK;
+    vn->current = vn->next_stamp++;
+    if (idom == SHRIMP_NO_BLOCK || vn->cfg.items[b].preds.count != 1) vn->valid_from = vn->current;
+}
+
+static bool Shrimp_vn_block(Shrimp_VN* vn, uint32_t b) {
+    Shrimp_Function* f = vn->func;
+    bool changed = false;
+    Shrimp_vn_enter_block(vn, b);
+    for (uint32_t i = vn->cfg.items[b].begin; i < vn->cfg.items[b].end; i++) {
+        Shrimp_Instr instr = f->items[i];
+        if (instr.t == SHRIMP_IT_ASSIGN) {
+            Shrimp_vn_def(vn, instr.assign.into, Shrimp_vn_ref(vn, instr.assign.v));
+            continue;
+        }
+        if (instr.t == SHRIMP_IT_CALL) {
+            Shrimp_vn_def(vn, instr.call.result, vn->next_vn++);
+            continue;
+        }
+        if (!Shrimp_instr_is_binop(instr.t)) continue;
+
+        Shrimp_VNKey key = Shrimp_vn_key(vn, &instr);
+        uint32_t result = instr.binop.result;
+        uint32_t e = Shrimp_vn_lookup(vn, key);
+        if (e == SHRIMP_VN_NO_ENTRY) {
+            Shrimp_vn_def(vn, result, vn->next_vn++);
+            Shrimp_vn_insert(vn, key, vn->state[result], result);
+            continue;
+        }
+        const Shrimp_VNEntry* entry = &vn->items[e];
+        if (entry->holder == result) {
+            // it already holds exactly this
+            Shrimp_function_remove_instr(f, i);
+        } else {
+            Shrimp_Instr copy = {
+                .t = SHRIMP_IT_ASSIGN,
+                .assign = {.into = result, .v = entry->holder},
+            };
+            Shrimp_function_set_instr(f, i, copy);
+            Shrimp_vn_def(vn, result, entry->vn);
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+static bool Shrimp_vn_dom_tree(Shrimp_VN* vn, uint32_t b) {
+    Shrimp_VNScope scope = Shrimp_vn_scope(vn);
+    bool changed = Shrimp_vn_block(vn, b);
+    for (uint32_t c = vn->cfg.dom_child[b]; c != SHRIMP_NO_BLOCK; c = vn->cfg.dom_sibling[c]) changed |= Shrimp_vn_dom_tree(vn, c);
+    Shrimp_vn_pop_to(vn, scope);
+    return changed;
+}
+
+static bool Shrimp_function_value_number(Shrimp_Function* f, bool global) {
+    if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+    Shrimp_VN vn = {.func = f, .global = global, .temps = f->temps.count, .next_vn = 0, .next_stamp = 1};
+    Shrimp_cfg_build(f, &vn.cfg);
+    Shrimp_cfg_dominators(&vn.cfg);
+
+    vn.state = malloc(sizeof(uint32_t) * (vn.temps + 1));
+    vn.stamp = malloc(sizeof(uint32_t) * (vn.temps + 1));
+    vn.once = malloc(sizeof(bool) * (vn.temps + 1));
+    for (size_t t = 0; t < vn.temps; t++) {
+        vn.once[t] = Shrimp_function_temp_def(f, t) != SHRIMP_NO_INSTR;
+        // temps nothing writes hold the same everywhere, stamp 0 is before every block so the rest get a
+        // new number when they are first read
+        vn.state[t] = vn.next_vn++;
+        vn.stamp[t] = f->uses.items[t].defs.count == 0 ? SHRIMP_VN_ALWAYS : 0;
+    }
+    size_t buckets = 16;
+    while (buckets < f->count * 2) buckets *= 2;
+    vn.buckets = malloc(sizeof(uint32_t) * buckets);
+    vn.bucket_mask = buckets - 1;
+    for (size_t i = 0; i < buckets; i++) vn.buckets[i] = SHRIMP_VN_NO_ENTRY;
+
+    bool changed = false;
+    if (global) {
+        changed = Shrimp_vn_dom_tree(&vn, 0);
+    } else {
+        for (uint32_t b = 0; b < vn.cfg.count; b++) {
+            Shrimp_VNScope scope = Shrimp_vn_scope(&vn);
+            changed |= Shrimp_vn_block(&vn, b);
+            Shrimp_vn_pop_to(&vn, scope);
+        }
+    }
+
+    Shrimp_da_free(&vn);
+    Shrimp_da_free(&vn.undo);
+    free(vn.buckets);
+    free(vn.once);
+    free(vn.stamp);
+    free(vn.state);
+    Shrimp_cfg_free(&vn.cfg);
+    return changed;
+}
+
+bool Shrimp_module_lvn(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) changed |= Shrimp_function_value_number(&mod->items[i], false);
+    return changed;
+}
+
+bool Shrimp_module_gvn(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) changed |= Shrimp_function_value_number(&mod->items[i], true);
+    return changed;
+}
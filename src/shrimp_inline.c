@@ -0,0 +1,193 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Inlining
+//
+// A call is replaced by a copy of the callee's body when the callee is small enough: what the body costs on
+// top of the arguments and the call it replaces has to stay within the threshold, which grows with every
+// constant argument since whatever depends on it folds away afterwards. A callee that is only called from one
+// place gets a much bigger budget, its own body goes away once it's inlined there. Callers stop taking in more
+// code once they reach a size limit.
+//
+// Only callees that don't make calls themselves are inlined, so a recursive function never is. Functions whose
+// calls all got inlined make none anymore and get their turn in the next round, so call chains get inlined
+// bottom up. The functions left without callers are dropped by the drop-unused pass at the end of the pipeline.
+//
+// The copy gets fresh temps and labels, the params become assignments of the arguments and every return becomes
+// an assignment of the call's result and a jump behind the copy.
+
+// how big a callee may be on top of what its call costs when the options don't say
+#define SHRIMP_INLINE_THRESHOLD 16
+// what every constant argument adds to it
+#define SHRIMP_INLINE_CONST_ARG_BONUS 8
+// the limit for callees with a single call site
+#define SHRIMP_INLINE_SINGLE_CALLER 256
+// a caller doesn't grow past this many instructions by inlining
+#define SHRIMP_INLINE_MAX_CALLER 8192
+#define SHRIMP_INLINE_MAX_ROUNDS 16
+
+static size_t Shrimp_inline_size(const Shrimp_Function* f) {
+    size_t size = 0;
+    for (size_t i = 0; i < f->count; i++) size += f->items[i].t != SHRIMP_IT_NOP && f->items[i].t != SHRIMP_IT_LABEL;
+    return size;
+}
+
+static void Shrimp_inline_set_def(Shrimp_Instr* instr, uint32_t temp) {
+    if (instr->t == SHRIMP_IT_ASSIGN) instr->assign.into = temp;
+    else instr->binop.result = temp;
+}
+
+// Replaces the call at `at` in f by the body of the callee, the arguments are the `argc` ARGs in front of it
+static void Shrimp_inline_call(Shrimp_Module* mod, Shrimp_Function* f, uint32_t at) {
+    Shrimp_Instr call = f->items[at];
+    const Shrimp_Function* callee = &mod->items[call.call.func];
+
+    uint32_t temps = f->temps.count;
+    for (size_t t = 0; t < callee->temps.count; t++) Shrimp_function_alloc_temp(f, callee->temps.items[t].size);
+    Shrimp_Label labels = f->label_count;
+    f->label_count += callee->label_count;
+    Shrimp_Label after = Shrimp_function_label_alloc(f);
+
+    Shrimp_InstrBuf out = {0};
+    // the ARGs are in order right in front of the call, so going back finds the last param first
+    uint32_t param = callee->param_count;
+    for (uint32_t i = at; param != 0;) {
+        i--;
+        if (f->items[i].t != SHRIMP_IT_ARG) continue;
+        param--;
+        Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = temps + param, .v = f->items[i].arg}}));
+        Shrimp_function_remove_instr(f, i);
+    }
+    for (size_t i = 0; i < callee->count; i++) {
+        Shrimp_Instr instr = callee->items[i];
+        if (instr.t == SHRIMP_IT_NOP) continue;
+        Shrimp_Ref* ops[2];
+        size_t n = Shrimp_instr_operands(&instr, ops);
+        for (size_t o = 0; o < n; o++) {
+            *ops[o] = SHRIMP_REF_IS_CONST(*ops[o]) ? Shrimp_function_const_ref(f, Shrimp_function_const(callee, *ops[o])) : temps + *ops[o];
+        }
+        uint32_t def;
+        if (Shrimp_instr_def(&instr, &def)) Shrimp_inline_set_def(&instr, temps + def);
+        if (instr.t == SHRIMP_IT_LABEL) instr.label += labels;
+        else if (instr.t == SHRIMP_IT_JUMP) instr.jmp.to += labels;
+        else if (Shrimp_instr_is_branch(instr.t)) instr.jmp_if_not.to += labels;
+        else if (instr.t == SHRIMP_IT_RETURN) {
+            Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = call.call.result, .v = instr.ret}}));
+            instr = (Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = after}};
+        }
+        Shrimp_da_push(&out, instr);
+    }
+    Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = after}));
+
+    Shrimp_function_remove_instr(f, at);
+    Shrimp_function_insert(f, at, out.items, out.count);
+    Shrimp_da_free(&out);
+}
+
+// How big the callee may be for this call to be inlined
+static size_t Shrimp_inline_budget(const Shrimp_Function* f, uint32_t at, size_t threshold, size_t sites) {
+    if (sites == 1) return SHRIMP_INLINE_SINGLE_CALLER;
+    size_t budget = threshold + f->items[at].call.argc + 1;
+    for (uint32_t i = at, left = f->items[at].call.argc; left != 0;) {
+        i--;
+        if (f->items[i].t != SHRIMP_IT_ARG) continue;
+        left--;
+        if (SHRIMP_REF_IS_CONST(f->items[i].arg)) budget += SHRIMP_INLINE_CONST_ARG_BONUS;
+    }
+    return budget;
+}
+
+bool Shrimp_module_inline(Shrimp_Module* mod) {
+    size_t threshold = mod->inline_threshold != 0 ? mod->inline_threshold : SHRIMP_INLINE_THRESHOLD;
+    // how often every function is called and whether it makes calls
+    size_t* sites = calloc(mod->count + 1, sizeof(size_t));
+    bool* calls = calloc(mod->count + 1, sizeof(bool));
+    size_t* sizes = malloc(sizeof(size_t) * (mod->count + 1));
+    bool changed = false;
+    for (size_t round = 0; round < SHRIMP_INLINE_MAX_ROUNDS; round++) {
+        memset(sites, 0, sizeof(size_t) * mod->count);
+        for (size_t i = 0; i < mod->count; i++) {
+            const Shrimp_Function* f = &mod->items[i];
+            calls[i] = false;
+            sizes[i] = Shrimp_inline_size(f);
+            for (size_t j = 0; j < f->count; j++) {
+                if (f->items[j].t != SHRIMP_IT_CALL) continue;
+                sites[f->items[j].call.func]++;
+                calls[i] = true;
+            }
+        }
+
+        bool inlined = false;
+        for (size_t i = 0; i < mod->count; i++) {
+            Shrimp_Function* f = &mod->items[i];
+            for (size_t j = 0; j < f->count; j++) {
+                if (f->items[j].t != SHRIMP_IT_CALL) continue;
+                uint32_t callee = f->items[j].call.func;
+                if (callee == i || calls[callee]) continue;
+                if (sizes[callee] > Shrimp_inline_budget(f, j, threshold, sites[callee])) continue;
+                if (sizes[i] + sizes[callee] > SHRIMP_INLINE_MAX_CALLER) continue;
+                if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+                Shrimp_inline_call(mod, f, j);
+                sizes[i] += sizes[callee];
+                sites[callee]--;
+                inlined = true;
+            }
+        }
+        if (!inlined) break;
+        changed = true;
+    }
+    free(sizes);
+    free(calls);
+    free(sites);
+    return changed;
+}
+
+// Dropping unused functions
+// Inlining, compile time evaluation and everything that deletes code can leave functions without callers. The
+// ones no chain of calls from the entry _start or an exported function reaches anymore are dropped and the calls
+// to the rest renumbered, modules without an entry keep all of their functions.
+bool Shrimp_module_drop_unused(Shrimp_Module* mod) {
+    uint32_t entry = Shrimp_module_find_function(mod, "_start");
+    if (entry == SHRIMP_NO_FUNCTION) return false;
+    bool* reached = calloc(mod->count + 1, sizeof(bool));
+    uint32_t* stack = malloc(sizeof(uint32_t) * (mod->count + 1));
+    size_t stack_count = 0;
+    for (size_t i = 0; i < mod->count; i++) {
+        if (i != entry && !mod->items[i].exported) continue;
+        reached[i] = true;
+        stack[stack_count++] = i;
+    }
+    while (stack_count != 0) {
+        const Shrimp_Function* f = &mod->items[stack[--stack_count]];
+        for (size_t j = 0; j < f->count; j++) {
+            if (f->items[j].t != SHRIMP_IT_CALL || reached[f->items[j].call.func]) continue;
+            reached[f->items[j].call.func] = true;
+            stack[stack_count++] = f->items[j].call.func;
+        }
+    }
+
+    uint32_t* index = stack;
+    size_t kept = 0;
+    for (size_t i = 0; i < mod->count; i++) {
+        if (!reached[i]) {
+            index[i] = SHRIMP_NO_FUNCTION;
+            Shrimp_function_free(&mod->items[i]);
+            continue;
+        }
+        index[i] = kept;
+        mod->items[kept++] = mod->items[i];
+    }
+    bool changed = kept != mod->count;
+    mod->count = kept;
+    for (size_t i = 0; i < mod->count && changed; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        for (size_t j = 0; j < f->count; j++) {
+            if (f->items[j].t == SHRIMP_IT_CALL) f->items[j].call.func = index[f->items[j].call.func];
+        }
+    }
+    free(index);
+    free(reached);
+    return changed;
+}
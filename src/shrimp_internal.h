@@ -0,0 +1,171 @@
+#ifndef SHRIMP_INTERNAL_H_
+#define SHRIMP_INTERNAL_H_
+
+// Only for use inside of the Shrimp library itself
+#include "shrimp.h"
+#include <stdlib.h>
+#include <string.h>
+
+// A zero capacity with a non zero count means the items are borrowed (for example from a mapped bytecode file)
+// so they get copied out on the first push and never freed
+#define SHRIMP_DA_INIT_CAP 16
+#define Shrimp_da_push(arr, item) do { \
+    if ((arr)->capacity == 0) {\
+        void* borrowed = (arr)->items; \
+        (arr)->capacity = (arr)->count + SHRIMP_DA_INIT_CAP;\
+        (arr)->items = malloc(sizeof(*(arr)->items) * (arr)->capacity);\
+        if ((arr)->count != 0) memcpy((arr)->items, borrowed, sizeof(*(arr)->items) * (arr)->count); \
+    }\
+    if ((arr)->count >= (arr)->capacity) {\
+        (arr)->capacity *= 1.5; \
+        (arr)->items = realloc((arr)->items, sizeof(*(arr)->items) * (arr)->capacity); \
+    }\
+    (arr)->items[(arr)->count++] = (item);\
+} while (false)
+
+#define Shrimp_da_free(arr) do { \
+    if ((arr)->capacity != 0) free((arr)->items); \
+} while (false)
+
+// Instructions put together by a pass before they go into the body with Shrimp_function_insert
+typedef struct {
+    Shrimp_Instr* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_InstrBuf;
+
+// Applies a binary operation to two constants the same way the generated code would
+// Returns false if the result isn't defined (division by zero)
+bool Shrimp_eval_binop(uint8_t t, uint64_t l, uint64_t r, uint64_t* out);
+bool Shrimp_instr_is_binop(uint8_t t);
+// Makes an instruction that writes a temp (see Shrimp_instr_def) write to `temp` instead
+void Shrimp_instr_set_def(Shrimp_Instr* instr, uint32_t temp);
+// A division by something that isn't a constant other than 0, which traps on 0 so it can't go away unread
+bool Shrimp_instr_may_trap(const Shrimp_Function* func, const Shrimp_Instr* instr);
+// SHRIMP_IT_JUMP_IF_NOT or SHRIMP_IT_JUMP_IF, both read their operands through jmp_if_not
+bool Shrimp_instr_is_branch(uint8_t t);
+// Frees what the function owns, for dropping it from a module
+void Shrimp_function_free(Shrimp_Function* func);
+// Whether control falling through to `at` ends up at the label without doing anything
+bool Shrimp_function_falls_to(const Shrimp_Function* func, uint32_t at, Shrimp_Label label);
+// Whether the call at `at` is in tail position, what it returns is returned right away
+bool Shrimp_function_is_tail_call(const Shrimp_Function* func, uint32_t at);
+
+// ---- CFG ----
+#define SHRIMP_NO_BLOCK UINT32_MAX
+
+// A label can only be at the beginning of a block and a jump or return only at the end
+typedef struct {
+    uint32_t begin;
+    uint32_t end;
+    uint32_t succs[2];
+    uint32_t succ_count;
+    Shrimp_InstrList preds;
+} Shrimp_Block;
+
+typedef struct {
+    Shrimp_Block* items;
+    size_t count;
+    size_t capacity;
+    // indexed by label, SHRIMP_NO_BLOCK for labels that aren't placed
+    uint32_t* label_block;
+    uint32_t* instr_block;
+    // filled in by Shrimp_cfg_dominators, only the blocks reachable from the entry are in the reverse post order
+    // the dominator tree is kept as a first child and next sibling link for every block
+    uint32_t* rpo;
+    size_t rpo_count;
+    uint32_t* idom;
+    uint32_t* dom_child;
+    uint32_t* dom_sibling;
+} Shrimp_CFG;
+
+// Block 0 is always the entry, even for an empty function
+void Shrimp_cfg_build(const Shrimp_Function* func, Shrimp_CFG* out);
+void Shrimp_cfg_free(Shrimp_CFG* cfg);
+// The block control continues in when a block doesn't jump, SHRIMP_NO_BLOCK if it leaves the function
+uint32_t Shrimp_cfg_fallthrough(const Shrimp_CFG* cfg, uint32_t block);
+// The last instruction of the block if it's a jump, a conditional jump or a return, NULL otherwise
+const Shrimp_Instr* Shrimp_cfg_terminator(const Shrimp_Function* func, const Shrimp_CFG* cfg, uint32_t block);
+// Immediate dominators, the entry and unreachable blocks have SHRIMP_NO_BLOCK
+void Shrimp_cfg_dominators(Shrimp_CFG* cfg);
+// Whether every path from the entry to b goes through a, a block dominates itself
+bool Shrimp_cfg_dominates(const Shrimp_CFG* cfg, uint32_t a, uint32_t b);
+
+// Natural loops, the ones sharing a header are merged into one
+typedef struct {
+    uint32_t header;
+    // the header comes first, the rest is in no particular order
+    Shrimp_InstrList blocks;
+    // indexed by block
+    bool* contains;
+    // index of the innermost loop around this one in Shrimp_Loops, SHRIMP_NO_BLOCK if there's none
+    uint32_t parent;
+} Shrimp_Loop;
+
+typedef struct {
+    Shrimp_Loop* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_Loops;
+
+// Needs the dominators, inner loops come before the ones around them
+void Shrimp_cfg_loops(const Shrimp_CFG* cfg, Shrimp_Loops* out);
+void Shrimp_loops_free(Shrimp_Loops* loops);
+// Whether code can be put in front of the loop so it runs once every time the loop is entered from outside
+bool Shrimp_loop_has_preheader(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop);
+// Puts the instructions there, adding a label and redirecting the jumps from outside of the loop if needed
+// Returns how many instructions went in front of the header, everything from the header on moves back by that
+size_t Shrimp_loop_insert_preheader(Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop, const Shrimp_Instr* instrs, size_t count);
+
+// A loop whose header ends in the test `i < n` and leaves when it fails, with i going up by a constant
+typedef struct {
+    uint32_t counter;
+    // the only instruction in the loop writing the counter, it isn't in the header or inside of a nested loop
+    uint32_t step_instr;
+    uint64_t step;
+    // a constant or a temp the loop doesn't write
+    Shrimp_Ref limit;
+    uint32_t test_instr;
+    // the step runs exactly once between two runs of the header
+    bool every_round;
+} Shrimp_CountedLoop;
+
+// All of these need the dominators
+bool Shrimp_loop_counted(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loops* loops, const Shrimp_Loop* loop, Shrimp_CountedLoop* out);
+// The constant the temp holds every time the loop is entered, if it's always the same one
+bool Shrimp_loop_entry_const(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop, uint32_t temp, uint64_t* out);
+// How many times the header's test passes, needs a constant start and limit and the step to run every round
+bool Shrimp_loop_trip_count(const Shrimp_Function* func, const Shrimp_CFG* cfg, const Shrimp_Loop* loop, const Shrimp_CountedLoop* counted, uint64_t* out);
+
+// Which temps are live at the start of every block
+typedef struct {
+    uint64_t* live_in;
+    size_t words;
+} Shrimp_Liveness;
+
+#define SHRIMP_BITS_WORD(i) ((i) / 64)
+#define SHRIMP_BITS_MASK(i) ((uint64_t)1 << ((i) % 64))
+#define SHRIMP_BITS_TEST(bits, i) (((bits)[SHRIMP_BITS_WORD(i)] & SHRIMP_BITS_MASK(i)) != 0)
+
+void Shrimp_liveness_compute(const Shrimp_Function* func, const Shrimp_CFG* cfg, Shrimp_Liveness* out);
+void Shrimp_liveness_free(Shrimp_Liveness* liveness);
+// Sets `live` to what is live at the end of the block
+void Shrimp_liveness_out(const Shrimp_CFG* cfg, const Shrimp_Liveness* liveness, uint32_t block, uint64_t* live);
+// Moves `live` from after the instruction to before it
+void Shrimp_liveness_step(const Shrimp_Instr* instr, uint64_t* live);
+
+// ---- Cleanups shared by the passes ----
+// Removes the blocks no path from the entry reaches
+bool Shrimp_dce_unreachable(Shrimp_Function* func);
+// Removes jumps to where control goes anyway and labels nothing jumps to
+bool Shrimp_dce_labels(Shrimp_Function* func);
+
+// ---- Profiles ----
+// The layout of the file is described in shrimp_profile.c
+#define SHRIMP_PROFILE_MAGIC "SHRPROF1"
+size_t Shrimp_profile_branch_count(const Shrimp_Function* func);
+// Changes with the shape of the body the counters belong to
+uint64_t Shrimp_profile_checksum(const Shrimp_Function* func);
+#define SHRIMP_BRANCH_HAS_WEIGHTS(instr) ((instr)->jmp_if_not.taken != 0 || (instr)->jmp_if_not.not_taken != 0)
+
+#endif
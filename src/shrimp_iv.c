@@ -0,0 +1,282 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Induction variables and loop strength reduction
+//
+// A basic induction variable is a temp whose only write in the loop is `i <- i + c` or `i <- i - c` with c a
+// constant. A multiplication `j <- i * k` with k not written in the loop is a derived one: it gets its own temp
+// J that is set to i * k in front of the loop and has c * k added right after every step of i, so J == i * k
+// holds everywhere in the loop and the multiplication becomes a copy of J.
+//
+// With that done the loop's test `i < n` can often be made on J instead (linear function test replacement).
+// That needs i * k and n * k to not overflow for any value i takes at the test, which is only known for a
+// test in the header that leaves the loop, a constant n, k and start value and i stepping up once per round.
+// A counter whose only read left in the loop is its own step and that isn't read after the loop is removed.
+//
+// Loops are done inner first, one per round with everything rebuilt after it, like licm does.
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    Shrimp_Loops loops;
+    Shrimp_Liveness liveness;
+} Shrimp_IV;
+
+typedef struct {
+    uint32_t temp;
+    // the instruction stepping it and by how much, a subtraction is an addition of the negated constant
+    uint32_t step_instr;
+    uint64_t step;
+    // J and what i is multiplied with, J is SHRIMP_NO_INSTR while it's only the basic one
+    uint32_t derived;
+    Shrimp_Ref k;
+} Shrimp_IVDerived;
+
+typedef struct {
+    Shrimp_IVDerived* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_IVDeriveds;
+
+typedef struct {
+    uint32_t at;
+    Shrimp_Instr instr;
+} Shrimp_IVInsert;
+
+static bool Shrimp_iv_defined_in(const Shrimp_IV* iv, const Shrimp_Loop* loop, uint32_t temp) {
+    const Shrimp_InstrList* defs = &iv->func->uses.items[temp].defs;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (loop->contains[iv->cfg.instr_block[defs->items[i]]]) return true;
+    }
+    return false;
+}
+
+static bool Shrimp_iv_invariant_ref(const Shrimp_IV* iv, const Shrimp_Loop* loop, Shrimp_Ref ref) {
+    return SHRIMP_REF_IS_CONST(ref) || !Shrimp_iv_defined_in(iv, loop, ref);
+}
+
+// The same constant can sit in the pool more than once
+static bool Shrimp_iv_same_ref(const Shrimp_Function* f, Shrimp_Ref a, Shrimp_Ref b) {
+    if (SHRIMP_REF_IS_CONST(a) && SHRIMP_REF_IS_CONST(b)) return Shrimp_function_const(f, a) == Shrimp_function_const(f, b);
+    return a == b;
+}
+
+// Fills in temp, step_instr and step if `temp` is a basic induction variable of the loop
+static bool Shrimp_iv_basic(const Shrimp_IV* iv, const Shrimp_Loop* loop, uint32_t temp, Shrimp_IVDerived* out) {
+    const Shrimp_Function* f = iv->func;
+    const Shrimp_InstrList* defs = &f->uses.items[temp].defs;
+    uint32_t step_instr = SHRIMP_NO_INSTR;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (!loop->contains[iv->cfg.instr_block[defs->items[i]]]) continue;
+        if (step_instr != SHRIMP_NO_INSTR) return false;
+        step_instr = defs->items[i];
+    }
+    if (step_instr == SHRIMP_NO_INSTR) return false;
+
+    Shrimp_Instr instr = f->items[step_instr];
+    Shrimp_Ref l = instr.binop.l, r = instr.binop.r;
+    if (instr.t == SHRIMP_IT_ADD && SHRIMP_REF_IS_CONST(l)) {
+        l = instr.binop.r;
+        r = instr.binop.l;
+    }
+    if (instr.t != SHRIMP_IT_ADD && instr.t != SHRIMP_IT_SUB) return false;
+    if (l != temp || !SHRIMP_REF_IS_CONST(r)) return false;
+    uint64_t c = Shrimp_function_const(f, r);
+    *out = (Shrimp_IVDerived){
+        .temp = temp,
+        .step_instr = step_instr,
+        .step = instr.t == SHRIMP_IT_ADD ? c : -c,
+        .derived = SHRIMP_NO_INSTR,
+    };
+    return true;
+}
+
+static bool Shrimp_iv_live_after(const Shrimp_IV* iv, const Shrimp_Loop* loop, uint32_t temp) {
+    for (size_t i = 0; i < loop->blocks.count; i++) {
+        const Shrimp_Block* b = &iv->cfg.items[loop->blocks.items[i]];
+        for (size_t s = 0; s < b->succ_count; s++) {
+            if (loop->contains[b->succs[s]]) continue;
+            if (SHRIMP_BITS_TEST(&iv->liveness.live_in[b->succs[s] * iv->liveness.words], temp)) return true;
+        }
+    }
+    return false;
+}
+
+// Tries to turn the header's `i < n` into `J < n * k`, see the top of the file for when that's alright
+static bool Shrimp_iv_replace_test(Shrimp_IV* iv, const Shrimp_Loop* loop, const Shrimp_IVDerived* d) {
+    Shrimp_Function* f = iv->func;
+    Shrimp_CountedLoop counted;
+    uint64_t start;
+    if (!SHRIMP_REF_IS_CONST(d->k)) return false;
+    uint64_t k = Shrimp_function_const(f, d->k);
+    if (k == 0) return false;
+    if (!Shrimp_loop_counted(f, &iv->cfg, &iv->loops, loop, &counted) || counted.counter != d->temp) return false;
+    if (!SHRIMP_REF_IS_CONST(counted.limit) || !Shrimp_loop_entry_const(f, &iv->cfg, loop, d->temp, &start)) return false;
+
+    uint64_t bound = Shrimp_function_const(f, counted.limit);
+    // i runs from start to at most n + c - 1 at the test, all of that times k has to fit
+    if (start > bound) return false;
+    unsigned __int128 top = ((unsigned __int128)bound + counted.step - 1) * k;
+    if (top >> 64) return false;
+
+    Shrimp_Instr test = {
+        .t = SHRIMP_IT_CMP_LT,
+        .binop = {.l = d->derived, .r = Shrimp_function_const_ref(f, bound * k), .result = f->items[counted.test_instr].binop.result},
+    };
+    Shrimp_function_set_instr(f, counted.test_instr, test);
+    return true;
+}
+
+// Removes the step of a counter nothing in the loop or after it reads anymore
+static bool Shrimp_iv_remove_counters(Shrimp_IV* iv, const Shrimp_Loop* loop, const Shrimp_IVDeriveds* basics) {
+    Shrimp_Function* f = iv->func;
+    bool changed = false;
+    for (size_t b = 0; b < basics->count; b++) {
+        const Shrimp_IVDerived* d = &basics->items[b];
+        const Shrimp_InstrList* uses = &f->uses.items[d->temp].uses;
+        bool read = false;
+        for (size_t u = 0; u < uses->count && !read; u++) {
+            read = uses->items[u] != d->step_instr && loop->contains[iv->cfg.instr_block[uses->items[u]]];
+        }
+        if (read || Shrimp_iv_live_after(iv, loop, d->temp)) continue;
+        Shrimp_function_remove_instr(f, d->step_instr);
+        changed = true;
+    }
+    return changed;
+}
+
+static int Shrimp_iv_insert_cmp(const void* a, const void* b) {
+    uint32_t x = ((const Shrimp_IVInsert*)a)->at, y = ((const Shrimp_IVInsert*)b)->at;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Reduces the multiplications of the loop's induction variables, returns false if there were none
+static bool Shrimp_iv_loop(Shrimp_IV* iv, const Shrimp_Loop* loop) {
+    Shrimp_Function* f = iv->func;
+    Shrimp_IVDeriveds basics = {0};
+    for (size_t t = 0; t < f->temps.count; t++) {
+        Shrimp_IVDerived d;
+        if (Shrimp_iv_basic(iv, loop, t, &d)) Shrimp_da_push(&basics, d);
+    }
+    if (basics.count == 0) return false;
+    if (Shrimp_iv_remove_counters(iv, loop, &basics)) {
+        Shrimp_da_free(&basics);
+        return true;
+    }
+    if (!Shrimp_loop_has_preheader(f, &iv->cfg, loop)) {
+        Shrimp_da_free(&basics);
+        return false;
+    }
+
+    // every basic variable and factor gets its own J, the same pair a second time reuses it
+    Shrimp_IVDeriveds derived = {0};
+    for (size_t b = 0; b < loop->blocks.count; b++) {
+        const Shrimp_Block* block = &iv->cfg.items[loop->blocks.items[b]];
+        for (uint32_t i = block->begin; i < block->end; i++) {
+            Shrimp_Instr instr = f->items[i];
+            if (instr.t != SHRIMP_IT_MUL) continue;
+            for (size_t side = 0; side < 2; side++) {
+                Shrimp_Ref x = side == 0 ? instr.binop.l : instr.binop.r;
+                Shrimp_Ref k = side == 0 ? instr.binop.r : instr.binop.l;
+                if (SHRIMP_REF_IS_CONST(x) || x == k || !Shrimp_iv_invariant_ref(iv, loop, k)) continue;
+                size_t basic = 0;
+                while (basic < basics.count && basics.items[basic].temp != x) basic++;
+                if (basic == basics.count) continue;
+
+                size_t j = 0;
+                while (j < derived.count && (derived.items[j].temp != x || !Shrimp_iv_same_ref(f, derived.items[j].k, k))) j++;
+                if (j == derived.count) {
+                    Shrimp_IVDerived d = basics.items[basic];
+                    d.k = k;
+                    d.derived = Shrimp_function_alloc_temp(f, 8).t;
+                    Shrimp_da_push(&derived, d);
+                }
+                Shrimp_Instr copy = {.t = SHRIMP_IT_ASSIGN, .assign = {.into = instr.binop.result, .v = derived.items[j].derived}};
+                Shrimp_function_set_instr(f, i, copy);
+                break;
+            }
+        }
+    }
+    if (derived.count == 0) {
+        Shrimp_da_free(&basics);
+        return false;
+    }
+
+    // what goes in front of the loop and what goes after the steps
+    Shrimp_Instr* preheader = malloc(sizeof(Shrimp_Instr) * derived.count * 2);
+    Shrimp_IVInsert* steps = malloc(sizeof(Shrimp_IVInsert) * derived.count);
+    size_t preheader_count = 0;
+    for (size_t j = 0; j < derived.count; j++) {
+        const Shrimp_IVDerived* d = &derived.items[j];
+        uint64_t start;
+        if (SHRIMP_REF_IS_CONST(d->k) && Shrimp_loop_entry_const(f, &iv->cfg, loop, d->temp, &start)) {
+            Shrimp_Ref value = Shrimp_function_const_ref(f, start * Shrimp_function_const(f, d->k));
+            preheader[preheader_count++] = (Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = d->derived, .v = value}};
+        } else {
+            preheader[preheader_count++] = (Shrimp_Instr){.t = SHRIMP_IT_MUL, .binop = {.l = d->temp, .r = d->k, .result = d->derived}};
+        }
+        Shrimp_Ref step;
+        if (SHRIMP_REF_IS_CONST(d->k)) {
+            step = Shrimp_function_const_ref(f, d->step * Shrimp_function_const(f, d->k));
+        } else {
+            step = Shrimp_function_alloc_temp(f, 8).t;
+            preheader[preheader_count++] = (Shrimp_Instr){.t = SHRIMP_IT_MUL, .binop = {.l = d->k, .r = Shrimp_function_const_ref(f, d->step), .result = step}};
+        }
+        steps[j] = (Shrimp_IVInsert){
+            .at = d->step_instr + 1,
+            .instr = {.t = SHRIMP_IT_ADD, .binop = {.l = d->derived, .r = step, .result = d->derived}},
+        };
+    }
+
+    // the test still reads i at this point, all that's left is the instruction indices moving
+    for (size_t j = 0; j < derived.count; j++) {
+        if (Shrimp_iv_replace_test(iv, loop, &derived.items[j])) break;
+    }
+
+    uint32_t header_begin = iv->cfg.items[loop->header].begin;
+    size_t moved = Shrimp_loop_insert_preheader(f, &iv->cfg, loop, preheader, preheader_count);
+    for (size_t j = 0; j < derived.count; j++) {
+        if (steps[j].at > header_begin) steps[j].at += moved;
+    }
+    // back to front so inserting doesn't move what's still to be inserted
+    qsort(steps, derived.count, sizeof(Shrimp_IVInsert), Shrimp_iv_insert_cmp);
+    for (size_t j = 0; j < derived.count; j++) Shrimp_function_insert(f, steps[j].at, &steps[j].instr, 1);
+
+    free(steps);
+    free(preheader);
+    Shrimp_da_free(&derived);
+    Shrimp_da_free(&basics);
+    return true;
+}
+
+static bool Shrimp_iv_round(Shrimp_Function* f) {
+    Shrimp_IV iv = {.func = f};
+    Shrimp_cfg_build(f, &iv.cfg);
+    Shrimp_cfg_dominators(&iv.cfg);
+    Shrimp_cfg_loops(&iv.cfg, &iv.loops);
+    Shrimp_liveness_compute(f, &iv.cfg, &iv.liveness);
+
+    bool changed = false;
+    for (size_t l = 0; l < iv.loops.count && !changed; l++) changed = Shrimp_iv_loop(&iv, &iv.loops.items[l]);
+
+    Shrimp_liveness_free(&iv.liveness);
+    Shrimp_loops_free(&iv.loops);
+    Shrimp_cfg_free(&iv.cfg);
+    return changed;
+}
+
+bool Shrimp_module_iv(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        // every round removes a multiplication or an instruction from a loop, this only guards against a bug
+        for (size_t rounds = 0; rounds < f->count && Shrimp_iv_round(f); rounds++) {
+            Shrimp_function_compact(f);
+            changed = true;
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,67 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Block layout
+//
+// A conditional jump the profile says is mostly taken leaves the code right after it as the unlikely way.
+// That code gets moved to the end of the function and the jump turned around to go there instead:
+//     jump_z c @T; F; T: ...        ->     jump_nz c @F'; T: ... return; F': F; jump @T
+// so the likely way falls through and the unlikely code stays out of the way. F has to be straight line code
+// that either leaves with a jump or return or falls into T, and T has to come right after it. An `if` whose
+// body is mostly skipped and an `if` whose body mostly doesn't return or break out both look like that.
+//
+// Without weights (no profile was used) nothing happens.
+
+// Moves the code after the branch at `index` to the end of the function if that's the unlikely way
+static bool Shrimp_layout_branch(Shrimp_Function* f, uint32_t index) {
+    Shrimp_Instr branch = f->items[index];
+    if (!Shrimp_instr_is_branch(branch.t) || branch.jmp_if_not.taken <= branch.jmp_if_not.not_taken) return false;
+    Shrimp_Label target = branch.jmp_if_not.to;
+
+    uint32_t end = index + 1;
+    size_t size = 0;
+    for (; end < f->count; end++) {
+        uint8_t t = f->items[end].t;
+        if (t == SHRIMP_IT_LABEL || t == SHRIMP_IT_JUMP || t == SHRIMP_IT_RETURN || Shrimp_instr_is_branch(t)) break;
+        size += t != SHRIMP_IT_NOP;
+    }
+    if (end >= f->count || Shrimp_instr_is_branch(f->items[end].t)) return false;
+    bool falls = f->items[end].t == SHRIMP_IT_LABEL;
+    if (!falls) end++;
+    else if (size == 0) return false;
+    if (!Shrimp_function_falls_to(f, end, target)) return false;
+
+    Shrimp_Label moved = Shrimp_function_label_alloc(f);
+    Shrimp_Instr turned = {
+        .t = branch.t == SHRIMP_IT_JUMP_IF_NOT ? SHRIMP_IT_JUMP_IF : SHRIMP_IT_JUMP_IF_NOT,
+        .jmp_if_not = {.cond = branch.jmp_if_not.cond, .to = moved, .taken = branch.jmp_if_not.not_taken, .not_taken = branch.jmp_if_not.taken},
+    };
+    Shrimp_function_set_instr(f, index, turned);
+    Shrimp_function_push(f, (Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = moved});
+    for (uint32_t i = index + 1; i < end; i++) {
+        if (f->items[i].t == SHRIMP_IT_NOP) continue;
+        Shrimp_function_push(f, f->items[i]);
+        Shrimp_function_remove_instr(f, i);
+    }
+    if (falls) Shrimp_function_push(f, (Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = target}});
+    return true;
+}
+
+bool Shrimp_module_layout(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        // the moved code goes at the end, where nothing may fall into it
+        uint32_t last = f->count;
+        while (last > 0 && f->items[last - 1].t == SHRIMP_IT_NOP) last--;
+        if (last == 0 || (f->items[last - 1].t != SHRIMP_IT_JUMP && f->items[last - 1].t != SHRIMP_IT_RETURN)) continue;
+
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        // what gets moved ends in a jump or return too and has no branches, so it's never looked at again
+        uint32_t count = f->count;
+        for (uint32_t j = 0; j < count; j++) changed |= Shrimp_layout_branch(f, j);
+    }
+    return changed;
+}
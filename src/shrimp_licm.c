@@ -0,0 +1,145 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Loop invariant code motion
+//
+// An instruction in a loop gets moved in front of the loop's header (the preheader, which is made if there's
+// no block that only runs on entering the loop) if
+//   - everything it reads is a constant or isn't written in the loop, or only by instructions moved already
+//   - it is the only instruction in the loop writing its temp
+//   - the temp isn't live on entry to the header, so every read in the loop sees this instruction's value
+//   - the temp isn't live after the loop or the instruction runs before every exit of it
+// Division traps on zero, so it only moves when the divisor is a nonzero constant or when the loop would
+// run it anyway. With the condition at the top of while loops that's only true for the condition itself.
+//
+// Loops are done inner first and everything gets rebuilt after each, so what moved out of an inner loop can
+// move out of the one around it next.
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    Shrimp_Loops loops;
+    Shrimp_Liveness liveness;
+    bool* hoisted;
+} Shrimp_LICM;
+
+static bool Shrimp_licm_invariant_ref(const Shrimp_LICM* licm, const Shrimp_Loop* loop, Shrimp_Ref ref) {
+    if (SHRIMP_REF_IS_CONST(ref)) return true;
+    const Shrimp_InstrList* defs = &licm->func->uses.items[ref].defs;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (loop->contains[licm->cfg.instr_block[defs->items[i]]] && !licm->hoisted[defs->items[i]]) return false;
+    }
+    return true;
+}
+
+static bool Shrimp_licm_runs_before_exits(const Shrimp_LICM* licm, const Shrimp_Loop* loop, uint32_t block) {
+    for (size_t i = 0; i < loop->blocks.count; i++) {
+        const Shrimp_Block* b = &licm->cfg.items[loop->blocks.items[i]];
+        for (size_t s = 0; s < b->succ_count; s++) {
+            if (loop->contains[b->succs[s]]) continue;
+            if (!Shrimp_cfg_dominates(&licm->cfg, block, loop->blocks.items[i])) return false;
+        }
+    }
+    return true;
+}
+
+static bool Shrimp_licm_live_after(const Shrimp_LICM* licm, const Shrimp_Loop* loop, uint32_t temp) {
+    for (size_t i = 0; i < loop->blocks.count; i++) {
+        const Shrimp_Block* b = &licm->cfg.items[loop->blocks.items[i]];
+        for (size_t s = 0; s < b->succ_count; s++) {
+            if (loop->contains[b->succs[s]]) continue;
+            if (SHRIMP_BITS_TEST(&licm->liveness.live_in[b->succs[s] * licm->liveness.words], temp)) return true;
+        }
+    }
+    return false;
+}
+
+static bool Shrimp_licm_can_hoist(const Shrimp_LICM* licm, const Shrimp_Loop* loop, uint32_t index) {
+    Shrimp_Function* f = licm->func;
+    Shrimp_Instr instr = f->items[index];
+    uint32_t block = licm->cfg.instr_block[index];
+    uint32_t def;
+    if (instr.t != SHRIMP_IT_ASSIGN && !Shrimp_instr_is_binop(instr.t)) return false;
+    if (!Shrimp_instr_def(&instr, &def)) return false;
+
+    Shrimp_Ref* ops[2];
+    size_t n = Shrimp_instr_operands(&instr, ops);
+    for (size_t i = 0; i < n; i++) {
+        if (!Shrimp_licm_invariant_ref(licm, loop, *ops[i])) return false;
+    }
+    const Shrimp_InstrList* defs = &f->uses.items[def].defs;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (defs->items[i] != index && loop->contains[licm->cfg.instr_block[defs->items[i]]]) return false;
+    }
+    if (SHRIMP_BITS_TEST(&licm->liveness.live_in[loop->header * licm->liveness.words], def)) return false;
+
+    bool always = Shrimp_licm_runs_before_exits(licm, loop, block);
+    if (!always && Shrimp_licm_live_after(licm, loop, def)) return false;
+    return always || !Shrimp_instr_may_trap(f, &instr);
+}
+
+// Moves the marked instructions in front of the loop, returns false if the loop can't get a preheader
+static bool Shrimp_licm_move(Shrimp_LICM* licm, const Shrimp_Loop* loop, const Shrimp_InstrList* moved) {
+    Shrimp_Function* f = licm->func;
+    if (!Shrimp_loop_has_preheader(f, &licm->cfg, loop)) return false;
+    Shrimp_Instr* instrs = malloc(sizeof(Shrimp_Instr) * moved->count);
+    for (size_t i = 0; i < moved->count; i++) {
+        instrs[i] = f->items[moved->items[i]];
+        Shrimp_function_remove_instr(f, moved->items[i]);
+    }
+    Shrimp_loop_insert_preheader(f, &licm->cfg, loop, instrs, moved->count);
+    free(instrs);
+    return true;
+}
+
+// Hoists out of the first loop that has something to hoist, returns false if none had anything
+static bool Shrimp_licm_round(Shrimp_Function* f) {
+    Shrimp_LICM licm = {.func = f};
+    Shrimp_cfg_build(f, &licm.cfg);
+    Shrimp_cfg_dominators(&licm.cfg);
+    Shrimp_cfg_loops(&licm.cfg, &licm.loops);
+    Shrimp_liveness_compute(f, &licm.cfg, &licm.liveness);
+    licm.hoisted = calloc(f->count + 1, sizeof(bool));
+
+    bool changed = false;
+    Shrimp_InstrList moved = {0};
+    for (size_t l = 0; l < licm.loops.count && !changed; l++) {
+        const Shrimp_Loop* loop = &licm.loops.items[l];
+        moved.count = 0;
+        memset(licm.hoisted, 0, sizeof(bool) * f->count);
+        // in reverse post order what an instruction reads was looked at before it
+        for (size_t r = 0; r < licm.cfg.rpo_count; r++) {
+            uint32_t b = licm.cfg.rpo[r];
+            if (!loop->contains[b]) continue;
+            for (uint32_t i = licm.cfg.items[b].begin; i < licm.cfg.items[b].end; i++) {
+                if (!Shrimp_licm_can_hoist(&licm, loop, i)) continue;
+                licm.hoisted[i] = true;
+                Shrimp_da_push(&moved, i);
+            }
+        }
+        if (moved.count != 0) changed = Shrimp_licm_move(&licm, loop, &moved);
+    }
+
+    Shrimp_da_free(&moved);
+    free(licm.hoisted);
+    Shrimp_liveness_free(&licm.liveness);
+    Shrimp_loops_free(&licm.loops);
+    Shrimp_cfg_free(&licm.cfg);
+    return changed;
+}
+
+bool Shrimp_module_licm(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        // every round moves at least one instruction out of a loop, this only guards against a bug looping forever
+        for (size_t rounds = 0; rounds < f->count && Shrimp_licm_round(f); rounds++) {
+            Shrimp_function_compact(f);
+            changed = true;
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,231 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Every pass there is, the order here doesn't matter, the default pipeline below decides that
+static const Shrimp_Pass shrimp_passes[] = {
+    {.name = "tailrec",    .flag = SHRIMP_OPT_TAIL_REC,   .run = Shrimp_module_tailrec},
+    {.name = "inline",     .flag = SHRIMP_OPT_INLINE,     .run = Shrimp_module_inline},
+    {.name = "eval",       .flag = SHRIMP_OPT_EVAL,       .run = Shrimp_module_eval},
+    {.name = "const-fold", .flag = SHRIMP_OPT_CONST_FOLD, .run = Shrimp_module_const_fold},
+    {.name = "algebra",    .flag = SHRIMP_OPT_ALGEBRA,    .run = Shrimp_module_algebra},
+    {.name = "sccp",       .flag = SHRIMP_OPT_SCCP,       .run = Shrimp_module_sccp},
+    {.name = "dce",        .flag = SHRIMP_OPT_DEAD_CODE,  .run = Shrimp_module_dce},
+    {.name = "simplify-cfg", .flag = SHRIMP_OPT_SIMPLIFY_CFG, .run = Shrimp_module_simplify_cfg},
+    {.name = "copy-prop",  .flag = SHRIMP_OPT_COPY_PROP,  .run = Shrimp_module_copy_prop},
+    {.name = "lvn",        .flag = SHRIMP_OPT_LOCAL_CSE,  .run = Shrimp_module_lvn},
+    {.name = "gvn",        .flag = SHRIMP_OPT_GLOBAL_CSE, .run = Shrimp_module_gvn},
+    {.name = "licm",       .flag = SHRIMP_OPT_LICM,       .run = Shrimp_module_licm},
+    {.name = "strength-reduce", .flag = SHRIMP_OPT_STRENGTH, .run = Shrimp_module_strength_reduce},
+    {.name = "iv",         .flag = SHRIMP_OPT_IV,         .run = Shrimp_module_iv},
+    {.name = "scev",       .flag = SHRIMP_OPT_SCEV,       .run = Shrimp_module_scev},
+    {.name = "unroll",     .flag = SHRIMP_OPT_UNROLL,     .run = Shrimp_module_unroll},
+    {.name = "unswitch",   .flag = SHRIMP_OPT_UNSWITCH,   .run = Shrimp_module_unswitch},
+    {.name = "loop-rotate", .flag = SHRIMP_OPT_ROTATE,    .run = Shrimp_module_rotate},
+    {.name = "block-layout", .flag = SHRIMP_OPT_LAYOUT,   .run = Shrimp_module_layout},
+    {.name = "range",      .flag = SHRIMP_OPT_RANGE,      .run = Shrimp_module_range},
+    {.name = "drop-unused", .flag = SHRIMP_OPT_DROP_UNUSED, .run = Shrimp_module_drop_unused},
+};
+
+// What runs when no explicit pipeline is given, passes whose flag isn't set get dropped
+static const char* shrimp_default_pipeline = "tailrec,inline,eval,const-fold,[algebra,sccp,copy-prop],lvn,gvn,copy-prop,licm,unswitch,[iv,copy-prop],scev,unroll,[algebra,sccp,copy-prop],gvn,strength-reduce,algebra,range,loop-rotate,block-layout,dce,simplify-cfg,drop-unused";
+
+// A fixed point group gives up after this many rounds, so two passes undoing each other can't hang the compiler
+#define SHRIMP_PASS_MAX_ROUNDS 16
+
+typedef struct {
+    size_t runs;
+    size_t changed;
+    double ms;
+    int64_t delta;
+} Shrimp_PassStats;
+
+typedef struct {
+    const Shrimp_Pass* pass;
+    Shrimp_PassStats stats;
+} Shrimp_PipelineStep;
+
+typedef struct {
+    Shrimp_PipelineStep* items;
+    size_t count;
+    size_t capacity;
+    bool fixed_point;
+} Shrimp_PipelineGroup;
+
+typedef struct {
+    Shrimp_PipelineGroup* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_Pipeline;
+
+static bool Shrimp_pipeline_parse(const char* spec, Shrimp_OptFlags filter, Shrimp_Pipeline* out);
+static void Shrimp_pipeline_free(Shrimp_Pipeline* pipeline);
+static bool Shrimp_pipeline_run_step(Shrimp_Module* mod, Shrimp_PipelineStep* step);
+static void Shrimp_pipeline_report(const Shrimp_Pipeline* pipeline, size_t before, size_t after);
+static double Shrimp_now_ms(void);
+
+Shrimp_OptFlags Shrimp_opt_level_flags(Shrimp_OptLevel level) {
+    Shrimp_OptFlags o1 = SHRIMP_OPT_CONST_FOLD | SHRIMP_OPT_LOCAL_CSE | SHRIMP_OPT_COPY_PROP | SHRIMP_OPT_STRENGTH | SHRIMP_OPT_SIMPLIFY_CFG | SHRIMP_OPT_ALGEBRA | SHRIMP_OPT_LAYOUT | SHRIMP_OPT_DEAD_CODE | SHRIMP_OPT_TAIL_REC;
+    Shrimp_OptFlags o2 = (o1 & ~SHRIMP_OPT_LOCAL_CSE) | SHRIMP_OPT_SCCP | SHRIMP_OPT_GLOBAL_CSE | SHRIMP_OPT_LICM | SHRIMP_OPT_IV | SHRIMP_OPT_SCEV | SHRIMP_OPT_UNROLL | SHRIMP_OPT_EVAL | SHRIMP_OPT_ROTATE | SHRIMP_OPT_RANGE | SHRIMP_OPT_INLINE | SHRIMP_OPT_UNSWITCH | SHRIMP_OPT_DROP_UNUSED;
+    switch (level) {
+        case SHRIMP_O0: return SHRIMP_OPT_NONE;
+        case SHRIMP_O1: return o1;
+        case SHRIMP_O2: return o2;
+        case SHRIMP_OS: return o2 & ~(SHRIMP_OPT_UNROLL | SHRIMP_OPT_ROTATE | SHRIMP_OPT_UNSWITCH);
+    }
+    return SHRIMP_OPT_NONE;
+}
+
+const Shrimp_Pass* Shrimp_pass_find(const char* name, size_t len) {
+    for (size_t i = 0; i < sizeof(shrimp_passes) / sizeof(shrimp_passes[0]); i++) {
+        if (strlen(shrimp_passes[i].name) == len && strncmp(shrimp_passes[i].name, name, len) == 0) return &shrimp_passes[i];
+    }
+    return NULL;
+}
+
+bool Shrimp_module_optimize(Shrimp_Module* mod, Shrimp_CompOptions opts) {
+    Shrimp_Pipeline pipeline = {0};
+    bool ok = opts.passes != NULL
+        ? Shrimp_pipeline_parse(opts.passes, ~0, &pipeline)
+        : Shrimp_pipeline_parse(shrimp_default_pipeline, opts.opts, &pipeline);
+    if (!ok) {
+        Shrimp_pipeline_free(&pipeline);
+        return false;
+    }
+
+    mod->unroll_threshold = opts.unroll_threshold;
+    mod->eval_fuel = opts.eval_fuel;
+    mod->inline_threshold = opts.inline_threshold;
+    mod->unswitch_threshold = opts.unswitch_threshold;
+    size_t before = Shrimp_module_instr_count(mod);
+    for (size_t g = 0; g < pipeline.count; g++) {
+        Shrimp_PipelineGroup* group = &pipeline.items[g];
+        size_t rounds = 0;
+        bool changed;
+        do {
+            changed = false;
+            for (size_t s = 0; s < group->count; s++) changed |= Shrimp_pipeline_run_step(mod, &group->items[s]);
+            rounds++;
+        } while (group->fixed_point && changed && rounds < SHRIMP_PASS_MAX_ROUNDS);
+    }
+    // the passes leave the constants they folded away and the temps they coalesced or deleted the last write of
+    // behind, none of them should end up in the bytecode or take up room in the frame
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_function_compact_consts(&mod->items[i]);
+        Shrimp_function_compact_temps(&mod->items[i]);
+    }
+    if (opts.time_passes) Shrimp_pipeline_report(&pipeline, before, Shrimp_module_instr_count(mod));
+    Shrimp_pipeline_free(&pipeline);
+    return true;
+}
+
+bool Shrimp_module_run_passes(Shrimp_Module* mod, const char* pipeline, bool time_passes) {
+    Shrimp_CompOptions opts = {
+        .passes = pipeline,
+        .time_passes = time_passes,
+    };
+    return Shrimp_module_optimize(mod, opts);
+}
+
+size_t Shrimp_module_instr_count(const Shrimp_Module* mod) {
+    size_t count = 0;
+    for (size_t i = 0; i < mod->count; i++) {
+        for (size_t j = 0; j < mod->items[i].count; j++) count += mod->items[i].items[j].t != SHRIMP_IT_NOP;
+    }
+    return count;
+}
+
+static bool Shrimp_pipeline_run_step(Shrimp_Module* mod, Shrimp_PipelineStep* step) {
+    size_t before = Shrimp_module_instr_count(mod);
+    double start = Shrimp_now_ms();
+    bool changed = step->pass->run(mod);
+    // passes delete by leaving nops behind, get rid of them so the next one doesn't have to walk over them
+    for (size_t i = 0; i < mod->count; i++) Shrimp_function_compact(&mod->items[i]);
+    step->stats.ms += Shrimp_now_ms() - start;
+    step->stats.runs++;
+    step->stats.changed += changed;
+    step->stats.delta += (int64_t)Shrimp_module_instr_count(mod) - (int64_t)before;
+    return changed;
+}
+
+static void Shrimp_pipeline_report(const Shrimp_Pipeline* pipeline, size_t before, size_t after) {
+    fprintf(stderr, "[INFO]: %-20s %6s %8s %10s %8s\n", "pass", "runs", "changed", "time (ms)", "instrs");
+    double total = 0;
+    for (size_t g = 0; g < pipeline->count; g++) {
+        for (size_t s = 0; s < pipeline->items[g].count; s++) {
+            const Shrimp_PipelineStep* step = &pipeline->items[g].items[s];
+            fprintf(stderr, "[INFO]: %-20s %6zu %8zu %10.3f %+8ld\n",
+                    step->pass->name, step->stats.runs, step->stats.changed, step->stats.ms, step->stats.delta);
+            total += step->stats.ms;
+        }
+    }
+    fprintf(stderr, "[INFO]: %-20s %6s %8s %10.3f %zu -> %zu\n", "total", "", "", total, before, after);
+}
+
+static bool Shrimp_pipeline_parse(const char* spec, Shrimp_OptFlags filter, Shrimp_Pipeline* out) {
+    const char* cur = spec;
+    Shrimp_PipelineGroup group = {0};
+    bool in_group = false;
+    while (true) {
+        while (isspace(*cur) || *cur == ',') cur++;
+        if (*cur == '\0') break;
+        if (*cur == '[') {
+            if (in_group) {
+                fprintf(stderr, "[ERROR]: Pass groups can't be nested: %s\n", spec);
+                return false;
+            }
+            in_group = true;
+            group = (Shrimp_PipelineGroup){.fixed_point = true};
+            cur++;
+            continue;
+        }
+        if (*cur == ']') {
+            if (!in_group) {
+                fprintf(stderr, "[ERROR]: Unmatched `]` in pass pipeline: %s\n", spec);
+                return false;
+            }
+            in_group = false;
+            if (group.count != 0) Shrimp_da_push(out, group);
+            cur++;
+            continue;
+        }
+        const char* name = cur;
+        while (*cur != '\0' && *cur != ',' && *cur != '[' && *cur != ']' && !isspace(*cur)) cur++;
+        const Shrimp_Pass* pass = Shrimp_pass_find(name, cur - name);
+        if (pass == NULL) {
+            fprintf(stderr, "[ERROR]: Unknown pass `%.*s`\n", (int)(cur - name), name);
+            if (in_group) Shrimp_da_free(&group);
+            return false;
+        }
+        if ((pass->flag & filter) == 0) continue;
+        Shrimp_PipelineStep step = {.pass = pass};
+        if (in_group) {
+            Shrimp_da_push(&group, step);
+        } else {
+            Shrimp_PipelineGroup single = {0};
+            Shrimp_da_push(&single, step);
+            Shrimp_da_push(out, single);
+        }
+    }
+    if (in_group) {
+        fprintf(stderr, "[ERROR]: Missing `]` in pass pipeline: %s\n", spec);
+        Shrimp_da_free(&group);
+        return false;
+    }
+    return true;
+}
+
+static void Shrimp_pipeline_free(Shrimp_Pipeline* pipeline) {
+    for (size_t i = 0; i < pipeline->count; i++) Shrimp_da_free(&pipeline->items[i]);
+    Shrimp_da_free(pipeline);
+}
+
+static double Shrimp_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
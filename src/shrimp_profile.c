@@ -0,0 +1,132 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Profiles
+//
+// An instrumented build (see Shrimp_CompOptions.profile_generate) isn't optimized, so its counters belong to
+// the IR as the front end made it and a build reading them back has to do that before optimizing too. It
+// counts how often every block ran, the entry and every label, and how often every conditional jump was
+// taken. How often a jump ran is what reached its block minus what the jumps before it in the block took.
+//
+// The file is what the program has in memory when it exits, native 64 bit words:
+//   magic, function count
+//   per function: checksum, label count, conditional jump count,
+//                 entry count, one count per label, one taken count per conditional jump
+// The checksum and counts have to match the function they're read into, otherwise it's left without weights.
+
+size_t Shrimp_profile_branch_count(const Shrimp_Function* func) {
+    size_t count = 0;
+    for (size_t i = 0; i < func->count; i++) count += Shrimp_instr_is_branch(func->items[i].t);
+    return count;
+}
+
+uint64_t Shrimp_profile_checksum(const Shrimp_Function* func) {
+    // FNV-1a over the opcodes and where the labels and jumps are, which is what the counters depend on
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < func->count; i++) {
+        const Shrimp_Instr* instr = &func->items[i];
+        uint64_t word = instr->t;
+        if (instr->t == SHRIMP_IT_LABEL) word |= (uint64_t)instr->label << 8;
+        else if (instr->t == SHRIMP_IT_JUMP) word |= (uint64_t)instr->jmp.to << 8;
+        else if (Shrimp_instr_is_branch(instr->t)) word |= (uint64_t)instr->jmp_if_not.to << 8;
+        for (size_t b = 0; b < 8; b++) {
+            hash ^= (word >> (b * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static void Shrimp_profile_set_weights(Shrimp_Instr* branch, uint64_t taken, uint64_t not_taken) {
+    // scaled down together until both fit, one more so that a jump that never ran still has weights
+    while (taken >= UINT16_MAX || not_taken >= UINT16_MAX) {
+        taken >>= 1;
+        not_taken >>= 1;
+    }
+    branch->jmp_if_not.taken = taken + 1;
+    branch->jmp_if_not.not_taken = not_taken + 1;
+}
+
+// Returns false if the counts can't have come from this function
+static bool Shrimp_profile_function(Shrimp_Function* f, const uint64_t* counts) {
+    const uint64_t* blocks = counts;
+    const uint64_t* taken = counts + f->label_count + 1;
+    // checked before anything is written
+    for (int write = 0; write < 2; write++) {
+        uint64_t reached = blocks[0];
+        size_t branch = 0;
+        for (size_t i = 0; i < f->count; i++) {
+            Shrimp_Instr* instr = &f->items[i];
+            if (instr->t == SHRIMP_IT_LABEL) {
+                reached = blocks[instr->label + 1];
+            } else if (instr->t == SHRIMP_IT_JUMP || instr->t == SHRIMP_IT_RETURN) {
+                reached = 0;
+            } else if (Shrimp_instr_is_branch(instr->t)) {
+                uint64_t t = taken[branch++];
+                if (t > reached) return false;
+                if (write) Shrimp_profile_set_weights(instr, t, reached - t);
+                reached -= t;
+            }
+        }
+    }
+    return true;
+}
+
+bool Shrimp_module_profile_use(Shrimp_Module* mod, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]: Failed to open profile %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    uint64_t* words = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t word;
+    while (fread(&word, sizeof(word), 1, file) == 1) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            words = realloc(words, sizeof(uint64_t) * capacity);
+        }
+        words[count++] = word;
+    }
+    fclose(file);
+
+    if (count < 2 || memcmp(&words[0], SHRIMP_PROFILE_MAGIC, sizeof(uint64_t)) != 0) {
+        fprintf(stderr, "[ERROR]: %s is not a profile written by an instrumented build\n", path);
+        free(words);
+        return false;
+    }
+    size_t at = 2;
+    for (size_t i = 0; i < words[1]; i++) {
+        if (count - at < 3) {
+            fprintf(stderr, "[ERROR]: Profile %s is truncated\n", path);
+            free(words);
+            return false;
+        }
+        uint64_t checksum = words[at], labels = words[at + 1], branches = words[at + 2];
+        at += 3;
+        if (labels + 1 > count - at || branches > count - at - labels - 1) {
+            fprintf(stderr, "[ERROR]: Profile %s is truncated\n", path);
+            free(words);
+            return false;
+        }
+        const uint64_t* counts = &words[at];
+        at += labels + 1 + branches;
+        if (i >= mod->count) continue;
+
+        Shrimp_Function* f = &mod->items[i];
+        if (checksum != Shrimp_profile_checksum(f) || labels != f->label_count || branches != Shrimp_profile_branch_count(f) ||
+            !Shrimp_profile_function(f, counts)) {
+            fprintf(stderr, "[WARNING]: Profile %s doesn't match function %s, it is compiled without it\n", path, f->name);
+        }
+    }
+    if (words[1] != mod->count) {
+        fprintf(stderr, "[WARNING]: Profile %s has %lu functions but the module has %zu\n", path, words[1], mod->count);
+    }
+    free(words);
+    return true;
+}
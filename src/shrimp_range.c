@@ -0,0 +1,377 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Value range analysis
+//
+// Finds the smallest and biggest value every temp can hold at the start of every block. The ranges go through
+// the instructions and at a conditional jump on `a < b` the sides learn that it did or didn't hold, so the body
+// of `while i < 10` knows i is at most 9. Ranges that keep growing around a loop are widened to everything
+// at its head after a few rounds so the analysis ends, and then a couple of rounds without widening win back
+// what the tests bound them to.
+//
+// With the ranges:
+//   - temps that can only hold one value are replaced by it and so are conditions that can't be 0
+//   - comparisons the ranges decide become assignments of the result
+//   - temps that never hold anything above 32 bits are narrowed to 4 bytes, the backend loads and stores
+//     them with shorter instructions and divides them with the 32 bit division
+//
+// The states take a range per temp and block, functions where that gets too big are left alone.
+
+#define SHRIMP_RANGE_MAX_CELLS (1 << 20)
+// how often a block's state may grow before it gets widened
+#define SHRIMP_RANGE_WIDEN_AFTER 3
+#define SHRIMP_RANGE_NARROW_ROUNDS 2
+
+// Empty when lo > hi
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} Shrimp_Range;
+
+static const Shrimp_Range shrimp_range_full = {0, UINT64_MAX};
+static const Shrimp_Range shrimp_range_empty = {1, 0};
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    size_t temps;
+    // per block, only meaningful for the blocks that were reached
+    Shrimp_Range* in;
+    bool* reached;
+    uint32_t* grown;
+    // blocks control can come back to, a predecessor comes after them in the reverse post order
+    bool* joins_back;
+    // scratch states for the edges of a block
+    Shrimp_Range* taken;
+    Shrimp_Range* not_taken;
+} Shrimp_RangeAnalysis;
+
+static bool Shrimp_range_is_empty(Shrimp_Range r) {
+    return r.lo > r.hi;
+}
+
+static Shrimp_Range Shrimp_range_const(uint64_t c) {
+    return (Shrimp_Range){c, c};
+}
+
+static Shrimp_Range Shrimp_range_of(const Shrimp_Function* f, const Shrimp_Range* state, Shrimp_Ref ref) {
+    if (SHRIMP_REF_IS_CONST(ref)) return Shrimp_range_const(Shrimp_function_const(f, ref));
+    return state[ref];
+}
+
+static Shrimp_Range Shrimp_range_binop(uint8_t t, Shrimp_Range a, Shrimp_Range b) {
+    if (Shrimp_range_is_empty(a) || Shrimp_range_is_empty(b)) return shrimp_range_empty;
+    switch (t) {
+        case SHRIMP_IT_ADD: {
+            // the ends have to wrap around together or not at all
+            bool lo_wraps = a.lo + b.lo < a.lo;
+            bool hi_wraps = a.hi + b.hi < a.hi;
+            if (lo_wraps != hi_wraps) return shrimp_range_full;
+            return (Shrimp_Range){a.lo + b.lo, a.hi + b.hi};
+        }
+        case SHRIMP_IT_SUB: {
+            if (a.lo < b.hi) return shrimp_range_full;
+            return (Shrimp_Range){a.lo - b.hi, a.hi - b.lo};
+        }
+        case SHRIMP_IT_MUL: {
+            unsigned __int128 hi = (unsigned __int128)a.hi * b.hi;
+            if (hi > UINT64_MAX) return shrimp_range_full;
+            return (Shrimp_Range){a.lo * b.lo, (uint64_t)hi};
+        }
+        case SHRIMP_IT_DIV: {
+            // dividing by 0 traps, so whatever comes after it divided by at least 1
+            uint64_t min = b.lo == 0 ? 1 : b.lo;
+            if (b.hi == 0) return shrimp_range_empty;
+            return (Shrimp_Range){a.lo / b.hi, a.hi / min};
+        }
+        case SHRIMP_IT_CMP_LT: {
+            if (a.hi < b.lo) return Shrimp_range_const(1);
+            if (a.lo >= b.hi) return Shrimp_range_const(0);
+            return (Shrimp_Range){0, 1};
+        }
+        case SHRIMP_IT_CMP_MT: {
+            if (a.lo > b.hi) return Shrimp_range_const(1);
+            if (a.hi <= b.lo) return Shrimp_range_const(0);
+            return (Shrimp_Range){0, 1};
+        }
+        case SHRIMP_IT_SHL: {
+            if (b.lo != b.hi) return shrimp_range_full;
+            uint64_t shift = b.lo & 63;
+            if (shift != 0 && a.hi >> (64 - shift) != 0) return shrimp_range_full;
+            return (Shrimp_Range){a.lo << shift, a.hi << shift};
+        }
+        case SHRIMP_IT_SHR: {
+            if (b.lo != b.hi) return (Shrimp_Range){0, a.hi};
+            return (Shrimp_Range){a.lo >> (b.lo & 63), a.hi >> (b.lo & 63)};
+        }
+        case SHRIMP_IT_MULHU: {
+            return (Shrimp_Range){
+                (uint64_t)(((unsigned __int128)a.lo * b.lo) >> 64),
+                (uint64_t)(((unsigned __int128)a.hi * b.hi) >> 64),
+            };
+        }
+    }
+    return shrimp_range_full;
+}
+
+// What the instruction leaves in the temp it writes
+static Shrimp_Range Shrimp_range_result(const Shrimp_Function* f, const Shrimp_Range* state, const Shrimp_Instr* instr) {
+    if (instr->t == SHRIMP_IT_ASSIGN) return Shrimp_range_of(f, state, instr->assign.v);
+    if (instr->t == SHRIMP_IT_CALL) return shrimp_range_full;
+    return Shrimp_range_binop(instr->t, Shrimp_range_of(f, state, instr->binop.l), Shrimp_range_of(f, state, instr->binop.r));
+}
+
+static void Shrimp_range_step(const Shrimp_Function* f, Shrimp_Range* state, const Shrimp_Instr* instr) {
+    uint32_t def;
+    if (Shrimp_instr_def(instr, &def)) state[def] = Shrimp_range_result(f, state, instr);
+}
+
+// Narrows what `a < b` holding (or not) says about a and b, returns false if it can't hold
+static bool Shrimp_range_less(Shrimp_Range* state, const Shrimp_Function* f, Shrimp_Ref a, Shrimp_Ref b, bool holds) {
+    Shrimp_Range ra = Shrimp_range_of(f, state, a);
+    Shrimp_Range rb = Shrimp_range_of(f, state, b);
+    if (holds) {
+        if (rb.hi == 0 || ra.lo == UINT64_MAX) return false;
+        if (ra.hi > rb.hi - 1) ra.hi = rb.hi - 1;
+        if (rb.lo < ra.lo + 1) rb.lo = ra.lo + 1;
+    } else {
+        if (ra.lo < rb.lo) ra.lo = rb.lo;
+        if (rb.hi > ra.hi) rb.hi = ra.hi;
+    }
+    if (Shrimp_range_is_empty(ra) || Shrimp_range_is_empty(rb)) return false;
+    if (!SHRIMP_REF_IS_CONST(a)) state[a] = ra;
+    if (!SHRIMP_REF_IS_CONST(b)) state[b] = rb;
+    return true;
+}
+
+// Narrows the state at the end of the block for the way out where the condition is (or isn't) 0
+// Returns false if that way can't be taken
+static bool Shrimp_range_refine(Shrimp_RangeAnalysis* ra, uint32_t block, Shrimp_Range* state, Shrimp_Ref cond, bool nonzero) {
+    const Shrimp_Function* f = ra->func;
+    if (SHRIMP_REF_IS_CONST(cond)) return (Shrimp_function_const(f, cond) != 0) == nonzero;
+    Shrimp_Range c = state[cond];
+    if (nonzero && c.lo == 0) c.lo = 1;
+    if (!nonzero) c.hi = 0;
+    if (Shrimp_range_is_empty(c)) return false;
+    state[cond] = c;
+
+    // the comparison the condition comes from, if its operands still hold what it compared
+    const Shrimp_Block* b = &ra->cfg.items[block];
+    uint32_t end = b->end - 1;
+    for (uint32_t i = end; i-- > b->begin;) {
+        const Shrimp_Instr* instr = &f->items[i];
+        uint32_t def;
+        if (!Shrimp_instr_def(instr, &def) || def != cond) continue;
+        if (instr->t != SHRIMP_IT_CMP_LT && instr->t != SHRIMP_IT_CMP_MT) return true;
+        Shrimp_Ref l = instr->binop.l, r = instr->binop.r;
+        if (l == cond || r == cond) return true;
+        for (uint32_t j = i + 1; j < end; j++) {
+            if (Shrimp_instr_def(&f->items[j], &def) && (def == l || def == r)) return true;
+        }
+        // `l > r` is `r < l`
+        if (instr->t == SHRIMP_IT_CMP_MT) return Shrimp_range_less(state, f, r, l, nonzero);
+        return Shrimp_range_less(state, f, l, r, nonzero);
+    }
+    return true;
+}
+
+// Joins the state into what the block starts with, widening the ends that moved if it grew too often
+static bool Shrimp_range_merge(Shrimp_RangeAnalysis* ra, Shrimp_Range* into, bool* reached, uint32_t block, const Shrimp_Range* state, bool widen) {
+    Shrimp_Range* in = &into[(size_t)block * ra->temps];
+    if (!reached[block]) {
+        reached[block] = true;
+        memcpy(in, state, sizeof(Shrimp_Range) * ra->temps);
+        return true;
+    }
+    widen = widen && ra->joins_back[block] && ra->grown[block] >= SHRIMP_RANGE_WIDEN_AFTER;
+    bool changed = false;
+    for (size_t t = 0; t < ra->temps; t++) {
+        Shrimp_Range r = in[t];
+        if (Shrimp_range_is_empty(state[t])) continue;
+        if (Shrimp_range_is_empty(r)) {
+            r = state[t];
+        } else {
+            if (state[t].lo < r.lo) r.lo = widen ? 0 : state[t].lo;
+            if (state[t].hi > r.hi) r.hi = widen ? UINT64_MAX : state[t].hi;
+        }
+        if (r.lo == in[t].lo && r.hi == in[t].hi) continue;
+        in[t] = r;
+        changed = true;
+    }
+    if (changed) ra->grown[block]++;
+    return changed;
+}
+
+// Runs every reached block and merges what it leaves into its successors in `into`
+// A block starts with what `into` has for it once all its predecessors ran, loop heads with their state in `from`
+static bool Shrimp_range_sweep(Shrimp_RangeAnalysis* ra, const Shrimp_Range* from, const bool* from_reached, Shrimp_Range* into, bool* into_reached, bool widen) {
+    const Shrimp_Function* f = ra->func;
+    const Shrimp_CFG* cfg = &ra->cfg;
+    bool changed = false;
+    for (size_t i = 0; i < cfg->rpo_count; i++) {
+        uint32_t b = cfg->rpo[i];
+        const Shrimp_Range* in = ra->joins_back[b] ? from : into;
+        if (!(ra->joins_back[b] ? from_reached : into_reached)[b]) continue;
+        Shrimp_Range* state = ra->not_taken;
+        memcpy(state, &in[(size_t)b * ra->temps], sizeof(Shrimp_Range) * ra->temps);
+        for (uint32_t j = cfg->items[b].begin; j < cfg->items[b].end; j++) Shrimp_range_step(f, state, &f->items[j]);
+
+        const Shrimp_Instr* last = Shrimp_cfg_terminator(f, cfg, b);
+        if (last != NULL && last->t == SHRIMP_IT_RETURN) continue;
+        if (last != NULL && last->t == SHRIMP_IT_JUMP) {
+            changed |= Shrimp_range_merge(ra, into, into_reached, cfg->label_block[last->jmp.to], state, widen);
+            continue;
+        }
+        uint32_t next = Shrimp_cfg_fallthrough(cfg, b);
+        if (last != NULL && Shrimp_instr_is_branch(last->t)) {
+            memcpy(ra->taken, state, sizeof(Shrimp_Range) * ra->temps);
+            bool jumps_on_nonzero = last->t == SHRIMP_IT_JUMP_IF;
+            if (Shrimp_range_refine(ra, b, ra->taken, last->jmp_if_not.cond, jumps_on_nonzero)) {
+                changed |= Shrimp_range_merge(ra, into, into_reached, cfg->label_block[last->jmp_if_not.to], ra->taken, widen);
+            }
+            if (!Shrimp_range_refine(ra, b, state, last->jmp_if_not.cond, !jumps_on_nonzero)) continue;
+        }
+        if (next != SHRIMP_NO_BLOCK) changed |= Shrimp_range_merge(ra, into, into_reached, next, state, widen);
+    }
+    return changed;
+}
+
+static void Shrimp_range_analyze(Shrimp_RangeAnalysis* ra) {
+    size_t cells = ra->cfg.count * ra->temps;
+    ra->in = malloc(sizeof(Shrimp_Range) * (cells + 1));
+    ra->reached = calloc(ra->cfg.count, sizeof(bool));
+    ra->grown = calloc(ra->cfg.count, sizeof(uint32_t));
+    ra->joins_back = calloc(ra->cfg.count, sizeof(bool));
+    uint32_t* order = malloc(sizeof(uint32_t) * (ra->cfg.count + 1));
+    for (size_t i = 0; i < ra->cfg.count; i++) order[i] = SHRIMP_NO_BLOCK;
+    for (size_t i = 0; i < ra->cfg.rpo_count; i++) order[ra->cfg.rpo[i]] = i;
+    for (size_t i = 0; i < ra->cfg.rpo_count; i++) {
+        const Shrimp_Block* block = &ra->cfg.items[ra->cfg.rpo[i]];
+        for (size_t p = 0; p < block->preds.count; p++) {
+            uint32_t pred = order[block->preds.items[p]];
+            if (pred != SHRIMP_NO_BLOCK && pred >= i) ra->joins_back[ra->cfg.rpo[i]] = true;
+        }
+    }
+    free(order);
+    ra->taken = malloc(sizeof(Shrimp_Range) * (ra->temps + 1));
+    ra->not_taken = malloc(sizeof(Shrimp_Range) * (ra->temps + 1));
+
+    // nothing is known about the temps when the function starts
+    for (size_t t = 0; t < ra->temps; t++) ra->in[t] = shrimp_range_full;
+    ra->reached[0] = true;
+    // a loop head can only grow so often before it's widened, and widened ends don't move anymore
+    while (Shrimp_range_sweep(ra, ra->in, ra->reached, ra->in, ra->reached, true));
+
+    Shrimp_Range* next = malloc(sizeof(Shrimp_Range) * (cells + 1));
+    bool* next_reached = malloc(sizeof(bool) * ra->cfg.count);
+    for (size_t round = 0; round < SHRIMP_RANGE_NARROW_ROUNDS; round++) {
+        memset(next_reached, 0, sizeof(bool) * ra->cfg.count);
+        next_reached[0] = true;
+        for (size_t t = 0; t < ra->temps; t++) next[t] = shrimp_range_full;
+        Shrimp_range_sweep(ra, ra->in, ra->reached, next, next_reached, false);
+        Shrimp_Range* swap = ra->in;
+        ra->in = next;
+        next = swap;
+        memcpy(ra->reached, next_reached, sizeof(bool) * ra->cfg.count);
+    }
+    free(next_reached);
+    free(next);
+}
+
+static void Shrimp_range_free(Shrimp_RangeAnalysis* ra) {
+    free(ra->not_taken);
+    free(ra->taken);
+    free(ra->joins_back);
+    free(ra->grown);
+    free(ra->reached);
+    free(ra->in);
+    Shrimp_cfg_free(&ra->cfg);
+}
+
+// Rewrites the function with what the analysis found, returns whether anything changed
+static bool Shrimp_range_apply(Shrimp_RangeAnalysis* ra) {
+    Shrimp_Function* f = ra->func;
+    const Shrimp_CFG* cfg = &ra->cfg;
+    // whether every value written to the temp fits into 32 bits, only for the temps that are written
+    bool* fits = malloc(sizeof(bool) * (ra->temps + 1));
+    bool* written = calloc(ra->temps + 1, sizeof(bool));
+    // params get whatever the caller passes on entry
+    for (size_t t = 0; t < ra->temps; t++) fits[t] = t >= f->param_count;
+
+    bool changed = false;
+    Shrimp_Range* state = ra->not_taken;
+    for (uint32_t b = 0; b < cfg->count; b++) {
+        if (!ra->reached[b]) {
+            // nothing is known about code that never runs, so it can't be narrowed either
+            for (uint32_t j = cfg->items[b].begin; j < cfg->items[b].end; j++) {
+                uint32_t def;
+                if (Shrimp_instr_def(&f->items[j], &def)) fits[def] = false;
+            }
+            continue;
+        }
+        memcpy(state, &ra->in[(size_t)b * ra->temps], sizeof(Shrimp_Range) * ra->temps);
+        for (uint32_t j = cfg->items[b].begin; j < cfg->items[b].end; j++) {
+            Shrimp_Instr instr = f->items[j];
+            bool rewritten = false;
+            Shrimp_Ref* ops[2];
+            size_t n = Shrimp_instr_operands(&instr, ops);
+            for (size_t o = 0; o < n; o++) {
+                if (SHRIMP_REF_IS_CONST(*ops[o])) continue;
+                Shrimp_Range r = state[*ops[o]];
+                if (Shrimp_instr_is_branch(instr.t) && !Shrimp_range_is_empty(r) && r.lo != 0) {
+                    // only whether it's 0 matters
+                    *ops[o] = Shrimp_function_const_ref(f, 1);
+                    rewritten = true;
+                } else if (!Shrimp_range_is_empty(r) && r.lo == r.hi) {
+                    *ops[o] = Shrimp_function_const_ref(f, r.lo);
+                    rewritten = true;
+                }
+            }
+            uint32_t def;
+            if (Shrimp_instr_def(&instr, &def)) {
+                Shrimp_Range r = Shrimp_range_result(f, state, &instr);
+                if ((instr.t == SHRIMP_IT_CMP_LT || instr.t == SHRIMP_IT_CMP_MT) && r.lo == r.hi) {
+                    instr = (Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = def, .v = Shrimp_function_const_ref(f, r.lo)}};
+                    rewritten = true;
+                }
+                written[def] = true;
+                if (Shrimp_range_is_empty(r) || r.hi > UINT32_MAX) fits[def] = false;
+            }
+            if (rewritten) {
+                Shrimp_function_set_instr(f, j, instr);
+                changed = true;
+            }
+            Shrimp_range_step(f, state, &instr);
+        }
+    }
+
+    for (size_t t = 0; t < ra->temps; t++) {
+        if (!written[t] || !fits[t] || f->temps.items[t].size <= 4) continue;
+        f->temps.items[t].size = 4;
+        changed = true;
+    }
+    free(written);
+    free(fits);
+    return changed;
+}
+
+bool Shrimp_module_range(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        Shrimp_RangeAnalysis ra = {.func = f, .temps = f->temps.count};
+        Shrimp_cfg_build(f, &ra.cfg);
+        if ((size_t)ra.cfg.count * ra.temps > SHRIMP_RANGE_MAX_CELLS) {
+            Shrimp_cfg_free(&ra.cfg);
+            continue;
+        }
+        Shrimp_cfg_dominators(&ra.cfg);
+        Shrimp_range_analyze(&ra);
+        changed |= Shrimp_range_apply(&ra);
+        Shrimp_range_free(&ra);
+    }
+    return changed;
+}
@@ -0,0 +1,102 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Loop rotation
+//
+// While loops come with the test on top:
+//     H: test; jump_z c @X; body; jump @H
+// so every round runs the test, the body and a taken jump back. Rotating puts a copy of the test in front
+// as a guard and the test itself at the bottom, turned around so that it jumps back into the body:
+//     test; jump_z c @X; B: body; H: test; jump_nz c @B; jump @X
+// which leaves one taken branch per round and the way out of the loop on the fall through. The jump to X
+// is only there when X doesn't follow the loop anyway. Whatever else jumped to H runs the test as before.
+//
+// The loop passes only understand loops with the test on top, so this runs after them.
+
+// how many instructions of the header may get copied for the guard
+#define SHRIMP_ROTATE_MAX_HEADER 8
+
+static bool Shrimp_rotate_loop(Shrimp_Function* f, const Shrimp_CFG* cfg, const Shrimp_Loop* loop) {
+    const Shrimp_Block* header = &cfg->items[loop->header];
+    if (f->items[header->begin].t != SHRIMP_IT_LABEL) return false;
+    Shrimp_Label header_label = f->items[header->begin].label;
+    const Shrimp_Instr* test = Shrimp_cfg_terminator(f, cfg, loop->header);
+    if (test == NULL || !Shrimp_instr_is_branch(test->t)) return false;
+    uint32_t next = Shrimp_cfg_fallthrough(cfg, loop->header);
+    if (loop->contains[cfg->label_block[test->jmp_if_not.to]] || next == SHRIMP_NO_BLOCK || !loop->contains[next]) return false;
+    size_t size = 0;
+    for (uint32_t i = header->begin + 1; i < header->end; i++) size += f->items[i].t != SHRIMP_IT_NOP;
+    if (size > SHRIMP_ROTATE_MAX_HEADER) return false;
+
+    // the last jump back, the ones before it keep jumping to the test
+    uint32_t latch = SHRIMP_NO_BLOCK;
+    for (uint32_t b = loop->header + 1; b < cfg->count; b++) {
+        const Shrimp_Instr* last = Shrimp_cfg_terminator(f, cfg, b);
+        if (loop->contains[b] && last != NULL && last->t == SHRIMP_IT_JUMP && last->jmp.to == header_label) latch = b;
+    }
+    if (latch == SHRIMP_NO_BLOCK) return false;
+    uint32_t end = cfg->items[latch].end;
+
+    Shrimp_InstrBuf out = {0};
+    Shrimp_Label body = Shrimp_function_label_alloc(f);
+    for (uint32_t i = header->begin + 1; i < header->end; i++) {
+        if (f->items[i].t != SHRIMP_IT_NOP) Shrimp_da_push(&out, f->items[i]);
+    }
+    Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = body}));
+    for (uint32_t i = header->end; i + 1 < end; i++) {
+        if (f->items[i].t != SHRIMP_IT_NOP) Shrimp_da_push(&out, f->items[i]);
+    }
+    Shrimp_da_push(&out, f->items[header->begin]);
+    for (uint32_t i = header->begin + 1; i + 1 < header->end; i++) {
+        if (f->items[i].t != SHRIMP_IT_NOP) Shrimp_da_push(&out, f->items[i]);
+    }
+    // turned around, so what the test took before is what it doesn't take now
+    Shrimp_Instr back = {
+        .t = test->t == SHRIMP_IT_JUMP_IF_NOT ? SHRIMP_IT_JUMP_IF : SHRIMP_IT_JUMP_IF_NOT,
+        .jmp_if_not = {.cond = test->jmp_if_not.cond, .to = body, .taken = test->jmp_if_not.not_taken, .not_taken = test->jmp_if_not.taken},
+    };
+    Shrimp_da_push(&out, back);
+    if (!Shrimp_function_falls_to(f, end, test->jmp_if_not.to)) {
+        Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = test->jmp_if_not.to}}));
+    }
+
+    uint32_t begin = header->begin;
+    for (uint32_t i = begin; i < end; i++) {
+        if (f->items[i].t != SHRIMP_IT_NOP) Shrimp_function_remove_instr(f, i);
+    }
+    Shrimp_function_insert(f, begin, out.items, out.count);
+    Shrimp_da_free(&out);
+    return true;
+}
+
+static bool Shrimp_rotate_round(Shrimp_Function* f) {
+    Shrimp_CFG cfg;
+    Shrimp_Loops loops;
+    Shrimp_cfg_build(f, &cfg);
+    Shrimp_cfg_dominators(&cfg);
+    Shrimp_cfg_loops(&cfg, &loops);
+
+    bool changed = false;
+    for (size_t l = 0; l < loops.count && !changed; l++) changed = Shrimp_rotate_loop(f, &cfg, &loops.items[l]);
+
+    Shrimp_loops_free(&loops);
+    Shrimp_cfg_free(&cfg);
+    return changed;
+}
+
+bool Shrimp_module_rotate(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        // a rotated loop is only jumped back to by the test at its bottom, so it's never rotated again and
+        // this only guards against a bug looping forever
+        for (size_t rounds = 0; rounds < f->count && Shrimp_rotate_round(f); rounds++) {
+            Shrimp_function_compact(f);
+            changed = true;
+        }
+    }
+    return changed;
+}
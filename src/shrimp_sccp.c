@@ -0,0 +1,254 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Sparse conditional constant propagation over the whole CFG of a function
+//
+// Shrimp isn't in SSA form, the temps behind variables get assigned over and over. So:
+//   - temps with exactly one definition get one lattice cell for the whole function, like SSA values
+//   - temps with several definitions get a cell per block (the state at the start of it)
+//     which is met over the executable edges coming into the block
+//   - temps that are never defined are unknown, so are params until something writes to them
+//     (params that get written go per block as well, since they're already written on entry)
+// Blocks are only looked at once an executable edge reaches them and a branch on a known
+// condition only makes its taken edge executable, which is what finds the dead code
+typedef enum {
+    SHRIMP_LATTICE_TOP,
+    SHRIMP_LATTICE_CONST,
+    SHRIMP_LATTICE_BOTTOM,
+} Shrimp_LatticeKind;
+
+typedef struct {
+    Shrimp_LatticeKind kind;
+    uint64_t c;
+} Shrimp_LatticeCell;
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    // for every temp: SHRIMP_NO_INSTR if it's never defined, its cell in `single` if it's defined once,
+    // otherwise its index into the per block states
+    uint32_t* slot;
+    bool* multi;
+    Shrimp_LatticeCell* single;
+    size_t multi_count;
+    // multi_count cells per block
+    Shrimp_LatticeCell* in;
+    bool* executable;
+    // worklist of blocks
+    uint32_t* work;
+    size_t work_count;
+    bool* queued;
+} Shrimp_SCCP;
+
+static bool Shrimp_lattice_meet(Shrimp_LatticeCell* into, Shrimp_LatticeCell with) {
+    if (with.kind == SHRIMP_LATTICE_TOP || into->kind == SHRIMP_LATTICE_BOTTOM) return false;
+    if (into->kind == SHRIMP_LATTICE_TOP) {
+        *into = with;
+        return true;
+    }
+    if (with.kind == SHRIMP_LATTICE_CONST && with.c == into->c) return false;
+    into->kind = SHRIMP_LATTICE_BOTTOM;
+    return true;
+}
+
+static void Shrimp_sccp_push(Shrimp_SCCP* s, uint32_t block) {
+    if (s->queued[block]) return;
+    s->queued[block] = true;
+    s->work[s->work_count++] = block;
+}
+
+static Shrimp_LatticeCell Shrimp_sccp_value(const Shrimp_SCCP* s, const Shrimp_LatticeCell* state, Shrimp_Ref ref) {
+    if (SHRIMP_REF_IS_CONST(ref)) return (Shrimp_LatticeCell){.kind = SHRIMP_LATTICE_CONST, .c = Shrimp_function_const(s->func, ref)};
+    uint32_t slot = s->slot[ref];
+    if (slot == SHRIMP_NO_INSTR) return (Shrimp_LatticeCell){.kind = SHRIMP_LATTICE_BOTTOM};
+    return s->multi[ref] ? state[slot] : s->single[slot];
+}
+
+static Shrimp_LatticeCell Shrimp_sccp_eval(const Shrimp_SCCP* s, const Shrimp_LatticeCell* state, const Shrimp_Instr* instr) {
+    if (instr->t == SHRIMP_IT_ASSIGN) return Shrimp_sccp_value(s, state, instr->assign.v);
+    if (instr->t == SHRIMP_IT_CALL) return (Shrimp_LatticeCell){.kind = SHRIMP_LATTICE_BOTTOM};
+    Shrimp_LatticeCell l = Shrimp_sccp_value(s, state, instr->binop.l);
+    Shrimp_LatticeCell r = Shrimp_sccp_value(s, state, instr->binop.r);
+    if (l.kind == SHRIMP_LATTICE_BOTTOM || r.kind == SHRIMP_LATTICE_BOTTOM) return (Shrimp_LatticeCell){.kind = SHRIMP_LATTICE_BOTTOM};
+    if (l.kind == SHRIMP_LATTICE_TOP || r.kind == SHRIMP_LATTICE_TOP) return (Shrimp_LatticeCell){.kind = SHRIMP_LATTICE_TOP};
+    Shrimp_LatticeCell result = {.kind = SHRIMP_LATTICE_CONST};
+    if (!Shrimp_eval_binop(instr->t, l.c, r.c, &result.c)) result.kind = SHRIMP_LATTICE_BOTTOM;
+    return result;
+}
+
+// Updates `state` (or the single cell) with what the instruction defines
+static void Shrimp_sccp_def(Shrimp_SCCP* s, Shrimp_LatticeCell* state, const Shrimp_Instr* instr) {
+    uint32_t def;
+    if (!Shrimp_instr_def(instr, &def)) return;
+    Shrimp_LatticeCell v = Shrimp_sccp_eval(s, state, instr);
+    if (s->multi[def]) {
+        state[s->slot[def]] = v;
+        return;
+    }
+    if (!Shrimp_lattice_meet(&s->single[s->slot[def]], v)) return;
+    // everything reading it has to be looked at again
+    const Shrimp_InstrList* uses = &s->func->uses.items[def].uses;
+    for (size_t i = 0; i < uses->count; i++) {
+        uint32_t block = s->cfg.instr_block[uses->items[i]];
+        if (s->executable[block]) Shrimp_sccp_push(s, block);
+    }
+}
+
+static void Shrimp_sccp_flow(Shrimp_SCCP* s, const Shrimp_LatticeCell* state, uint32_t to) {
+    if (to == SHRIMP_NO_BLOCK) return;
+    bool changed = !s->executable[to];
+    s->executable[to] = true;
+    Shrimp_LatticeCell* in = &s->in[(size_t)to * s->multi_count];
+    for (size_t i = 0; i < s->multi_count; i++) changed |= Shrimp_lattice_meet(&in[i], state[i]);
+    if (changed) Shrimp_sccp_push(s, to);
+}
+
+static void Shrimp_sccp_block(Shrimp_SCCP* s, uint32_t b, Shrimp_LatticeCell* state) {
+    const Shrimp_Block* block = &s->cfg.items[b];
+    memcpy(state, &s->in[(size_t)b * s->multi_count], sizeof(Shrimp_LatticeCell) * s->multi_count);
+    for (uint32_t i = block->begin; i < block->end; i++) Shrimp_sccp_def(s, state, &s->func->items[i]);
+
+    const Shrimp_Instr* last = Shrimp_cfg_terminator(s->func, &s->cfg, b);
+    uint32_t next = Shrimp_cfg_fallthrough(&s->cfg, b);
+    if (last == NULL) {
+        Shrimp_sccp_flow(s, state, next);
+        return;
+    }
+    switch (last->t) {
+        case SHRIMP_IT_JUMP: Shrimp_sccp_flow(s, state, s->cfg.label_block[last->jmp.to]); break;
+        case SHRIMP_IT_JUMP_IF_NOT: case SHRIMP_IT_JUMP_IF: {
+            Shrimp_LatticeCell cond = Shrimp_sccp_value(s, state, last->jmp_if_not.cond);
+            if (cond.kind == SHRIMP_LATTICE_TOP) break;
+            bool jumps = (cond.c == 0) == (last->t == SHRIMP_IT_JUMP_IF_NOT);
+            if (cond.kind == SHRIMP_LATTICE_BOTTOM || !jumps) Shrimp_sccp_flow(s, state, next);
+            if (cond.kind == SHRIMP_LATTICE_BOTTOM || jumps) Shrimp_sccp_flow(s, state, s->cfg.label_block[last->jmp_if_not.to]);
+            break;
+        }
+        default: break;
+    }
+}
+
+// Replaces what turned out to be constant, walking the block with the final states
+static bool Shrimp_sccp_rewrite_block(Shrimp_SCCP* s, uint32_t b, Shrimp_LatticeCell* state) {
+    Shrimp_Function* f = s->func;
+    const Shrimp_Block* block = &s->cfg.items[b];
+    bool changed = false;
+    memcpy(state, &s->in[(size_t)b * s->multi_count], sizeof(Shrimp_LatticeCell) * s->multi_count);
+    for (uint32_t i = block->begin; i < block->end; i++) {
+        Shrimp_Instr instr = f->items[i];
+        bool modified = false;
+
+        uint32_t def;
+        if (Shrimp_instr_is_binop(instr.t) && Shrimp_instr_def(&instr, &def)) {
+            Shrimp_LatticeCell v = Shrimp_sccp_eval(s, state, &instr);
+            if (v.kind == SHRIMP_LATTICE_CONST) {
+                instr = (Shrimp_Instr) {
+                    .t = SHRIMP_IT_ASSIGN,
+                    .assign = {
+                        .into = def,
+                        .v = Shrimp_function_const_ref(f, v.c),
+                    }
+                };
+                modified = true;
+            }
+        }
+
+        Shrimp_Ref* ops[2];
+        size_t n = Shrimp_instr_operands(&instr, ops);
+        for (size_t j = 0; j < n; j++) {
+            if (SHRIMP_REF_IS_CONST(*ops[j])) continue;
+            Shrimp_LatticeCell v = Shrimp_sccp_value(s, state, *ops[j]);
+            if (v.kind != SHRIMP_LATTICE_CONST) continue;
+            *ops[j] = Shrimp_function_const_ref(f, v.c);
+            modified = true;
+        }
+
+        if (Shrimp_instr_is_branch(instr.t) && SHRIMP_REF_IS_CONST(instr.jmp_if_not.cond)) {
+            if ((Shrimp_function_const(f, instr.jmp_if_not.cond) == 0) != (instr.t == SHRIMP_IT_JUMP_IF_NOT)) {
+                instr = (Shrimp_Instr){.t = SHRIMP_IT_NOP};
+            } else {
+                instr = (Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = instr.jmp_if_not.to}};
+            }
+            modified = true;
+        }
+
+        // the state has to move on with what the original instruction did
+        Shrimp_sccp_def(s, state, &f->items[i]);
+        if (modified) {
+            Shrimp_function_set_instr(f, i, instr);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static bool Shrimp_function_sccp(Shrimp_Function* f) {
+    if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+    Shrimp_SCCP s = {.func = f};
+    Shrimp_cfg_build(f, &s.cfg);
+
+    size_t temps = f->temps.count;
+    size_t blocks = s.cfg.count;
+    s.slot = malloc(sizeof(uint32_t) * (temps ? temps : 1));
+    s.multi = calloc(temps ? temps : 1, sizeof(bool));
+    size_t single_count = 0;
+    for (size_t t = 0; t < temps; t++) {
+        size_t defs = f->uses.items[t].defs.count;
+        if (defs == 0) s.slot[t] = SHRIMP_NO_INSTR;
+        else if (defs == 1 && t >= f->param_count) s.slot[t] = single_count++;
+        else {
+            s.multi[t] = true;
+            s.slot[t] = s.multi_count++;
+        }
+    }
+    s.single = calloc(single_count ? single_count : 1, sizeof(Shrimp_LatticeCell));
+    s.in = calloc(blocks * s.multi_count + 1, sizeof(Shrimp_LatticeCell));
+    s.executable = calloc(blocks, sizeof(bool));
+    s.queued = calloc(blocks, sizeof(bool));
+    s.work = malloc(sizeof(uint32_t) * blocks);
+    Shrimp_LatticeCell* state = malloc(sizeof(Shrimp_LatticeCell) * (s.multi_count + 1));
+
+    // nothing is known about the variables on entry
+    for (size_t i = 0; i < s.multi_count; i++) s.in[i].kind = SHRIMP_LATTICE_BOTTOM;
+    s.executable[0] = true;
+    Shrimp_sccp_push(&s, 0);
+    while (s.work_count != 0) {
+        // the worklist holds every block at most once, so popping from the back is fine
+        uint32_t b = s.work[--s.work_count];
+        s.queued[b] = false;
+        Shrimp_sccp_block(&s, b, state);
+    }
+
+    bool changed = false;
+    for (uint32_t b = 0; b < blocks; b++) {
+        if (s.executable[b]) {
+            changed |= Shrimp_sccp_rewrite_block(&s, b, state);
+            continue;
+        }
+        // never reached, only the labels stay so that the jumps which are still around have somewhere to go
+        for (uint32_t i = s.cfg.items[b].begin; i < s.cfg.items[b].end; i++) {
+            if (f->items[i].t == SHRIMP_IT_LABEL || f->items[i].t == SHRIMP_IT_NOP) continue;
+            Shrimp_function_remove_instr(f, i);
+            changed = true;
+        }
+    }
+
+    free(state);
+    free(s.work);
+    free(s.queued);
+    free(s.executable);
+    free(s.in);
+    free(s.single);
+    free(s.multi);
+    free(s.slot);
+    Shrimp_cfg_free(&s.cfg);
+    return changed;
+}
+
+bool Shrimp_module_sccp(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) changed |= Shrimp_function_sccp(&mod->items[i]);
+    return changed;
+}
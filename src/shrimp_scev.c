@@ -0,0 +1,348 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Closed forms of loops (scalar evolution)
+//
+// Works on counted loops (see Shrimp_CountedLoop) made of the header and a single straight line block, the
+// shape of a while loop without ifs inside. One round of the loop is evaluated symbolically, with values
+// that are affine in the round number m: A * m + B, where A and B are the same in every round and get
+// computed up front. What the loop carries from round to round is either
+//   - an induction variable `t <- t + d` with d invariant, which starts a round as d * m + t
+//   - an accumulator written once per round with what it held at the start of the round plus something
+//     affine, like `s <- s + e`, which the values read from it are as well
+// After T rounds an accumulator holds s + A * T * (T - 1) / 2 + B * T and everything written in the header
+// holds what the header's last run computes with m = T, so the whole loop can be replaced by computing
+// that directly. The counter can't wrap around before the test fails if it goes up by 1 or the limit is a
+// constant far enough from the top, so T is (n - i) / c rounded up, or 0 if i >= n to begin with.
+// All of the arithmetic is modulo 2^64 just like the loop's.
+
+typedef struct {
+    bool known;
+    // A * m + B, A and B are constants or temps computed before the loop
+    Shrimp_Ref a, b;
+    // unless it's SHRIMP_NO_INSTR plus what this accumulator held at the start of the round
+    uint32_t accum;
+} Shrimp_Evolution;
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    Shrimp_Loops loops;
+    Shrimp_Liveness liveness;
+
+    const Shrimp_Loop* loop;
+    // the temps there were before emitting anything, the tables are indexed by them
+    size_t temps;
+    Shrimp_Evolution* state;
+    // the temps carried from round to round that aren't induction variables and still might be accumulators
+    bool* accumulator;
+    // what every round adds to an accumulator and what it holds after the loop once that's been emitted
+    Shrimp_Evolution* increment;
+    Shrimp_Ref* final;
+    // the code replacing the loop
+    Shrimp_InstrBuf out;
+} Shrimp_SCEV;
+
+static Shrimp_Ref Shrimp_scev_const(Shrimp_SCEV* s, uint64_t value) {
+    return Shrimp_function_const_ref(s->func, value);
+}
+
+static bool Shrimp_scev_is_const(const Shrimp_SCEV* s, Shrimp_Ref ref, uint64_t value) {
+    return SHRIMP_REF_IS_CONST(ref) && Shrimp_function_const(s->func, ref) == value;
+}
+
+// Emits l op r into the replacement, folding what's known
+static Shrimp_Ref Shrimp_scev_emit(Shrimp_SCEV* s, uint8_t op, Shrimp_Ref l, Shrimp_Ref r) {
+    uint64_t folded;
+    if (SHRIMP_REF_IS_CONST(l) && SHRIMP_REF_IS_CONST(r) && Shrimp_eval_binop(op, Shrimp_function_const(s->func, l), Shrimp_function_const(s->func, r), &folded)) {
+        return Shrimp_scev_const(s, folded);
+    }
+    if ((op == SHRIMP_IT_ADD || op == SHRIMP_IT_SUB) && Shrimp_scev_is_const(s, r, 0)) return l;
+    if (op == SHRIMP_IT_ADD && Shrimp_scev_is_const(s, l, 0)) return r;
+    if (op == SHRIMP_IT_MUL && (Shrimp_scev_is_const(s, l, 0) || Shrimp_scev_is_const(s, r, 0))) return Shrimp_scev_const(s, 0);
+    if (op == SHRIMP_IT_MUL && Shrimp_scev_is_const(s, r, 1)) return l;
+    if (op == SHRIMP_IT_MUL && Shrimp_scev_is_const(s, l, 1)) return r;
+    uint32_t result = Shrimp_function_alloc_temp(s->func, 8).t;
+    Shrimp_da_push(&s->out, ((Shrimp_Instr){.t = op, .binop = {.l = l, .r = r, .result = result}}));
+    return result;
+}
+
+static bool Shrimp_scev_defined_in_loop(const Shrimp_SCEV* s, uint32_t temp) {
+    const Shrimp_InstrList* defs = &s->func->uses.items[temp].defs;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (s->loop->contains[s->cfg.instr_block[defs->items[i]]]) return true;
+    }
+    return false;
+}
+
+static Shrimp_Evolution Shrimp_scev_ref(Shrimp_SCEV* s, Shrimp_Ref ref) {
+    if (SHRIMP_REF_IS_CONST(ref) || !Shrimp_scev_defined_in_loop(s, ref)) {
+        return (Shrimp_Evolution){.known = true, .a = Shrimp_scev_const(s, 0), .b = ref, .accum = SHRIMP_NO_INSTR};
+    }
+    return s->state[ref];
+}
+
+static Shrimp_Evolution Shrimp_scev_binop(Shrimp_SCEV* s, const Shrimp_Instr* instr) {
+    Shrimp_Evolution l = Shrimp_scev_ref(s, instr->binop.l);
+    Shrimp_Evolution r = Shrimp_scev_ref(s, instr->binop.r);
+    Shrimp_Evolution unknown = {.known = false};
+    if (!l.known || !r.known) return unknown;
+    Shrimp_Evolution result = {.known = true, .accum = SHRIMP_NO_INSTR};
+    switch (instr->t) {
+        case SHRIMP_IT_ADD:
+        case SHRIMP_IT_SUB:
+            // there's no room for two accumulators or a negated one
+            if (r.accum != SHRIMP_NO_INSTR && (l.accum != SHRIMP_NO_INSTR || instr->t == SHRIMP_IT_SUB)) return unknown;
+            result.accum = l.accum != SHRIMP_NO_INSTR ? l.accum : r.accum;
+            result.a = Shrimp_scev_emit(s, instr->t, l.a, r.a);
+            result.b = Shrimp_scev_emit(s, instr->t, l.b, r.b);
+            return result;
+        case SHRIMP_IT_MUL:
+            if (l.accum != SHRIMP_NO_INSTR || r.accum != SHRIMP_NO_INSTR) return unknown;
+            // one side has to be the same in every round for the product to stay affine
+            if (Shrimp_scev_is_const(s, l.a, 0)) {
+                Shrimp_Evolution swap = l;
+                l = r;
+                r = swap;
+            }
+            if (!Shrimp_scev_is_const(s, r.a, 0)) return unknown;
+            result.a = Shrimp_scev_emit(s, SHRIMP_IT_MUL, l.a, r.b);
+            result.b = Shrimp_scev_emit(s, SHRIMP_IT_MUL, l.b, r.b);
+            return result;
+        case SHRIMP_IT_SHL:
+            if (l.accum != SHRIMP_NO_INSTR || !SHRIMP_REF_IS_CONST(instr->binop.r)) return unknown;
+            result.a = Shrimp_scev_emit(s, SHRIMP_IT_SHL, l.a, r.b);
+            result.b = Shrimp_scev_emit(s, SHRIMP_IT_SHL, l.b, r.b);
+            return result;
+        default:
+            return unknown;
+    }
+}
+
+// The only instruction in the loop writing the temp, SHRIMP_NO_INSTR if there are several
+static uint32_t Shrimp_scev_loop_def(const Shrimp_SCEV* s, uint32_t temp) {
+    const Shrimp_InstrList* defs = &s->func->uses.items[temp].defs;
+    uint32_t def = SHRIMP_NO_INSTR;
+    for (size_t i = 0; i < defs->count; i++) {
+        if (!s->loop->contains[s->cfg.instr_block[defs->items[i]]]) continue;
+        if (def != SHRIMP_NO_INSTR) return SHRIMP_NO_INSTR;
+        def = defs->items[i];
+    }
+    return def;
+}
+
+// What a temp the loop carries from round to round starts a round as, induction variables are
+// `t <- t + d` or `t <- t - d` and everything else written once is taken as an accumulator until its
+// update turns out to be something else
+static Shrimp_Evolution Shrimp_scev_carried(Shrimp_SCEV* s, uint32_t temp) {
+    Shrimp_Evolution unknown = {.known = false};
+    uint32_t def = Shrimp_scev_loop_def(s, temp);
+    if (def == SHRIMP_NO_INSTR) return unknown;
+    Shrimp_Instr instr = s->func->items[def];
+    if (instr.t == SHRIMP_IT_ADD || instr.t == SHRIMP_IT_SUB) {
+        Shrimp_Ref step = SHRIMP_NO_INSTR;
+        if (instr.binop.l == temp) step = instr.binop.r;
+        else if (instr.t == SHRIMP_IT_ADD && instr.binop.r == temp) step = instr.binop.l;
+        if (step != SHRIMP_NO_INSTR && step != temp && (SHRIMP_REF_IS_CONST(step) || !Shrimp_scev_defined_in_loop(s, step))) {
+            if (instr.t == SHRIMP_IT_SUB) step = Shrimp_scev_emit(s, SHRIMP_IT_SUB, Shrimp_scev_const(s, 0), step);
+            return (Shrimp_Evolution){.known = true, .a = step, .b = temp, .accum = SHRIMP_NO_INSTR};
+        }
+    }
+    if (!s->accumulator[temp]) return unknown;
+    return (Shrimp_Evolution){.known = true, .a = Shrimp_scev_const(s, 0), .b = Shrimp_scev_const(s, 0), .accum = temp};
+}
+
+// Walks one round, returns the accumulator whose update wasn't one or SHRIMP_NO_INSTR
+static uint32_t Shrimp_scev_round(Shrimp_SCEV* s, uint32_t body, Shrimp_Evolution* after_header) {
+    Shrimp_Function* f = s->func;
+    uint32_t header = s->loop->header;
+    for (size_t t = 0; t < s->temps; t++) {
+        bool carried = SHRIMP_BITS_TEST(&s->liveness.live_in[header * s->liveness.words], t) && Shrimp_scev_defined_in_loop(s, t);
+        s->state[t] = carried ? Shrimp_scev_carried(s, t) : (Shrimp_Evolution){.known = false};
+    }
+    uint32_t blocks[2] = {header, body};
+    for (size_t b = 0; b < 2; b++) {
+        for (uint32_t i = s->cfg.items[blocks[b]].begin; i < s->cfg.items[blocks[b]].end; i++) {
+            Shrimp_Instr instr = f->items[i];
+            uint32_t def;
+            if (!Shrimp_instr_def(&instr, &def)) continue;
+            Shrimp_Evolution value = {.known = false};
+            if (instr.t == SHRIMP_IT_ASSIGN) value = Shrimp_scev_ref(s, instr.assign.v);
+            else if (Shrimp_instr_is_binop(instr.t)) value = Shrimp_scev_binop(s, &instr);
+            if (s->state[def].known && s->state[def].accum == def && s->accumulator[def]) {
+                if (!value.known || value.accum != def) return def;
+                s->increment[def] = value;
+            }
+            s->state[def] = value;
+        }
+        if (b == 0) memcpy(after_header, s->state, sizeof(Shrimp_Evolution) * s->temps);
+    }
+    return SHRIMP_NO_INSTR;
+}
+
+// Emits the number of rounds, SHRIMP_NO_INSTR if it isn't safe to compute
+static Shrimp_Ref Shrimp_scev_trip_count(Shrimp_SCEV* s, const Shrimp_CountedLoop* counted) {
+    Shrimp_Function* f = s->func;
+    uint64_t trips;
+    if (Shrimp_loop_trip_count(f, &s->cfg, s->loop, counted, &trips)) return Shrimp_scev_const(s, trips);
+    if (counted->step != 1) {
+        if (!SHRIMP_REF_IS_CONST(counted->limit)) return SHRIMP_NO_INSTR;
+        if (((unsigned __int128)Shrimp_function_const(f, counted->limit) + counted->step - 1) >> 64) return SHRIMP_NO_INSTR;
+    }
+    // (n - i + c - 1) / c if i < n, 0 otherwise
+    Shrimp_Ref inside = Shrimp_scev_emit(s, SHRIMP_IT_CMP_LT, counted->counter, counted->limit);
+    Shrimp_Ref distance = Shrimp_scev_emit(s, SHRIMP_IT_SUB, counted->limit, counted->counter);
+    distance = Shrimp_scev_emit(s, SHRIMP_IT_ADD, distance, Shrimp_scev_const(s, counted->step - 1));
+    distance = Shrimp_scev_emit(s, SHRIMP_IT_DIV, distance, Shrimp_scev_const(s, counted->step));
+    return Shrimp_scev_emit(s, SHRIMP_IT_MUL, distance, inside);
+}
+
+// T * (T - 1) / 2 modulo 2^64, from the full 128 bit product so halving it doesn't lose the top bit
+static Shrimp_Ref Shrimp_scev_triangle(Shrimp_SCEV* s, Shrimp_Ref trips) {
+    Shrimp_Ref before = Shrimp_scev_emit(s, SHRIMP_IT_SUB, trips, Shrimp_scev_const(s, 1));
+    Shrimp_Ref low = Shrimp_scev_emit(s, SHRIMP_IT_MUL, trips, before);
+    Shrimp_Ref high = Shrimp_scev_emit(s, SHRIMP_IT_MULHU, trips, before);
+    low = Shrimp_scev_emit(s, SHRIMP_IT_SHR, low, Shrimp_scev_const(s, 1));
+    high = Shrimp_scev_emit(s, SHRIMP_IT_SHL, high, Shrimp_scev_const(s, 63));
+    return Shrimp_scev_emit(s, SHRIMP_IT_ADD, low, high);
+}
+
+// What the accumulator holds after T rounds, s + A * T * (T - 1) / 2 + B * T
+static Shrimp_Ref Shrimp_scev_final(Shrimp_SCEV* s, uint32_t accum, Shrimp_Ref trips, Shrimp_Ref* triangle) {
+    if (s->final[accum] != SHRIMP_NO_INSTR) return s->final[accum];
+    if (*triangle == SHRIMP_NO_INSTR) *triangle = Shrimp_scev_triangle(s, trips);
+    Shrimp_Ref sum = Shrimp_scev_emit(s, SHRIMP_IT_MUL, s->increment[accum].a, *triangle);
+    sum = Shrimp_scev_emit(s, SHRIMP_IT_ADD, sum, Shrimp_scev_emit(s, SHRIMP_IT_MUL, s->increment[accum].b, trips));
+    s->final[accum] = Shrimp_scev_emit(s, SHRIMP_IT_ADD, accum, sum);
+    return s->final[accum];
+}
+
+static bool Shrimp_scev_loop(Shrimp_SCEV* s, const Shrimp_Loop* loop) {
+    Shrimp_Function* f = s->func;
+    Shrimp_CountedLoop counted;
+    s->loop = loop;
+    if (loop->blocks.count != 2 || !Shrimp_loop_counted(f, &s->cfg, &s->loops, loop, &counted) || !counted.every_round) return false;
+    uint32_t header = loop->header;
+    uint32_t body = loop->blocks.items[1];
+    const Shrimp_Instr* back = Shrimp_cfg_terminator(f, &s->cfg, body);
+    if (back == NULL || back->t != SHRIMP_IT_JUMP || s->cfg.items[body].preds.count != 1) return false;
+    if (f->items[s->cfg.items[header].begin].t != SHRIMP_IT_LABEL) return false;
+    // the loop is dropped as a whole, a call in it might never return and a division might trap
+    for (size_t b = 0; b < 2; b++) {
+        const Shrimp_Block* block = &s->cfg.items[loop->blocks.items[b]];
+        for (uint32_t i = block->begin; i < block->end; i++) {
+            if (f->items[i].t == SHRIMP_IT_CALL || Shrimp_instr_may_trap(f, &f->items[i])) return false;
+        }
+    }
+    Shrimp_Label exit = Shrimp_cfg_terminator(f, &s->cfg, header)->jmp_if_not.to;
+
+    size_t temps = s->temps;
+    s->out.count = 0;
+    Shrimp_da_push(&s->out, f->items[s->cfg.items[header].begin]);
+    Shrimp_Ref trips = Shrimp_scev_trip_count(s, &counted);
+    if (trips == SHRIMP_NO_INSTR) {
+        Shrimp_function_truncate_temps(f, temps);
+        return false;
+    }
+
+    for (size_t t = 0; t < temps; t++) {
+        s->accumulator[t] = true;
+        s->final[t] = SHRIMP_NO_INSTR;
+    }
+    Shrimp_Evolution* after_header = malloc(sizeof(Shrimp_Evolution) * (temps + 1));
+    // every failed walk rules out an accumulator, what it emitted is thrown away
+    size_t walk_temps = f->temps.count;
+    size_t walk_out = s->out.count;
+    for (uint32_t failed; (failed = Shrimp_scev_round(s, body, after_header)) != SHRIMP_NO_INSTR;) {
+        s->accumulator[failed] = false;
+        Shrimp_function_truncate_temps(f, walk_temps);
+        s->out.count = walk_out;
+    }
+
+    // the final values go to fresh temps first, they are computed from the ones at the start
+    bool ok = true;
+    Shrimp_Ref triangle = SHRIMP_NO_INSTR;
+    Shrimp_InstrBuf finals = {0};
+    uint32_t exit_block = s->cfg.label_block[exit];
+    for (size_t t = 0; t < temps && ok; t++) {
+        if (!SHRIMP_BITS_TEST(&s->liveness.live_in[exit_block * s->liveness.words], t) || !Shrimp_scev_defined_in_loop(s, t)) continue;
+        // the last thing the loop runs is the header with m = T
+        Shrimp_Evolution v = after_header[t];
+        if (!v.known) {
+            ok = false;
+            break;
+        }
+        Shrimp_Ref value = Shrimp_scev_emit(s, SHRIMP_IT_MUL, v.a, trips);
+        value = Shrimp_scev_emit(s, SHRIMP_IT_ADD, value, v.b);
+        if (v.accum != SHRIMP_NO_INSTR) value = Shrimp_scev_emit(s, SHRIMP_IT_ADD, value, Shrimp_scev_final(s, v.accum, trips, &triangle));
+        Shrimp_da_push(&finals, ((Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = t, .v = value}}));
+    }
+    free(after_header);
+
+    // with a known trip count the loop might be cheaper than its closed form, unrolling deals with that one
+    size_t size = 0;
+    for (size_t b = 0; b < 2; b++) size += s->cfg.items[loop->blocks.items[b]].end - s->cfg.items[loop->blocks.items[b]].begin;
+    if (ok && SHRIMP_REF_IS_CONST(trips) && Shrimp_function_const(f, trips) * size <= s->out.count + finals.count) ok = false;
+    if (!ok) {
+        Shrimp_da_free(&finals);
+        Shrimp_function_truncate_temps(f, temps);
+        return false;
+    }
+
+    for (size_t i = 0; i < finals.count; i++) Shrimp_da_push(&s->out, finals.items[i]);
+    Shrimp_da_push(&s->out, ((Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = exit}}));
+    Shrimp_da_free(&finals);
+    for (size_t b = 0; b < 2; b++) {
+        const Shrimp_Block* block = &s->cfg.items[loop->blocks.items[b]];
+        for (uint32_t i = block->begin; i < block->end; i++) {
+            if (f->items[i].t != SHRIMP_IT_NOP) Shrimp_function_remove_instr(f, i);
+        }
+    }
+    Shrimp_function_insert(f, s->cfg.items[header].begin, s->out.items, s->out.count);
+    return true;
+}
+
+static bool Shrimp_scev_function_round(Shrimp_Function* f) {
+    Shrimp_SCEV s = {.func = f};
+    Shrimp_cfg_build(f, &s.cfg);
+    Shrimp_cfg_dominators(&s.cfg);
+    Shrimp_cfg_loops(&s.cfg, &s.loops);
+    Shrimp_liveness_compute(f, &s.cfg, &s.liveness);
+
+    bool changed = false;
+    for (size_t l = 0; l < s.loops.count && !changed; l++) {
+        // emitting allocates temps, so the tables are made for each loop
+        s.temps = f->temps.count;
+        s.state = malloc(sizeof(Shrimp_Evolution) * (s.temps + 1));
+        s.increment = malloc(sizeof(Shrimp_Evolution) * (s.temps + 1));
+        s.accumulator = malloc(sizeof(bool) * (s.temps + 1));
+        s.final = malloc(sizeof(Shrimp_Ref) * (s.temps + 1));
+        changed = Shrimp_scev_loop(&s, &s.loops.items[l]);
+        free(s.final);
+        free(s.accumulator);
+        free(s.increment);
+        free(s.state);
+    }
+
+    Shrimp_da_free(&s.out);
+    Shrimp_liveness_free(&s.liveness);
+    Shrimp_loops_free(&s.loops);
+    Shrimp_cfg_free(&s.cfg);
+    return changed;
+}
+
+bool Shrimp_module_scev(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        // every round replaces a loop, this only guards against a bug looping forever
+        for (size_t rounds = 0; rounds < f->count && Shrimp_scev_function_round(f); rounds++) {
+            Shrimp_function_compact(f);
+            changed = true;
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,169 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// CFG simplification
+//   - a conditional jump on a constant becomes a jump or goes away
+//   - jumps to a jump go straight to where that one goes, a conditional jump landing on a test of the same
+//     temp goes where that test sends it since the temp can't have changed in between
+//   - a jump to a return becomes that return
+//   - jumps to labels placed next to each other all go to the first one, so the others are left unused
+//   - blocks nothing reaches anymore, jumps to where control goes anyway and labels nothing jumps to go away
+//   - a block only one jump goes to, that nothing falls into and that doesn't fall out of either, is moved in
+//     place of that jump
+
+// Where every label is placed, SHRIMP_NO_INSTR for the ones that aren't
+static uint32_t* Shrimp_simplify_targets(const Shrimp_Function* f) {
+    uint32_t* targets = malloc(sizeof(uint32_t) * (f->label_count + 1));
+    for (Shrimp_Label l = 0; l < f->label_count; l++) targets[l] = SHRIMP_NO_INSTR;
+    for (uint32_t i = 0; i < f->count; i++) {
+        if (f->items[i].t == SHRIMP_IT_LABEL) targets[f->items[i].label] = i;
+    }
+    return targets;
+}
+
+// The first instruction at or after `at` that does something, f->count if there's none
+static uint32_t Shrimp_simplify_first(const Shrimp_Function* f, uint32_t at) {
+    while (at < f->count && (f->items[at].t == SHRIMP_IT_LABEL || f->items[at].t == SHRIMP_IT_NOP)) at++;
+    return at;
+}
+
+// The first of the labels placed right next to the one given, so jumps to any of them use the same one
+static Shrimp_Label Shrimp_simplify_canonical(const Shrimp_Function* f, const uint32_t* targets, Shrimp_Label label) {
+    if (targets[label] == SHRIMP_NO_INSTR) return label;
+    for (uint32_t i = targets[label]; i-- > 0;) {
+        if (f->items[i].t == SHRIMP_IT_LABEL) label = f->items[i].label;
+        else if (f->items[i].t != SHRIMP_IT_NOP) break;
+    }
+    return label;
+}
+
+// Where a jump ends up after skipping over the jumps and tests it lands on that go the same way
+static Shrimp_Label Shrimp_simplify_thread(const Shrimp_Function* f, const uint32_t* targets, const Shrimp_Instr* jump) {
+    Shrimp_Label original = jump->t == SHRIMP_IT_JUMP ? jump->jmp.to : jump->jmp_if_not.to;
+    Shrimp_Label to = original;
+    for (Shrimp_Label steps = 0; steps <= f->label_count; steps++) {
+        uint32_t first = targets[to] == SHRIMP_NO_INSTR ? f->count : Shrimp_simplify_first(f, targets[to]);
+        if (first >= f->count) return to;
+        const Shrimp_Instr* next = &f->items[first];
+        if (next->t == SHRIMP_IT_JUMP) {
+            to = next->jmp.to;
+        } else if (Shrimp_instr_is_branch(jump->t) && next->t == jump->t && next->jmp_if_not.cond == jump->jmp_if_not.cond) {
+            to = next->jmp_if_not.to;
+        } else {
+            return to;
+        }
+    }
+    // the jumps go around in a circle
+    return original;
+}
+
+static bool Shrimp_simplify_jumps(Shrimp_Function* f) {
+    uint32_t* targets = Shrimp_simplify_targets(f);
+    bool changed = false;
+    for (uint32_t i = 0; i < f->count; i++) {
+        Shrimp_Instr instr = f->items[i];
+        if (Shrimp_instr_is_branch(instr.t) && SHRIMP_REF_IS_CONST(instr.jmp_if_not.cond)) {
+            changed = true;
+            if ((Shrimp_function_const(f, instr.jmp_if_not.cond) == 0) != (instr.t == SHRIMP_IT_JUMP_IF_NOT)) {
+                Shrimp_function_remove_instr(f, i);
+                continue;
+            }
+            instr = (Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = instr.jmp_if_not.to}};
+            Shrimp_function_set_instr(f, i, instr);
+        }
+        if (instr.t != SHRIMP_IT_JUMP && !Shrimp_instr_is_branch(instr.t)) continue;
+
+        Shrimp_Label to = Shrimp_simplify_canonical(f, targets, Shrimp_simplify_thread(f, targets, &instr));
+        if (instr.t == SHRIMP_IT_JUMP && targets[to] != SHRIMP_NO_INSTR) {
+            uint32_t first = Shrimp_simplify_first(f, targets[to]);
+            if (first < f->count && f->items[first].t == SHRIMP_IT_RETURN) {
+                Shrimp_function_set_instr(f, i, f->items[first]);
+                changed = true;
+                continue;
+            }
+        }
+        if (to == (instr.t == SHRIMP_IT_JUMP ? instr.jmp.to : instr.jmp_if_not.to)) continue;
+        if (instr.t == SHRIMP_IT_JUMP) instr.jmp.to = to;
+        else instr.jmp_if_not.to = to;
+        Shrimp_function_set_instr(f, i, instr);
+        changed = true;
+    }
+    free(targets);
+    return changed;
+}
+
+// Moves one block that is only reached by a jump in place of it
+static bool Shrimp_simplify_merge(Shrimp_Function* f) {
+    uint32_t* targets = Shrimp_simplify_targets(f);
+    uint32_t* refs = calloc(f->label_count + 1, sizeof(uint32_t));
+    uint32_t* from = malloc(sizeof(uint32_t) * (f->label_count + 1));
+    for (uint32_t i = 0; i < f->count; i++) {
+        if (f->items[i].t == SHRIMP_IT_JUMP) {
+            refs[f->items[i].jmp.to]++;
+            from[f->items[i].jmp.to] = i;
+        } else if (Shrimp_instr_is_branch(f->items[i].t)) {
+            refs[f->items[i].jmp_if_not.to]++;
+            from[f->items[i].jmp_if_not.to] = SHRIMP_NO_INSTR;
+        }
+    }
+
+    bool changed = false;
+    for (Shrimp_Label l = 0; l < f->label_count && !changed; l++) {
+        if (refs[l] != 1 || from[l] == SHRIMP_NO_INSTR || targets[l] == SHRIMP_NO_INSTR) continue;
+        uint32_t begin = targets[l];
+        uint32_t jump = from[l];
+        // nothing may fall into it
+        uint32_t prev = begin;
+        while (prev > 0 && f->items[prev - 1].t == SHRIMP_IT_NOP) prev--;
+        if (prev == 0) continue;
+        uint8_t before = f->items[prev - 1].t;
+        if (before != SHRIMP_IT_JUMP && before != SHRIMP_IT_RETURN) continue;
+        // and it has to end in a jump or return so nothing falls out of it at its new place
+        uint32_t end = begin + 1;
+        while (end < f->count && f->items[end].t != SHRIMP_IT_JUMP && f->items[end].t != SHRIMP_IT_RETURN && f->items[end].t != SHRIMP_IT_LABEL) end++;
+        if (end >= f->count || f->items[end].t == SHRIMP_IT_LABEL) continue;
+        if (jump >= begin && jump <= end) continue;
+
+        size_t count = 0;
+        Shrimp_Instr* moved = malloc(sizeof(Shrimp_Instr) * (end - begin));
+        for (uint32_t i = begin + 1; i <= end; i++) {
+            if (f->items[i].t == SHRIMP_IT_NOP) continue;
+            moved[count++] = f->items[i];
+            Shrimp_function_remove_instr(f, i);
+        }
+        Shrimp_function_remove_instr(f, begin);
+        Shrimp_function_remove_instr(f, jump);
+        Shrimp_function_insert(f, jump, moved, count);
+        free(moved);
+        changed = true;
+    }
+    free(from);
+    free(refs);
+    free(targets);
+    return changed;
+}
+
+static bool Shrimp_simplify_round(Shrimp_Function* f) {
+    bool changed = Shrimp_simplify_jumps(f);
+    changed |= Shrimp_dce_unreachable(f);
+    changed |= Shrimp_dce_labels(f);
+    changed |= Shrimp_simplify_merge(f);
+    return changed;
+}
+
+bool Shrimp_module_simplify_cfg(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        // every round removes an instruction or points a jump closer to where it ends up, this only guards against
+        // a bug looping forever
+        for (size_t rounds = 0; rounds < f->count && Shrimp_simplify_round(f); rounds++) {
+            Shrimp_function_compact(f);
+            changed = true;
+        }
+    }
+    return changed;
+}
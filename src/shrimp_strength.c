@@ -0,0 +1,131 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Strength reduction of multiplications and divisions by constants
+//   x * 0 -> 0, x * 1 -> x, x * 2^k -> x << k (the other constant factors are left to lea in the backend)
+//   x / 1 -> x, x / 2^k -> x >> k
+//   x / d with d >= 2^63 -> 1 - (x < d), the quotient can only be 0 or 1
+//   x / d otherwise -> the high half of a multiplication by a magic number and shifts
+// The magic numbers are the ones from "Division by Invariant Integers using Multiplication"
+// by Granlund and Montgomery, computed like libdivide does for unsigned 64 bit division.
+
+typedef struct {
+    uint64_t magic;
+    uint32_t shift;
+    // the magic number needed 65 bits, so x has to be added back in after the multiplication
+    bool add;
+} Shrimp_DivMagic;
+
+static uint32_t Shrimp_log2(uint64_t x) {
+    return 63 - __builtin_clzll(x);
+}
+
+static bool Shrimp_is_pow2(uint64_t x) {
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+// d must not be 0 or a power of two
+static Shrimp_DivMagic Shrimp_div_magic(uint64_t d) {
+    uint32_t l = Shrimp_log2(d);
+    unsigned __int128 n = (unsigned __int128)1 << (64 + l);
+    uint64_t m = (uint64_t)(n / d);
+    uint64_t rem = (uint64_t)(n % d);
+    Shrimp_DivMagic result = {.shift = l};
+    // 2^(64 + l) / d rounded up is good enough if the error it brings in stays below 2^l
+    if (d - rem >= ((uint64_t)1 << l)) {
+        // otherwise go one bit further, which makes the magic number 2^64 + m
+        m += m;
+        uint64_t twice_rem = rem + rem;
+        if (twice_rem >= d || twice_rem < rem) m += 1;
+        result.add = true;
+    }
+    result.magic = m + 1;
+    return result;
+}
+
+static Shrimp_Instr Shrimp_binop_instr(uint8_t t, Shrimp_Ref l, Shrimp_Ref r, uint32_t result) {
+    return (Shrimp_Instr){.t = t, .binop = {.l = l, .r = r, .result = result}};
+}
+
+static uint32_t Shrimp_strength_temp(Shrimp_Function* f) {
+    return Shrimp_function_alloc_temp(f, 8).t;
+}
+
+// Writes what x / d turns into to `out`, returns how many instructions that is
+static size_t Shrimp_strength_div(Shrimp_Function* f, Shrimp_Ref x, uint64_t d, uint32_t result, Shrimp_Instr out[5]) {
+    if (d == 1) {
+        out[0] = (Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = result, .v = x}};
+        return 1;
+    }
+    if (Shrimp_is_pow2(d)) {
+        out[0] = Shrimp_binop_instr(SHRIMP_IT_SHR, x, Shrimp_function_const_ref(f, Shrimp_log2(d)), result);
+        return 1;
+    }
+    if (d >> 63) {
+        uint32_t lt = Shrimp_strength_temp(f);
+        out[0] = Shrimp_binop_instr(SHRIMP_IT_CMP_LT, x, Shrimp_function_const_ref(f, d), lt);
+        out[1] = Shrimp_binop_instr(SHRIMP_IT_SUB, Shrimp_function_const_ref(f, 1), lt, result);
+        return 2;
+    }
+    Shrimp_DivMagic magic = Shrimp_div_magic(d);
+    Shrimp_Ref m = Shrimp_function_const_ref(f, magic.magic);
+    Shrimp_Ref shift = Shrimp_function_const_ref(f, magic.shift);
+    uint32_t q = Shrimp_strength_temp(f);
+    out[0] = Shrimp_binop_instr(SHRIMP_IT_MULHU, x, m, q);
+    if (!magic.add) {
+        out[1] = Shrimp_binop_instr(SHRIMP_IT_SHR, q, shift, result);
+        return 2;
+    }
+    // ((x - q) >> 1 + q) >> shift, the same as (x + q) >> (shift + 1) without overflowing
+    uint32_t diff = Shrimp_strength_temp(f);
+    uint32_t half = Shrimp_strength_temp(f);
+    uint32_t sum = Shrimp_strength_temp(f);
+    out[1] = Shrimp_binop_instr(SHRIMP_IT_SUB, x, q, diff);
+    out[2] = Shrimp_binop_instr(SHRIMP_IT_SHR, diff, Shrimp_function_const_ref(f, 1), half);
+    out[3] = Shrimp_binop_instr(SHRIMP_IT_ADD, half, q, sum);
+    out[4] = Shrimp_binop_instr(SHRIMP_IT_SHR, sum, shift, result);
+    return 5;
+}
+
+static bool Shrimp_function_strength_reduce(Shrimp_Function* f) {
+    bool changed = false;
+    // backwards so inserting doesn't move what is still to be looked at
+    for (size_t i = f->count; i-- > 0;) {
+        Shrimp_Instr instr = f->items[i];
+        if (instr.t != SHRIMP_IT_MUL && instr.t != SHRIMP_IT_DIV) continue;
+        if (instr.t == SHRIMP_IT_MUL && SHRIMP_REF_IS_CONST(instr.binop.l) && !SHRIMP_REF_IS_CONST(instr.binop.r)) {
+            Shrimp_Ref l = instr.binop.l;
+            instr.binop.l = instr.binop.r;
+            instr.binop.r = l;
+        }
+        // both constant is for the folders
+        if (!SHRIMP_REF_IS_CONST(instr.binop.r) || SHRIMP_REF_IS_CONST(instr.binop.l)) continue;
+        uint64_t c = Shrimp_function_const(f, instr.binop.r);
+        Shrimp_Ref x = instr.binop.l;
+        uint32_t result = instr.binop.result;
+
+        Shrimp_Instr out[5];
+        size_t count = 0;
+        if (instr.t == SHRIMP_IT_MUL) {
+            if (c == 0) out[count++] = (Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = result, .v = Shrimp_function_const_ref(f, 0)}};
+            else if (c == 1) out[count++] = (Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = result, .v = x}};
+            else if (Shrimp_is_pow2(c)) out[count++] = Shrimp_binop_instr(SHRIMP_IT_SHL, x, Shrimp_function_const_ref(f, Shrimp_log2(c)), result);
+            else if (f->items[i].binop.r != instr.binop.r) out[count++] = instr;
+        } else if (c != 0) {
+            count = Shrimp_strength_div(f, x, c, result, out);
+        }
+        if (count == 0) continue;
+        Shrimp_function_set_instr(f, i, out[0]);
+        Shrimp_function_insert(f, i + 1, &out[1], count - 1);
+        changed = true;
+    }
+    return changed;
+}
+
+bool Shrimp_module_strength_reduce(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) changed |= Shrimp_function_strength_reduce(&mod->items[i]);
+    return changed;
+}
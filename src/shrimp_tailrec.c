@@ -0,0 +1,79 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+
+// Tail recursion
+//
+// A function calling itself and returning what the call returns right away doesn't need a new frame for it,
+// the arguments become the new values of the params and the call a jump back to the start:
+//     func f($0, $1) {            func f($0, $1) {
+//       ...                         jump @S
+//                                   S:
+//                                   ...
+//       arg $2                      $5 <- $2
+//       arg $0                      $6 <- $0
+//       $4 <- call f                $0 <- $5
+//       return $4                   $1 <- $6
+//                                   jump @S
+// The arguments go through fresh temps first since they may read params that get written before them, copy
+// propagation cleans up the ones that didn't need it. The jump in front makes the start its own block so the
+// loop passes find a preheader for the loop this turns the recursion into.
+//
+// Tail calls to other functions, and the ones left when this doesn't run, are turned into jumps by the backend.
+
+static void Shrimp_tailrec_call(Shrimp_Function* f, uint32_t at, Shrimp_Label start) {
+    uint32_t argc = f->items[at].call.argc;
+    Shrimp_Ref* args = malloc(sizeof(Shrimp_Ref) * (argc + 1));
+    for (uint32_t i = at, left = argc; left != 0;) {
+        i--;
+        if (f->items[i].t != SHRIMP_IT_ARG) continue;
+        args[--left] = f->items[i].arg;
+        Shrimp_function_remove_instr(f, i);
+    }
+
+    Shrimp_InstrBuf out = {0};
+    uint32_t first = f->temps.count;
+    for (uint32_t p = 0; p < argc; p++) {
+        // passing a param on in its own place leaves it as it is
+        if (args[p] == p) continue;
+        uint32_t copy = Shrimp_function_alloc_temp(f, Shrimp_function_temp(f, p)->size).t;
+        Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = copy, .v = args[p]}}));
+    }
+    for (uint32_t p = 0, copy = first; p < argc; p++) {
+        if (args[p] == p) continue;
+        Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_ASSIGN, .assign = {.into = p, .v = copy++}}));
+    }
+    Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = start}}));
+
+    Shrimp_function_remove_instr(f, at);
+    Shrimp_function_insert(f, at, out.items, out.count);
+    Shrimp_da_free(&out);
+    free(args);
+}
+
+bool Shrimp_module_tailrec(Shrimp_Module* mod) {
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        Shrimp_Label start = 0;
+        bool found = false;
+        for (uint32_t j = 0; j < f->count; j++) {
+            const Shrimp_Instr* instr = &f->items[j];
+            if (instr->t != SHRIMP_IT_CALL || instr->call.func != i || !Shrimp_function_is_tail_call(f, j)) continue;
+            if (!found) {
+                if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+                start = Shrimp_function_label_alloc(f);
+                found = true;
+            }
+            Shrimp_tailrec_call(f, j, start);
+        }
+        if (!found) continue;
+        Shrimp_Instr entry[2] = {
+            {.t = SHRIMP_IT_JUMP, .jmp = {.to = start}},
+            {.t = SHRIMP_IT_LABEL, .label = start},
+        };
+        Shrimp_function_insert(f, 0, entry, 2);
+        changed = true;
+    }
+    return changed;
+}
@@ -0,0 +1,467 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reads back what Shrimp_module_dump prints:
+//   func _start() {
+//     $0 <- 10
+//     $1 <- $0 + 2
+//     0:
+//     jump_z $1 @1
+//     jump_nz $1 @0
+//     jump_z $1 @1 weights 3:97
+//     jump @0
+//     1:
+//     return $1
+//   }
+//   func add($0, $1) {
+//     $2 <- $0 + $1
+//     return $2
+//   }
+// The params of a function are its first temps and have to be listed in order, calls are written as
+//     arg $1
+//     arg 2
+//     $3 <- call add
+// and may refer to functions defined further down, a function that is visible outside of the module starts with
+//   export func add($0, $1) {
+// The weights of a conditional jump from a profile are how often it was taken and not taken
+// Everything after a `#` until the end of the line is a comment
+// Temps are numbered by the text, every temp up to the biggest number used exists so they only go up to
+// SHRIMP_TEXT_MAX_TEMPS. They have the default size of 8 bytes unless a mention of them gives another one, like
+// `$3:4`, the dump gives it on every mention of the ones that were narrowed
+
+// 8 MB worth of temps, more than that doesn't fit into the frame on a default stack anyway
+#define SHRIMP_TEXT_MAX_TEMPS (1u << 20)
+
+// A call whose callee is looked up once every function is known
+typedef struct {
+    uint32_t func;
+    uint32_t instr;
+    char* callee;
+    size_t line;
+} Shrimp_TextCall;
+
+typedef struct {
+    Shrimp_TextCall* items;
+    size_t count;
+    size_t capacity;
+} Shrimp_TextCalls;
+
+typedef struct {
+    const char* path;
+    const char* cur;
+    const char* end;
+    size_t line;
+    Shrimp_TextCalls calls;
+} Shrimp_TextParser;
+
+static void Shrimp_text_error(const Shrimp_TextParser* p, const char* fmt, ...);
+static void Shrimp_text_skip_ws(Shrimp_TextParser* p);
+static bool Shrimp_text_at_eol(Shrimp_TextParser* p);
+static void Shrimp_text_next_line(Shrimp_TextParser* p);
+static bool Shrimp_text_eat(Shrimp_TextParser* p, const char* s);
+static bool Shrimp_text_number(Shrimp_TextParser* p, uint64_t* out);
+static bool Shrimp_text_temp(Shrimp_TextParser* p, Shrimp_Function* func, uint32_t* out);
+static bool Shrimp_text_value(Shrimp_TextParser* p, Shrimp_Function* func, Shrimp_Ref* out);
+static bool Shrimp_text_label(Shrimp_TextParser* p, Shrimp_Function* func, Shrimp_Label* out);
+static bool Shrimp_text_weights(Shrimp_TextParser* p, Shrimp_Instr* branch);
+static bool Shrimp_text_instr(Shrimp_TextParser* p, Shrimp_Module* mod, uint32_t index);
+static bool Shrimp_text_function(Shrimp_TextParser* p, Shrimp_Module* mod);
+static bool Shrimp_text_check_labels(const Shrimp_TextParser* p, const Shrimp_Function* func);
+static bool Shrimp_text_resolve_calls(Shrimp_TextParser* p, Shrimp_Module* mod);
+static char* Shrimp_text_name(Shrimp_TextParser* p);
+
+bool Shrimp_module_parse(const char* path, const char* text, size_t len, Shrimp_Module* out) {
+    Shrimp_TextParser p = {
+        .path = path,
+        .cur = text,
+        .end = text + len,
+        .line = 1,
+    };
+    Shrimp_Module mod = Shrimp_module_new("main");
+    while (p.cur < p.end) {
+        Shrimp_text_skip_ws(&p);
+        if (Shrimp_text_at_eol(&p)) {
+            Shrimp_text_next_line(&p);
+            continue;
+        }
+        if (!Shrimp_text_function(&p, &mod)) {
+            Shrimp_text_resolve_calls(&p, NULL);
+            Shrimp_module_cleanup(mod);
+            return false;
+        }
+    }
+    if (!Shrimp_text_resolve_calls(&p, &mod) || !Shrimp_module_verify(&mod)) {
+        Shrimp_module_cleanup(mod);
+        return false;
+    }
+    *out = mod;
+    return true;
+}
+
+static bool Shrimp_text_function(Shrimp_TextParser* p, Shrimp_Module* mod) {
+    bool exported = Shrimp_text_eat(p, "export");
+    if (!Shrimp_text_eat(p, "func")) {
+        Shrimp_text_error(p, "expected `func`");
+        return false;
+    }
+    // the names live for as long as the module is used, just like the ones handed in by the frontend
+    char* name = Shrimp_text_name(p);
+    if (name == NULL) return false;
+    if (Shrimp_module_find_function(mod, name) != SHRIMP_NO_FUNCTION) {
+        Shrimp_text_error(p, "function %s is defined more than once", name);
+        return false;
+    }
+    uint32_t index = mod->count;
+    Shrimp_Function* func = Shrimp_module_new_function(mod, name);
+    func->exported = exported;
+    if (!Shrimp_text_eat(p, "(")) {
+        Shrimp_text_error(p, "expected `(` after the function name");
+        return false;
+    }
+    while (!Shrimp_text_eat(p, ")")) {
+        if (func->param_count != 0 && !Shrimp_text_eat(p, ",")) {
+            Shrimp_text_error(p, "expected `,` or `)` after a param");
+            return false;
+        }
+        uint32_t param;
+        if (!Shrimp_text_temp(p, func, &param)) return false;
+        if (param != func->param_count) {
+            Shrimp_text_error(p, "param $%u of %s should be $%u, params are the first temps in order", param, name, func->param_count);
+            return false;
+        }
+        func->param_count++;
+    }
+    if (!Shrimp_text_eat(p, "{")) {
+        Shrimp_text_error(p, "expected `{` after the params");
+        return false;
+    }
+    Shrimp_text_skip_ws(p);
+    if (!Shrimp_text_at_eol(p)) {
+        Shrimp_text_error(p, "unexpected text after `{`");
+        return false;
+    }
+    Shrimp_text_next_line(p);
+
+    while (p->cur < p->end) {
+        Shrimp_text_skip_ws(p);
+        if (Shrimp_text_at_eol(p)) {
+            Shrimp_text_next_line(p);
+            continue;
+        }
+        if (Shrimp_text_eat(p, "}")) {
+            Shrimp_text_skip_ws(p);
+            if (!Shrimp_text_at_eol(p)) {
+                Shrimp_text_error(p, "unexpected text after `}`");
+                return false;
+            }
+            Shrimp_text_next_line(p);
+            return Shrimp_text_check_labels(p, func);
+        }
+        if (!Shrimp_text_instr(p, mod, index)) return false;
+        Shrimp_text_skip_ws(p);
+        if (!Shrimp_text_at_eol(p)) {
+            Shrimp_text_error(p, "unexpected text after the instruction");
+            return false;
+        }
+        Shrimp_text_next_line(p);
+    }
+    Shrimp_text_error(p, "missing `}` to close function %s", name);
+    return false;
+}
+
+static bool Shrimp_text_instr(Shrimp_TextParser* p, Shrimp_Module* mod, uint32_t index) {
+    Shrimp_Function* func = &mod->items[index];
+    Shrimp_Instr instr = {0};
+    if (Shrimp_text_eat(p, "return")) {
+        instr.t = SHRIMP_IT_RETURN;
+        if (!Shrimp_text_value(p, func, &instr.ret)) return false;
+    } else if (Shrimp_text_eat(p, "nop")) {
+        instr.t = SHRIMP_IT_NOP;
+    } else if (Shrimp_text_eat(p, "arg")) {
+        instr.t = SHRIMP_IT_ARG;
+        if (!Shrimp_text_value(p, func, &instr.arg)) return false;
+    } else if (Shrimp_text_eat(p, "jump_nz")) {
+        instr.t = SHRIMP_IT_JUMP_IF;
+        if (!Shrimp_text_value(p, func, &instr.jmp_if_not.cond)) return false;
+        if (!Shrimp_text_label(p, func, &instr.jmp_if_not.to)) return false;
+        if (!Shrimp_text_weights(p, &instr)) return false;
+    } else if (Shrimp_text_eat(p, "jump_z")) {
+        instr.t = SHRIMP_IT_JUMP_IF_NOT;
+        if (!Shrimp_text_value(p, func, &instr.jmp_if_not.cond)) return false;
+        if (!Shrimp_text_label(p, func, &instr.jmp_if_not.to)) return false;
+        if (!Shrimp_text_weights(p, &instr)) return false;
+    } else if (Shrimp_text_eat(p, "jump")) {
+        instr.t = SHRIMP_IT_JUMP;
+        if (!Shrimp_text_label(p, func, &instr.jmp.to)) return false;
+    } else if (p->cur < p->end && isdigit(*p->cur)) {
+        uint64_t label;
+        if (!Shrimp_text_number(p, &label)) return false;
+        if (!Shrimp_text_eat(p, ":")) {
+            Shrimp_text_error(p, "expected `:` after a label");
+            return false;
+        }
+        if (label >= UINT32_MAX) {
+            Shrimp_text_error(p, "label %lu is too big", label);
+            return false;
+        }
+        instr.t = SHRIMP_IT_LABEL;
+        instr.label = label;
+        if (func->label_count <= label) func->label_count = label + 1;
+    } else if (p->cur < p->end && *p->cur == '$') {
+        uint32_t into;
+        if (!Shrimp_text_temp(p, func, &into)) return false;
+        if (!Shrimp_text_eat(p, "<-")) {
+            Shrimp_text_error(p, "expected `<-` after the destination temp");
+            return false;
+        }
+        if (Shrimp_text_eat(p, "call")) {
+            char* callee = Shrimp_text_name(p);
+            if (callee == NULL) return false;
+            instr.t = SHRIMP_IT_CALL;
+            instr.call.result = into;
+            instr.call.func = SHRIMP_NO_FUNCTION;
+            for (size_t i = func->count; i-- > 0 && (func->items[i].t == SHRIMP_IT_ARG || func->items[i].t == SHRIMP_IT_NOP);) {
+                instr.call.argc += func->items[i].t == SHRIMP_IT_ARG;
+            }
+            Shrimp_TextCall call = {.func = index, .instr = func->count, .callee = callee, .line = p->line};
+            Shrimp_da_push(&p->calls, call);
+            Shrimp_function_push(func, instr);
+            return true;
+        }
+        Shrimp_Ref l;
+        if (!Shrimp_text_value(p, func, &l)) return false;
+        Shrimp_text_skip_ws(p);
+        if (Shrimp_text_at_eol(p)) {
+            instr.t = SHRIMP_IT_ASSIGN;
+            instr.assign.v = l;
+            instr.assign.into = into;
+        } else {
+            // the two character operators first so `<<` isn't taken for `<`
+            if (Shrimp_text_eat(p, "<<")) instr.t = SHRIMP_IT_SHL;
+            else if (Shrimp_text_eat(p, ">>")) instr.t = SHRIMP_IT_SHR;
+            else if (Shrimp_text_eat(p, "*h")) instr.t = SHRIMP_IT_MULHU;
+            else switch (*p->cur++) {
+                case '+': instr.t = SHRIMP_IT_ADD; break;
+                case '-': instr.t = SHRIMP_IT_SUB; break;
+                case '*': instr.t = SHRIMP_IT_MUL; break;
+                case '/': instr.t = SHRIMP_IT_DIV; break;
+                case '<': instr.t = SHRIMP_IT_CMP_LT; break;
+                case '>': instr.t = SHRIMP_IT_CMP_MT; break;
+                default: {
+                    Shrimp_text_error(p, "unknown operator `%c`", p->cur[-1]);
+                    return false;
+                }
+            }
+            instr.binop.l = l;
+            instr.binop.result = into;
+            if (!Shrimp_text_value(p, func, &instr.binop.r)) return false;
+        }
+    } else {
+        Shrimp_text_error(p, "unknown instruction");
+        return false;
+    }
+    Shrimp_function_push(func, instr);
+    return true;
+}
+
+static bool Shrimp_text_check_labels(const Shrimp_TextParser* p, const Shrimp_Function* func) {
+    bool* defined = calloc(func->label_count ? func->label_count : 1, sizeof(bool));
+    for (size_t i = 0; i < func->count; i++) {
+        if (func->items[i].t != SHRIMP_IT_LABEL) continue;
+        if (defined[func->items[i].label]) {
+            Shrimp_text_error(p, "label %u is defined more than once in %s", func->items[i].label, func->name);
+            free(defined);
+            return false;
+        }
+        defined[func->items[i].label] = true;
+    }
+    for (size_t i = 0; i < func->count; i++) {
+        const Shrimp_Instr* instr = &func->items[i];
+        Shrimp_Label to;
+        if (instr->t == SHRIMP_IT_JUMP) to = instr->jmp.to;
+        else if (instr->t == SHRIMP_IT_JUMP_IF_NOT || instr->t == SHRIMP_IT_JUMP_IF) to = instr->jmp_if_not.to;
+        else continue;
+        if (!defined[to]) {
+            Shrimp_text_error(p, "jump to label %u which is never defined in %s", to, func->name);
+            free(defined);
+            return false;
+        }
+    }
+    free(defined);
+    return true;
+}
+
+// Points the calls at their callees and forgets them, with a NULL module it only does the latter
+static bool Shrimp_text_resolve_calls(Shrimp_TextParser* p, Shrimp_Module* mod) {
+    bool ok = true;
+    for (size_t i = 0; i < p->calls.count; i++) {
+        Shrimp_TextCall* call = &p->calls.items[i];
+        if (mod != NULL && ok) {
+            uint32_t callee = Shrimp_module_find_function(mod, call->callee);
+            if (callee == SHRIMP_NO_FUNCTION) {
+                p->line = call->line;
+                Shrimp_text_error(p, "call to function %s which is never defined", call->callee);
+                ok = false;
+            } else {
+                mod->items[call->func].items[call->instr].call.func = callee;
+            }
+        }
+        free(call->callee);
+    }
+    Shrimp_da_free(&p->calls);
+    p->calls = (Shrimp_TextCalls){0};
+    return ok;
+}
+
+static char* Shrimp_text_name(Shrimp_TextParser* p) {
+    Shrimp_text_skip_ws(p);
+    const char* begin = p->cur;
+    while (p->cur < p->end && (isalnum(*p->cur) || *p->cur == '_' || *p->cur == '.')) p->cur++;
+    if (p->cur == begin) {
+        Shrimp_text_error(p, "expected a function name");
+        return NULL;
+    }
+    return strndup(begin, p->cur - begin);
+}
+
+static bool Shrimp_text_value(Shrimp_TextParser* p, Shrimp_Function* func, Shrimp_Ref* out) {
+    Shrimp_text_skip_ws(p);
+    if (p->cur < p->end && *p->cur == '$') {
+        uint32_t t;
+        if (!Shrimp_text_temp(p, func, &t)) return false;
+        *out = t;
+        return true;
+    }
+    uint64_t c;
+    if (!Shrimp_text_number(p, &c)) return false;
+    *out = Shrimp_function_const_ref(func, c);
+    return true;
+}
+
+static bool Shrimp_text_temp(Shrimp_TextParser* p, Shrimp_Function* func, uint32_t* out) {
+    Shrimp_text_skip_ws(p);
+    if (p->cur >= p->end || *p->cur != '$') {
+        Shrimp_text_error(p, "expected a temp");
+        return false;
+    }
+    p->cur++;
+    uint64_t index;
+    if (!Shrimp_text_number(p, &index)) return false;
+    if (index >= SHRIMP_TEXT_MAX_TEMPS) {
+        Shrimp_text_error(p, "temp $%lu is too big, functions can have at most %u temps", index, SHRIMP_TEXT_MAX_TEMPS);
+        return false;
+    }
+    while (func->temps.count <= index) Shrimp_function_alloc_temp(func, 8);
+    if (p->cur < p->end && *p->cur == ':') {
+        p->cur++;
+        uint64_t size;
+        if (!Shrimp_text_number(p, &size)) return false;
+        if (size != 1 && size != 2 && size != 4 && size != 8) {
+            Shrimp_text_error(p, "temp $%lu can't be %lu bytes, only 1, 2, 4 or 8", index, size);
+            return false;
+        }
+        // it keeps the 8 byte slot it got allocated with, like the temps the range pass narrows
+        Shrimp_Temp* temp = &func->temps.items[index];
+        if (temp->size != 8 && temp->size != size) {
+            Shrimp_text_error(p, "temp $%lu was %u bytes before and is %lu bytes here", index, temp->size, size);
+            return false;
+        }
+        temp->size = size;
+    }
+    *out = index;
+    return true;
+}
+
+static bool Shrimp_text_label(Shrimp_TextParser* p, Shrimp_Function* func, Shrimp_Label* out) {
+    if (!Shrimp_text_eat(p, "@")) {
+        Shrimp_text_error(p, "expected a label reference like `@0`");
+        return false;
+    }
+    uint64_t label;
+    if (!Shrimp_text_number(p, &label)) return false;
+    if (label >= UINT32_MAX) {
+        Shrimp_text_error(p, "label %lu is too big", label);
+        return false;
+    }
+    if (func->label_count <= label) func->label_count = label + 1;
+    *out = label;
+    return true;
+}
+
+// The optional `weights <taken>:<not taken>` after a conditional jump
+static bool Shrimp_text_weights(Shrimp_TextParser* p, Shrimp_Instr* branch) {
+    if (!Shrimp_text_eat(p, "weights")) return true;
+    uint64_t taken, not_taken;
+    if (!Shrimp_text_number(p, &taken)) return false;
+    if (!Shrimp_text_eat(p, ":")) {
+        Shrimp_text_error(p, "expected `:` between the weights");
+        return false;
+    }
+    if (!Shrimp_text_number(p, &not_taken)) return false;
+    if (taken > UINT16_MAX || not_taken > UINT16_MAX) {
+        Shrimp_text_error(p, "weights can't be bigger than %u", UINT16_MAX);
+        return false;
+    }
+    branch->jmp_if_not.taken = taken;
+    branch->jmp_if_not.not_taken = not_taken;
+    return true;
+}
+
+static bool Shrimp_text_number(Shrimp_TextParser* p, uint64_t* out) {
+    Shrimp_text_skip_ws(p);
+    if (p->cur >= p->end || !isdigit(*p->cur)) {
+        Shrimp_text_error(p, "expected a number");
+        return false;
+    }
+    uint64_t n = 0;
+    while (p->cur < p->end && isdigit(*p->cur)) {
+        uint64_t digit = *p->cur - '0';
+        if (n > (UINT64_MAX - digit) / 10) {
+            Shrimp_text_error(p, "number doesn't fit into 64 bits");
+            return false;
+        }
+        n = n * 10 + digit;
+        p->cur++;
+    }
+    *out = n;
+    return true;
+}
+
+static bool Shrimp_text_eat(Shrimp_TextParser* p, const char* s) {
+    Shrimp_text_skip_ws(p);
+    size_t len = strlen(s);
+    if ((size_t)(p->end - p->cur) < len || strncmp(p->cur, s, len) != 0) return false;
+    // keywords have to end there, so `jump_z` doesn't get read as `jump` followed by garbage
+    if (isalpha(s[len - 1]) && p->cur + len < p->end && (isalnum(p->cur[len]) || p->cur[len] == '_')) return false;
+    p->cur += len;
+    return true;
+}
+
+static void Shrimp_text_skip_ws(Shrimp_TextParser* p) {
+    while (p->cur < p->end && (*p->cur == ' ' || *p->cur == '\t' || *p->cur == '\r')) p->cur++;
+}
+
+static bool Shrimp_text_at_eol(Shrimp_TextParser* p) {
+    return p->cur >= p->end || *p->cur == '\n' || *p->cur == '#';
+}
+
+static void Shrimp_text_next_line(Shrimp_TextParser* p) {
+    while (p->cur < p->end && *p->cur != '\n') p->cur++;
+    if (p->cur < p->end) p->cur++;
+    p->line++;
+}
+
+static void Shrimp_text_error(const Shrimp_TextParser* p, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "[ERROR]: %s:%zu: ", p->path, p->line);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
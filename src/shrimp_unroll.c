@@ -0,0 +1,248 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Loop unrolling
+//
+// Only counted loops (see Shrimp_CountedLoop) laid out the way while loops are get unrolled: the header with
+// the test first, the body after it in one piece, ending in the only jump back to the header, and the label
+// the test jumps to right after that. Nothing else may leave the loop.
+//
+// With a known trip count T and T copies of the body fitting the threshold the loop goes away completely:
+// the copies follow each other and the header runs once more at the end for what it computes besides the test.
+//
+// Otherwise it's unrolled by a factor U. The main loop runs U rounds per test with `i < n - (U-1)*c` (or 0 if
+// that would wrap), which makes sure all of them would have passed the original test. What's left are less
+// than U rounds, done by U-1 copies of the loop that each keep the test. Since the header runs twice when
+// the main loop is left, everything it computes has to give the same result when repeated. When the profile
+// says the loop is usually left before U rounds it isn't unrolled by a factor at all.
+//
+// Less than U rounds being left only holds when the counter can't wrap around past n, which it can once
+// n + c - 1 doesn't fit in 64 bits. Such a constant n isn't unrolled by a factor, for a temp the original
+// loop stays in front of the unrolled one and runs instead when n is that big.
+
+// how many instructions an unrolled loop may grow to when the options don't say
+#define SHRIMP_UNROLL_THRESHOLD 64
+#define SHRIMP_UNROLL_MAX_FACTOR 8
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    Shrimp_Loops loops;
+    size_t threshold;
+
+    // the loop being unrolled, [begin, end) are its instructions and the header is [begin, header_end)
+    uint32_t begin;
+    uint32_t header_end;
+    uint32_t end;
+    // new labels for the ones inside of the body, indexed by the old ones
+    Shrimp_Label* labels;
+} Shrimp_Unroll;
+
+// Appends the instructions in [from, to) leaving out the header's label, the jump back and the test's jump
+// unless `keep_test` is set, the labels in there get fresh ones
+static void Shrimp_unroll_copy(Shrimp_Unroll* u, Shrimp_InstrBuf* out, uint32_t from, uint32_t to, bool keep_test) {
+    Shrimp_Function* f = u->func;
+    for (uint32_t i = from; i < to; i++) {
+        if (f->items[i].t == SHRIMP_IT_LABEL && i != u->begin) u->labels[f->items[i].label] = Shrimp_function_label_alloc(f);
+    }
+    for (uint32_t i = from; i < to; i++) {
+        Shrimp_Instr instr = f->items[i];
+        if (instr.t == SHRIMP_IT_NOP || i == u->begin || i == u->end - 1) continue;
+        if (i == u->header_end - 1 && !keep_test) continue;
+        if (instr.t == SHRIMP_IT_LABEL) instr.label = u->labels[instr.label];
+        // only the test leaves the loop and only the jump back goes to the header, everything else stays inside
+        if (instr.t == SHRIMP_IT_JUMP) instr.jmp.to = u->labels[instr.jmp.to];
+        if (Shrimp_instr_is_branch(instr.t) && i != u->header_end - 1) instr.jmp_if_not.to = u->labels[instr.jmp_if_not.to];
+        Shrimp_da_push(out, instr);
+    }
+}
+
+static size_t Shrimp_unroll_size(const Shrimp_Unroll* u) {
+    size_t size = 0;
+    for (uint32_t i = u->begin; i < u->end; i++) {
+        uint8_t t = u->func->items[i].t;
+        size += t != SHRIMP_IT_NOP && t != SHRIMP_IT_LABEL;
+    }
+    return size;
+}
+
+// Whether running the header twice in a row leaves everything like running it once
+static bool Shrimp_unroll_header_repeatable(const Shrimp_Unroll* u) {
+    Shrimp_Function* f = u->func;
+    for (uint32_t i = u->begin; i < u->header_end; i++) {
+        Shrimp_Ref* ops[2];
+        size_t n = Shrimp_instr_operands(&f->items[i], ops);
+        for (size_t o = 0; o < n; o++) {
+            if (SHRIMP_REF_IS_CONST(*ops[o])) continue;
+            // a read of something written at or after it sees what the previous run left behind
+            for (uint32_t j = i; j < u->header_end; j++) {
+                uint32_t def;
+                if (Shrimp_instr_def(&f->items[j], &def) && def == *ops[o]) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether the loop has the shape described at the top of the file, fills in begin, header_end and end
+static bool Shrimp_unroll_shape(Shrimp_Unroll* u, const Shrimp_Loop* loop) {
+    const Shrimp_CFG* cfg = &u->cfg;
+    uint32_t latch = loop->header + loop->blocks.count - 1;
+    if (latch >= cfg->count) return false;
+    for (uint32_t b = loop->header; b <= latch; b++) {
+        if (!loop->contains[b]) return false;
+        // the header's exit is checked by Shrimp_loop_counted
+        if (b == loop->header) continue;
+        for (size_t s = 0; s < cfg->items[b].succ_count; s++) {
+            if (!loop->contains[cfg->items[b].succs[s]]) return false;
+        }
+    }
+    const Shrimp_Block* header = &cfg->items[loop->header];
+    for (size_t p = 0; p < header->preds.count; p++) {
+        if (loop->contains[header->preds.items[p]] && header->preds.items[p] != latch) return false;
+    }
+    const Shrimp_Instr* back = Shrimp_cfg_terminator(u->func, cfg, latch);
+    if (back == NULL || back->t != SHRIMP_IT_JUMP || cfg->label_block[back->jmp.to] != loop->header) return false;
+    // the header ends in the test, so the body starts with a new block and the jump back is the latch's last
+    const Shrimp_Instr* test = Shrimp_cfg_terminator(u->func, cfg, loop->header);
+    if (cfg->label_block[test->jmp_if_not.to] != latch + 1) return false;
+    if (u->func->items[header->begin].t != SHRIMP_IT_LABEL) return false;
+
+    u->begin = header->begin;
+    u->header_end = header->end;
+    u->end = cfg->items[latch].end;
+    return true;
+}
+
+// Writes the main loop of the partial unrolling and the copies doing what it leaves over
+static void Shrimp_unroll_partial(Shrimp_Unroll* u, const Shrimp_CountedLoop* counted, size_t factor, Shrimp_InstrBuf* out) {
+    Shrimp_Function* f = u->func;
+    Shrimp_Label main_loop = Shrimp_function_label_alloc(f);
+    Shrimp_Label rest = Shrimp_function_label_alloc(f);
+    uint64_t ahead = (factor - 1) * counted->step;
+
+    if (!SHRIMP_REF_IS_CONST(counted->limit) && counted->step > 1) {
+        // n > 2^64 - c keeps the loop rolled, it's left where it is so it isn't in the shape unrolled again
+        Shrimp_Label rolled = Shrimp_function_label_alloc(f);
+        Shrimp_Label unrolled = Shrimp_function_label_alloc(f);
+        uint32_t wraps = Shrimp_function_alloc_temp(f, 8).t;
+        Shrimp_Ref largest = Shrimp_function_const_ref(f, UINT64_MAX - counted->step + 1);
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_CMP_MT, .binop = {.l = counted->limit, .r = largest, .result = wraps}}));
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_JUMP_IF_NOT, .jmp_if_not = {.cond = wraps, .to = unrolled}}));
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = rolled}));
+        Shrimp_unroll_copy(u, out, u->begin, u->end, true);
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = rolled}}));
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = unrolled}));
+    }
+
+    // lim = n < ahead ? 0 : n - ahead
+    Shrimp_Ref limit;
+    if (SHRIMP_REF_IS_CONST(counted->limit)) {
+        uint64_t n = Shrimp_function_const(f, counted->limit);
+        limit = Shrimp_function_const_ref(f, n < ahead ? 0 : n - ahead);
+    } else {
+        uint32_t small = Shrimp_function_alloc_temp(f, 8).t;
+        uint32_t keep = Shrimp_function_alloc_temp(f, 8).t;
+        uint32_t diff = Shrimp_function_alloc_temp(f, 8).t;
+        limit = Shrimp_function_alloc_temp(f, 8).t;
+        Shrimp_Ref ahead_ref = Shrimp_function_const_ref(f, ahead);
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_CMP_LT, .binop = {.l = counted->limit, .r = ahead_ref, .result = small}}));
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_SUB, .binop = {.l = Shrimp_function_const_ref(f, 1), .r = small, .result = keep}}));
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_SUB, .binop = {.l = counted->limit, .r = ahead_ref, .result = diff}}));
+        Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_MUL, .binop = {.l = diff, .r = keep, .result = limit}}));
+    }
+
+    uint32_t test = Shrimp_function_alloc_temp(f, 8).t;
+    Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = main_loop}));
+    for (size_t i = 0; i < factor; i++) {
+        Shrimp_unroll_copy(u, out, u->begin, u->header_end, false);
+        if (i == 0) {
+            Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_CMP_LT, .binop = {.l = counted->counter, .r = limit, .result = test}}));
+            // leaves as often as the original test but passes only once per `factor` of its rounds
+            const Shrimp_Instr* original = &f->items[u->header_end - 1];
+            Shrimp_Instr leave = {.t = SHRIMP_IT_JUMP_IF_NOT, .jmp_if_not = {.cond = test, .to = rest}};
+            if (SHRIMP_BRANCH_HAS_WEIGHTS(original)) {
+                leave.jmp_if_not.taken = original->jmp_if_not.taken;
+                leave.jmp_if_not.not_taken = original->jmp_if_not.not_taken / factor + 1;
+            }
+            Shrimp_da_push(out, leave);
+        }
+        Shrimp_unroll_copy(u, out, u->header_end, u->end, false);
+    }
+    Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = main_loop}}));
+
+    Shrimp_da_push(out, ((Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = rest}));
+    for (size_t i = 0; i + 1 < factor; i++) Shrimp_unroll_copy(u, out, u->begin, u->end, true);
+}
+
+static bool Shrimp_unroll_loop(Shrimp_Unroll* u, const Shrimp_Loop* loop) {
+    Shrimp_Function* f = u->func;
+    Shrimp_CountedLoop counted;
+    if (!Shrimp_loop_counted(f, &u->cfg, &u->loops, loop, &counted) || !counted.every_round) return false;
+    if (!Shrimp_unroll_shape(u, loop)) return false;
+
+    size_t size = Shrimp_unroll_size(u);
+    uint64_t trips;
+    bool full = Shrimp_loop_trip_count(f, &u->cfg, loop, &counted, &trips) && trips <= u->threshold / size;
+    size_t factor = SHRIMP_UNROLL_MAX_FACTOR;
+    // the main loop has `factor` copies and the rest one less
+    while (factor >= 2 && (2 * factor - 1) * size > u->threshold) factor /= 2;
+    if (!full && (factor < 2 || !Shrimp_unroll_header_repeatable(u))) return false;
+    // the counter could wrap around and keep going after what's left over
+    if (!full && SHRIMP_REF_IS_CONST(counted.limit) && ((unsigned __int128)Shrimp_function_const(f, counted.limit) + counted.step - 1) >> 64) return false;
+    // the test jumps out of the loop, when the profile says it's left before the main loop would get through a
+    // single round (or never ran at all) unrolling only makes it bigger
+    const Shrimp_Instr* test = &f->items[u->header_end - 1];
+    if (!full && SHRIMP_BRANCH_HAS_WEIGHTS(test) && test->jmp_if_not.not_taken < factor * test->jmp_if_not.taken) return false;
+
+    Shrimp_InstrBuf out = {0};
+    Shrimp_da_push(&out, f->items[u->begin]);
+    if (full) {
+        for (uint64_t i = 0; i < trips; i++) Shrimp_unroll_copy(u, &out, u->begin, u->end, false);
+    } else {
+        Shrimp_unroll_partial(u, &counted, factor, &out);
+    }
+    // the header runs once more when the loop is left
+    Shrimp_unroll_copy(u, &out, u->begin, u->header_end, false);
+
+    for (uint32_t i = u->begin; i < u->end; i++) {
+        if (f->items[i].t != SHRIMP_IT_NOP) Shrimp_function_remove_instr(f, i);
+    }
+    Shrimp_function_insert(f, u->begin, out.items, out.count);
+    Shrimp_da_free(&out);
+    return true;
+}
+
+static bool Shrimp_unroll_round(Shrimp_Function* f, size_t threshold) {
+    Shrimp_Unroll u = {.func = f, .threshold = threshold};
+    Shrimp_cfg_build(f, &u.cfg);
+    Shrimp_cfg_dominators(&u.cfg);
+    Shrimp_cfg_loops(&u.cfg, &u.loops);
+    u.labels = malloc(sizeof(Shrimp_Label) * (f->label_count + 1));
+
+    bool changed = false;
+    for (size_t l = 0; l < u.loops.count && !changed; l++) changed = Shrimp_unroll_loop(&u, &u.loops.items[l]);
+
+    free(u.labels);
+    Shrimp_loops_free(&u.loops);
+    Shrimp_cfg_free(&u.cfg);
+    return changed;
+}
+
+bool Shrimp_module_unroll(Shrimp_Module* mod) {
+    size_t threshold = mod->unroll_threshold != 0 ? mod->unroll_threshold : SHRIMP_UNROLL_THRESHOLD;
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        // the main loop of an unrolled one steps several times per round and isn't counted anymore, so every
+        // round gets rid of a counted loop, this only guards against a bug looping forever
+        for (size_t rounds = 0; rounds < f->count && Shrimp_unroll_round(f, threshold); rounds++) {
+            Shrimp_function_compact(f);
+            changed = true;
+        }
+    }
+    return changed;
+}
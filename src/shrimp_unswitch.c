@@ -0,0 +1,162 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <stdlib.h>
+
+// Loop unswitching
+//
+// A conditional jump in a loop whose condition isn't written anywhere in the loop goes the same way in every
+// round. The test is taken out in front of the loop and the loop is duplicated, one version for either
+// outcome with the jump turned into what it does then:
+//     G: jump_z c @F           (in the preheader)
+//     H: ...loop with the jump always or never taken...
+//        jump @C
+//     F: ...copy with the other way...
+//     C:
+// Only loops whose blocks follow each other from the header on are duplicated, so the copy is one piece of
+// code. The jumps in it to labels in the loop go to the copy's own ones, the ones leaving the loop stay.
+// Either version keeps the jumps on other invariant conditions, they get taken out in later rounds as long as
+// the budget lasts: every copy counts against how many instructions a function may grow by.
+//
+// Whatever is left unreachable by the now unconditional jumps is cleaned up by dead code elimination.
+
+// how many instructions unswitching may add to a function when the options don't say
+#define SHRIMP_UNSWITCH_THRESHOLD 64
+
+typedef struct {
+    Shrimp_Function* func;
+    Shrimp_CFG cfg;
+    Shrimp_Loops loops;
+    // the instructions of the loop being looked at
+    uint32_t begin;
+    uint32_t end;
+} Shrimp_Unswitch;
+
+// Whether the loop's blocks come one after the other starting at its header, fills in begin and end
+// Unreachable blocks in between, like the ones an earlier round left behind, just get copied along
+static bool Shrimp_unswitch_contiguous(Shrimp_Unswitch* u, const Shrimp_Loop* loop) {
+    uint32_t last = loop->header;
+    for (size_t found = 1; found < loop->blocks.count;) {
+        if (++last >= u->cfg.count) return false;
+        if (loop->contains[last]) found++;
+        else if (u->cfg.idom[last] != SHRIMP_NO_BLOCK) return false;
+    }
+    u->begin = u->cfg.items[loop->header].begin;
+    u->end = u->cfg.items[last].end;
+    return u->func->items[u->begin].t == SHRIMP_IT_LABEL;
+}
+
+// The first conditional jump in the loop testing something the loop never writes, SHRIMP_NO_INSTR if there's none
+static uint32_t Shrimp_unswitch_find(const Shrimp_Unswitch* u) {
+    const Shrimp_Function* f = u->func;
+    for (uint32_t i = u->begin; i < u->end; i++) {
+        if (!Shrimp_instr_is_branch(f->items[i].t)) continue;
+        // constant conditions are left to sccp
+        Shrimp_Ref cond = f->items[i].jmp_if_not.cond;
+        if (SHRIMP_REF_IS_CONST(cond)) continue;
+        const Shrimp_InstrList* defs = &f->uses.items[cond].defs;
+        bool invariant = true;
+        for (size_t d = 0; d < defs->count && invariant; d++) invariant = defs->items[d] < u->begin || defs->items[d] >= u->end;
+        if (invariant) return i;
+    }
+    return SHRIMP_NO_INSTR;
+}
+
+static size_t Shrimp_unswitch_size(const Shrimp_Unswitch* u) {
+    size_t size = 0;
+    for (uint32_t i = u->begin; i < u->end; i++) {
+        uint8_t t = u->func->items[i].t;
+        size += t != SHRIMP_IT_NOP && t != SHRIMP_IT_LABEL;
+    }
+    return size;
+}
+
+// What the conditional jump turns into when its condition is always `cond`, a NOP if that's falling through
+static Shrimp_Instr Shrimp_unswitch_resolve(const Shrimp_Instr* branch, bool cond) {
+    bool taken = (branch->t == SHRIMP_IT_JUMP_IF) == cond;
+    if (!taken) return (Shrimp_Instr){.t = SHRIMP_IT_NOP};
+    return (Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = branch->jmp_if_not.to}};
+}
+
+static bool Shrimp_unswitch_loop(Shrimp_Unswitch* u, const Shrimp_Loop* loop, size_t* budget) {
+    Shrimp_Function* f = u->func;
+    if (!Shrimp_unswitch_contiguous(u, loop) || !Shrimp_loop_has_preheader(f, &u->cfg, loop)) return false;
+    uint32_t at = Shrimp_unswitch_find(u);
+    if (at == SHRIMP_NO_INSTR) return false;
+    size_t size = Shrimp_unswitch_size(u);
+    if (size > *budget) return false;
+    *budget -= size;
+
+    Shrimp_Instr branch = f->items[at];
+    Shrimp_Label copy = Shrimp_function_label_alloc(f);
+    Shrimp_Label after = Shrimp_function_label_alloc(f);
+    Shrimp_Instr guard = {.t = SHRIMP_IT_JUMP_IF_NOT, .jmp_if_not = {.cond = branch.jmp_if_not.cond, .to = copy}};
+    // the guard goes to the copy when the condition is 0, which is how often the loop's jump went that way
+    if (SHRIMP_BRANCH_HAS_WEIGHTS(&branch)) {
+        bool same = branch.t == SHRIMP_IT_JUMP_IF_NOT;
+        guard.jmp_if_not.taken = same ? branch.jmp_if_not.taken : branch.jmp_if_not.not_taken;
+        guard.jmp_if_not.not_taken = same ? branch.jmp_if_not.not_taken : branch.jmp_if_not.taken;
+    }
+    size_t moved = Shrimp_loop_insert_preheader(f, &u->cfg, loop, &guard, 1);
+    u->begin += moved;
+    u->end += moved;
+    at += moved;
+
+    // the labels placed in the loop get fresh ones in the copy, the rest stay
+    Shrimp_Label* labels = malloc(sizeof(Shrimp_Label) * (f->label_count + 1));
+    Shrimp_Label label_count = f->label_count;
+    for (Shrimp_Label l = 0; l < label_count; l++) labels[l] = l;
+    for (uint32_t i = u->begin; i < u->end; i++) {
+        if (f->items[i].t == SHRIMP_IT_LABEL) labels[f->items[i].label] = Shrimp_function_label_alloc(f);
+    }
+
+    Shrimp_InstrBuf out = {0};
+    Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_JUMP, .jmp = {.to = after}}));
+    Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = copy}));
+    for (uint32_t i = u->begin; i < u->end; i++) {
+        Shrimp_Instr instr = i == at ? Shrimp_unswitch_resolve(&branch, false) : f->items[i];
+        if (instr.t == SHRIMP_IT_NOP) continue;
+        if (instr.t == SHRIMP_IT_LABEL) instr.label = labels[instr.label];
+        else if (instr.t == SHRIMP_IT_JUMP) instr.jmp.to = labels[instr.jmp.to];
+        else if (Shrimp_instr_is_branch(instr.t)) instr.jmp_if_not.to = labels[instr.jmp_if_not.to];
+        Shrimp_da_push(&out, instr);
+    }
+    Shrimp_da_push(&out, ((Shrimp_Instr){.t = SHRIMP_IT_LABEL, .label = after}));
+
+    Shrimp_Instr taken = Shrimp_unswitch_resolve(&branch, true);
+    if (taken.t == SHRIMP_IT_NOP) Shrimp_function_remove_instr(f, at);
+    else Shrimp_function_set_instr(f, at, taken);
+    Shrimp_function_insert(f, u->end, out.items, out.count);
+    Shrimp_da_free(&out);
+    free(labels);
+    return true;
+}
+
+static bool Shrimp_unswitch_round(Shrimp_Function* f, size_t* budget) {
+    Shrimp_Unswitch u = {.func = f};
+    Shrimp_cfg_build(f, &u.cfg);
+    Shrimp_cfg_dominators(&u.cfg);
+    Shrimp_cfg_loops(&u.cfg, &u.loops);
+
+    bool changed = false;
+    for (size_t l = 0; l < u.loops.count && !changed; l++) changed = Shrimp_unswitch_loop(&u, &u.loops.items[l], budget);
+
+    Shrimp_loops_free(&u.loops);
+    Shrimp_cfg_free(&u.cfg);
+    return changed;
+}
+
+bool Shrimp_module_unswitch(Shrimp_Module* mod) {
+    size_t threshold = mod->unswitch_threshold != 0 ? mod->unswitch_threshold : SHRIMP_UNSWITCH_THRESHOLD;
+    bool changed = false;
+    for (size_t i = 0; i < mod->count; i++) {
+        Shrimp_Function* f = &mod->items[i];
+        if (!Shrimp_function_has_uses(f)) Shrimp_function_build_uses(f);
+        // every round takes from the budget, this only guards against a bug looping forever
+        size_t budget = threshold;
+        for (size_t rounds = 0; rounds < f->count && Shrimp_unswitch_round(f, &budget); rounds++) {
+            Shrimp_function_compact(f);
+            changed = true;
+        }
+    }
+    return changed;
+}
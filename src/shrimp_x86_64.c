@@ -0,0 +1,512 @@
+#include "shrimp.h"
+#include "shrimp_internal.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool Shrimp_module_x86_64_nasm_linux_compile(const Shrimp_Module* mod, Shrimp_CompOptions opts) {
+    char asm_path[256] = {0};
+    char o_path[256] = {0};
+    snprintf(asm_path, sizeof(asm_path), "%s.asm", opts.output_name);
+    snprintf(o_path, sizeof(o_path), "%s.o", opts.output_name);
+
+    FILE* asm_file = fopen(asm_path, "wb");
+
+    if (!Shrimp_module_x86_64_dump_nasm_mod(mod, asm_file)) {
+        fprintf(stderr, "[ERROR]: Failed to generate assembly\n");
+        return false;
+    }
+
+    fclose(asm_file);
+
+    if (opts.output_kind == SHRIMP_OUTPUT_ASM) {
+        fprintf(stderr, "[INFO]: Generated %s\n", asm_path);
+        return true;
+    }
+
+    // TODO: Don't use system here
+    char command_buffer[1024] = {0};
+    snprintf(command_buffer, sizeof(command_buffer), "nasm %s -felf64 -o %s", asm_path, o_path);
+    system(command_buffer);
+
+    if (opts.output_kind == SHRIMP_OUTPUT_OBJ) {
+        fprintf(stderr, "[INFO]: Generated %s\n", o_path);
+        return true;
+    }
+    memset(command_buffer, 0, sizeof(command_buffer));
+    snprintf(command_buffer, sizeof(command_buffer), "ld %s -o %s", o_path, opts.output_name);
+    system(command_buffer);
+    fprintf(stderr, "[INFO]: Generated %s\n", opts.output_name);
+    return true;
+}
+
+const char* Shrimp_x86_64_nasm_sized_reg(const char* init_reg, size_t size) {
+    if (size != 1 && size != 2 && size != 4 && size != 8) {
+        fprintf(stderr, "Invalid size: %zu. Must be a power of 2 and less or equal to 8.\n", size);
+        return NULL;
+    }
+    size_t index = (size_t)log2(size);
+    const char* rax[4] = {"al", "ax", "eax", "rax"};
+    const char* rbx[4] = {"bl", "bx", "ebx", "rbx"};
+    const char* rcx[4] = {"cl", "cx", "ecx", "rcx"};
+    const char* rdx[4] = {"dl", "dx", "edx", "rdx"};
+    const char* rsi[4] = {"sil", "si", "esi", "rsi"};
+    const char* rdi[4] = {"dil", "di", "edi", "rdi"};
+    const char* r8[4] = {"r8b", "r8w", "r8d", "r8"};
+    const char* r9[4] = {"r9b", "r9w", "r9d", "r9"};
+    const char* r10[4] = {"r10b", "r10w", "r10d", "r10"};
+    const char* r11[4] = {"r11b", "r11w", "r11d", "r11"};
+    const char* r12[4] = {"r12b", "r12w", "r12d", "r12"};
+    const char* r13[4] = {"r13b", "r13w", "r13d", "r13"};
+    const char* r14[4] = {"r14b", "r14w", "r14d", "r14"};
+    const char* r15[4] = {"r15b", "r15w", "r15d", "r15"};
+    if (strcmp(init_reg, "rax") == 0) return rax[index];
+    if (strcmp(init_reg, "rbx") == 0) return rbx[index];
+    if (strcmp(init_reg, "rcx") == 0) return rcx[index];
+    if (strcmp(init_reg, "rdx") == 0) return rdx[index];
+    if (strcmp(init_reg, "rsi") == 0) return rsi[index];
+    if (strcmp(init_reg, "rdi") == 0) return rdi[index];
+    if (strcmp(init_reg, "r8") == 0) return r8[index];
+    if (strcmp(init_reg, "r9") == 0) return r9[index];
+    if (strcmp(init_reg, "r10") == 0) return r10[index];
+    if (strcmp(init_reg, "r11") == 0) return r11[index];
+    if (strcmp(init_reg, "r12") == 0) return r12[index];
+    if (strcmp(init_reg, "r13") == 0) return r13[index];
+    if (strcmp(init_reg, "r14") == 0) return r14[index];
+    if (strcmp(init_reg, "r15") == 0) return r15[index];
+    fprintf(stderr, "[FATAL DIE ERROR]: What kinda register did you pass in??? %s\n", init_reg);
+    return NULL;
+}
+
+const char* Shrimp_x86_64_nasm_mem_op_prefix(size_t size) {
+    switch (size) {
+        case 1: return "byte";
+        case 2: return "word";
+        case 4: return "dword";
+        case 8: return "qword";
+        default: {
+            fprintf(stderr, "Invalid size: %zu. Must be a power of 2 and less or equal to 8.\n", size);
+            return NULL;
+        }
+    }
+}
+
+// Calls between functions of the module pass their first arguments in registers and the rest on the stack,
+// the first one right above the return address, and return in rax. Exported functions follow the SysV AMD64
+// convention so they can be called from C, the internal one passes two more arguments in r10 and r11. Both
+// only use registers that are caller saved in SysV, an exported function has nothing to preserve but rbp
+// since no temp is kept in a register.
+// Functions that make calls keep the usual frame with rbp pointing at the saved one, so debuggers and profilers
+// can walk it, and their temps under that. Functions that make no calls don't set up rbp, their temps are
+// addressed from rsp and live in the red zone under it when they fit.
+// Calls in tail position don't grow the stack: a function calling itself jumps back to where its params are
+// stored and any other callee is jumped to once the frame is gone, returning straight to the caller's caller.
+// The params are copied into temps on entry, so the stack arguments go into the slots the function got its own
+// in, which only works when the callee doesn't take more of them than that. So that isn't guaranteed: a callee
+// with more stack params is really called, with a warning since recursion through it can run out of stack.
+// The entry has to exit, its calls stay calls.
+static const char* Shrimp_x86_64_sysv_args[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+static const char* Shrimp_x86_64_internal_args[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9", "r10", "r11"};
+
+// what signal handlers leave alone under rsp
+#define SHRIMP_X86_64_RED_ZONE 128
+
+typedef struct {
+    const Shrimp_Function* f;
+    // without one the temps are addressed from rsp
+    bool frame_pointer;
+    // how far rsp is moved down on entry
+    size_t size;
+} Shrimp_X86_64_Frame;
+
+static size_t Shrimp_x86_64_nasm_arg_regs(const Shrimp_Function* f, const char*** regs) {
+    if (f->exported) {
+        *regs = Shrimp_x86_64_sysv_args;
+        return sizeof(Shrimp_x86_64_sysv_args) / sizeof(*Shrimp_x86_64_sysv_args);
+    }
+    *regs = Shrimp_x86_64_internal_args;
+    return sizeof(Shrimp_x86_64_internal_args) / sizeof(*Shrimp_x86_64_internal_args);
+}
+
+// The entry point is the function called _start, it exits the process with what it returns
+static bool Shrimp_x86_64_nasm_is_entry(const Shrimp_Function* f) {
+    return strcmp(f->name, "_start") == 0;
+}
+
+static Shrimp_X86_64_Frame Shrimp_x86_64_nasm_frame(const Shrimp_Function* f) {
+    bool leaf = !Shrimp_x86_64_nasm_is_entry(f);
+    for (size_t i = 0; i < f->count && leaf; i++) leaf = f->items[i].t != SHRIMP_IT_CALL;
+    // the temps go down from the top of the frame, the one at offset 0 ends right under it
+    size_t size = (f->current_offset + 7) & ~(size_t)7;
+    if (!leaf) return (Shrimp_X86_64_Frame){.f = f, .frame_pointer = true, .size = size};
+    return (Shrimp_X86_64_Frame){.f = f, .size = size <= SHRIMP_X86_64_RED_ZONE ? 0 : size};
+}
+
+static void Shrimp_x86_64_nasm_temp_addr(const Shrimp_X86_64_Frame* frame, uint32_t temp, FILE* file) {
+    const Shrimp_Temp* t = Shrimp_function_temp(frame->f, temp);
+    if (frame->frame_pointer) {
+        fprintf(file, "[rbp - %u]", t->offset + t->size);
+        return;
+    }
+    // the top of the frame is where the return address is
+    int64_t disp = (int64_t)frame->size - t->offset - t->size;
+    fprintf(file, disp < 0 ? "[rsp - %ld]" : "[rsp + %ld]", disp < 0 ? -disp : disp);
+}
+
+// Where the param passed in the stack slot `index` is
+static void Shrimp_x86_64_nasm_stack_param_addr(const Shrimp_X86_64_Frame* frame, size_t index, FILE* file) {
+    if (frame->frame_pointer) fprintf(file, "[rbp + %zu]", 16 + 8 * index);
+    else fprintf(file, "[rsp + %zu]", frame->size + 8 + 8 * index);
+}
+
+static size_t Shrimp_x86_64_nasm_stack_arg_count(const Shrimp_Function* f) {
+    const char** regs;
+    size_t reg_count = Shrimp_x86_64_nasm_arg_regs(f, &regs);
+    return f->param_count > reg_count ? f->param_count - reg_count : 0;
+}
+
+static bool Shrimp_x86_64_nasm_is_tail_call(const Shrimp_Module* mod, const Shrimp_Function* f, uint32_t at) {
+    if (Shrimp_x86_64_nasm_is_entry(f) || !Shrimp_function_is_tail_call(f, at)) return false;
+    return Shrimp_x86_64_nasm_stack_arg_count(&mod->items[f->items[at].call.func]) <= Shrimp_x86_64_nasm_stack_arg_count(f);
+}
+
+// Stores as much of reg into the temp as the temp is big
+static void Shrimp_x86_64_nasm_store(const Shrimp_X86_64_Frame* frame, uint32_t temp, const char* reg, FILE* file) {
+    size_t size = Shrimp_function_temp(frame->f, temp)->size;
+    fprintf(file, "  mov %s ", Shrimp_x86_64_nasm_mem_op_prefix(size));
+    Shrimp_x86_64_nasm_temp_addr(frame, temp, file);
+    fprintf(file, ", %s\n", Shrimp_x86_64_nasm_sized_reg(reg, size));
+}
+
+static void Shrimp_x86_64_nasm_mov_value_to_reg(const Shrimp_X86_64_Frame* frame, Shrimp_Ref ref, const char* reg, FILE* out) {
+    if (SHRIMP_REF_IS_CONST(ref)) {
+        fprintf(out, "  mov %s, ", reg);
+        fprintf(out, "%lu\n", Shrimp_function_const(frame->f, ref));
+    } else {
+        const Shrimp_Temp* t = Shrimp_function_temp(frame->f, SHRIMP_REF_INDEX(ref));
+        // writing the 32 bit register clears the upper half, the 8 and 16 bit ones leave everything above alone
+        if (t->size < 4) fprintf(out, "  movzx %s, %s ", Shrimp_x86_64_nasm_sized_reg(reg, 4), Shrimp_x86_64_nasm_mem_op_prefix(t->size));
+        else fprintf(out, "  mov %s, ", Shrimp_x86_64_nasm_sized_reg(reg, t->size));
+        Shrimp_x86_64_nasm_temp_addr(frame, SHRIMP_REF_INDEX(ref), out);
+        fprintf(out, "\n");
+    }
+}
+
+// Whether the value is known to fit into 32 bits, narrowed temps get zero extended when they are loaded
+static bool Shrimp_x86_64_nasm_fits_32(const Shrimp_Function* func, Shrimp_Ref ref) {
+    if (SHRIMP_REF_IS_CONST(ref)) return Shrimp_function_const(func, ref) <= UINT32_MAX;
+    return Shrimp_function_temp(func, SHRIMP_REF_INDEX(ref))->size <= 4;
+}
+
+// Multiplies r10 by a constant, with lea for the factors it can do and a shift for the powers of two on top
+static void Shrimp_x86_64_nasm_mul_const(uint64_t c, FILE* file) {
+    uint32_t shift = 0;
+    uint64_t odd = c;
+    while (odd != 0 && (odd & 1) == 0) {
+        odd >>= 1;
+        shift++;
+    }
+    if (odd == 1 || odd == 3 || odd == 5 || odd == 9) {
+        if (odd != 1) fprintf(file, "  lea r10, [r10 + r10 * %lu]\n", odd - 1);
+        if (shift != 0) fprintf(file, "  shl r10, %u\n", shift);
+    } else if (c <= INT32_MAX) {
+        fprintf(file, "  imul r10, r10, %lu\n", c);
+    } else {
+        fprintf(file, "  mov r11, %lu\n", c);
+        fprintf(file, "  imul r10, r11\n");
+    }
+}
+
+// Instrumented builds count in one array per function, see shrimp_profile.c for what is in it
+static void Shrimp_x86_64_nasm_count(FILE* file, size_t func, size_t counter) {
+    fprintf(file, "  inc qword [rel shrimp_profile_%zu + %zu]\n", func, counter * 8);
+}
+
+// Writes the counters out before the process exits, the result is kept in rax
+static void Shrimp_x86_64_nasm_profile_write(FILE* file) {
+    fprintf(file, "  mov r12, rax\n");
+    // open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+    fprintf(file, "  mov rax, 2\n");
+    fprintf(file, "  lea rdi, [rel shrimp_profile_path]\n");
+    fprintf(file, "  mov rsi, 577\n");
+    fprintf(file, "  mov rdx, 420\n");
+    fprintf(file, "  syscall\n");
+    fprintf(file, "  test rax, rax\n");
+    fprintf(file, "  js .profile_done\n");
+    fprintf(file, "  mov rdi, rax\n");
+    fprintf(file, "  mov rax, 1\n");
+    fprintf(file, "  lea rsi, [rel shrimp_profile]\n");
+    fprintf(file, "  mov rdx, shrimp_profile_end - shrimp_profile\n");
+    fprintf(file, "  syscall\n");
+    fprintf(file, "  mov rax, 3\n");
+    fprintf(file, "  syscall\n");
+    fprintf(file, "  .profile_done:\n");
+    fprintf(file, "  mov rax, r12\n");
+}
+
+static void Shrimp_x86_64_nasm_profile_data(const Shrimp_Module* mod, FILE* file) {
+    fprintf(file, "section .data\n");
+    fprintf(file, "shrimp_profile:\n");
+    fprintf(file, "  db \"%s\"\n", SHRIMP_PROFILE_MAGIC);
+    fprintf(file, "  dq %zu\n", mod->count);
+    for (size_t i = 0; i < mod->count; i++) {
+        const Shrimp_Function* f = &mod->items[i];
+        size_t branches = Shrimp_profile_branch_count(f);
+        fprintf(file, "  dq %lu, %u, %zu\n", Shrimp_profile_checksum(f), f->label_count, branches);
+        fprintf(file, "shrimp_profile_%zu:\n", i);
+        fprintf(file, "  times %zu dq 0\n", (size_t)f->label_count + 1 + branches);
+    }
+    fprintf(file, "shrimp_profile_end:\n");
+    // as numbers so nothing in the path needs escaping
+    fprintf(file, "shrimp_profile_path:\n  db ");
+    for (const char* c = mod->profile_output; *c != '\0'; c++) fprintf(file, "%u, ", (unsigned char)*c);
+    fprintf(file, "0\n");
+}
+
+bool Shrimp_module_x86_64_dump_nasm_mod(const Shrimp_Module* mod, FILE* file) {
+    bool profile = mod->profile_output != NULL;
+    fprintf(file, "section .text\n");
+    for (size_t i = 0; i < mod->count; i++) {
+        const Shrimp_Function* f = &mod->items[i];
+        bool entry = Shrimp_x86_64_nasm_is_entry(f);
+        Shrimp_X86_64_Frame frame = Shrimp_x86_64_nasm_frame(f);
+        // every other name gets a `$` in front so nasm never takes it for a register or keyword
+        if (entry) fprintf(file, "global _start\n");
+        else if (f->exported) fprintf(file, "global $%s\n", f->name);
+        fprintf(file, entry ? "%s:\n" : "$%s:\n", f->name);
+        if (frame.frame_pointer) {
+            fprintf(file, "  push rbp\n");
+            fprintf(file, "  mov rbp, rsp\n");
+        }
+        if (frame.size != 0) fprintf(file, "  sub rsp, %zu\n", frame.size);
+        fprintf(file, "  .tail:\n");
+
+        if (entry) {
+            // store callee saved registers according to the x86_64 sysV AMD64 abi
+            fprintf(file, "  push rbx\n");
+            fprintf(file, "  push r12\n");
+            fprintf(file, "  push r13\n");
+            fprintf(file, "  push r14\n");
+            fprintf(file, "  push r15\n");
+        }
+        const char** regs;
+        size_t reg_count = Shrimp_x86_64_nasm_arg_regs(f, &regs);
+        for (uint32_t p = 0; p < f->param_count; p++) {
+            if (p < reg_count) {
+                Shrimp_x86_64_nasm_store(&frame, p, regs[p], file);
+                continue;
+            }
+            fprintf(file, "  mov rax, ");
+            Shrimp_x86_64_nasm_stack_param_addr(&frame, p - reg_count, file);
+            fprintf(file, "\n");
+            Shrimp_x86_64_nasm_store(&frame, p, "rax", file);
+        }
+        if (profile) Shrimp_x86_64_nasm_count(file, i, 0);
+
+        size_t branch = 0;
+        // the callee of the ARGs that come next, how many of them were passed already and whether it's a tail call
+        const Shrimp_Function* callee = NULL;
+        size_t args = 0;
+        bool tail = false;
+        for (size_t j = 0; j < f->count; j++) {
+            const Shrimp_Instr* instr = &f->items[j];
+            switch (instr->t) {
+                case SHRIMP_IT_ADD: {
+                    // both operands are read before the result is written, it may be one of them
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.l, "r10", file);
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.r, "r11", file);
+                    fprintf(file, "  add r10, r11\n");
+                    Shrimp_x86_64_nasm_store(&frame, instr->binop.result, "r10", file);
+                    break;
+                }
+                case SHRIMP_IT_SUB: {
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.l, "r10", file);
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.r, "r11", file);
+                    fprintf(file, "  sub r10, r11\n");
+                    Shrimp_x86_64_nasm_store(&frame, instr->binop.result, "r10", file);
+                    break;
+                }
+                case SHRIMP_IT_MUL: {
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.l, "r10", file);
+                    if (SHRIMP_REF_IS_CONST(instr->binop.r)) {
+                        Shrimp_x86_64_nasm_mul_const(Shrimp_function_const(f, instr->binop.r), file);
+                    } else {
+                        Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.r, "r11", file);
+                        fprintf(file, "  imul r10, r11\n");
+                    }
+                    Shrimp_x86_64_nasm_store(&frame, instr->binop.result, "r10", file);
+                    break;
+                }
+                case SHRIMP_IT_DIV: {
+                    // the values are unsigned
+                    fprintf(file, "  xor edx, edx\n");
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.l, "rax", file);
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.r, "r10", file);
+                    // the 32 bit division is a lot faster and gives the same result when both operands fit
+                    bool narrow = Shrimp_x86_64_nasm_fits_32(f, instr->binop.l) && Shrimp_x86_64_nasm_fits_32(f, instr->binop.r);
+                    fprintf(file, "  div %s\n", narrow ? "r10d" : "r10");
+
+                    Shrimp_x86_64_nasm_store(&frame, instr->binop.result, "rax", file);
+                    break;
+                }
+                case SHRIMP_IT_ASSIGN: {
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->assign.v, "r10", file);
+                    Shrimp_x86_64_nasm_store(&frame, instr->assign.into, "r10", file);
+                    break;
+                }
+                case SHRIMP_IT_RETURN: {
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->ret, "rax", file);
+                    fprintf(file, "  jmp .exit\n");
+                    break;
+                }
+                case SHRIMP_IT_LABEL: {
+                    fprintf(file, "  .%u:\n", instr->label);
+                    if (profile) Shrimp_x86_64_nasm_count(file, i, instr->label + 1);
+                    break;
+                }
+                case SHRIMP_IT_JUMP: {
+                    fprintf(file, "  jmp .%u\n", instr->jmp.to);
+                    break;
+                }
+                case SHRIMP_IT_JUMP_IF_NOT: case SHRIMP_IT_JUMP_IF: {
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->jmp_if_not.cond, "r10", file);
+                    fprintf(file, "  cmp r10, 0\n");
+                    if (profile) {
+                        // only the taken side is counted, what didn't jump is known from what reached the jump
+                        fprintf(file, "  %s .not_taken_%zu\n", instr->t == SHRIMP_IT_JUMP_IF ? "jz" : "jnz", branch);
+                        Shrimp_x86_64_nasm_count(file, i, f->label_count + 1 + branch);
+                        fprintf(file, "  jmp .%u\n", instr->jmp_if_not.to);
+                        fprintf(file, "  .not_taken_%zu:\n", branch++);
+                        break;
+                    }
+                    fprintf(file, "  %s .%u\n", instr->t == SHRIMP_IT_JUMP_IF ? "jnz" : "jz", instr->jmp_if_not.to);
+                    break;
+                }
+                case SHRIMP_IT_NOP: break;
+                case SHRIMP_IT_ARG: {
+                    // the call comes right after its ARGs, it decides where they go
+                    if (args == 0) {
+                        size_t at = j;
+                        while (f->items[at].t != SHRIMP_IT_CALL) at++;
+                        callee = &mod->items[f->items[at].call.func];
+                        tail = Shrimp_x86_64_nasm_is_tail_call(mod, f, at);
+                    }
+                    const char** callee_regs;
+                    size_t callee_reg_count = Shrimp_x86_64_nasm_arg_regs(callee, &callee_regs);
+                    // loading a value touches no other register, so the ones already passed stay as they are
+                    if (args < callee_reg_count) {
+                        Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->arg, callee_regs[args], file);
+                    } else if (tail) {
+                        Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->arg, "rax", file);
+                        fprintf(file, "  mov ");
+                        Shrimp_x86_64_nasm_stack_param_addr(&frame, args - callee_reg_count, file);
+                        fprintf(file, ", rax\n");
+                    } else {
+                        // the stack slots are reserved all at once so the first one ends up lowest
+                        if (args == callee_reg_count) fprintf(file, "  sub rsp, %zu\n", 8 * (callee->param_count - callee_reg_count));
+                        Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->arg, "rax", file);
+                        fprintf(file, "  mov [rsp + %zu], rax\n", 8 * (args - callee_reg_count));
+                    }
+                    args++;
+                    break;
+                }
+                case SHRIMP_IT_CALL: {
+                    const Shrimp_Function* target = &mod->items[instr->call.func];
+                    const char** target_regs;
+                    size_t target_reg_count = Shrimp_x86_64_nasm_arg_regs(target, &target_regs);
+                    args = 0;
+                    if (Shrimp_x86_64_nasm_is_tail_call(mod, f, j)) {
+                        if (target == f) {
+                            fprintf(file, "  jmp .tail\n");
+                            break;
+                        }
+                        // only functions that call have a frame pointer
+                        fprintf(file, "  mov rsp, rbp\n");
+                        fprintf(file, "  pop rbp\n");
+                        fprintf(file, "  jmp $%s\n", target->name);
+                        break;
+                    }
+                    if (!Shrimp_x86_64_nasm_is_entry(f) && Shrimp_function_is_tail_call(f, j)) {
+                        fprintf(stderr, "[WARNING]: The call to %s in function %s isn't made a tail call, it needs %zu stack slots for its arguments and %s only got %zu\n",
+                                target->name, f->name, Shrimp_x86_64_nasm_stack_arg_count(target), f->name, Shrimp_x86_64_nasm_stack_arg_count(f));
+                    }
+                    fprintf(file, "  call $%s\n", target->name);
+                    if (instr->call.argc > target_reg_count) fprintf(file, "  add rsp, %zu\n", 8 * (instr->call.argc - target_reg_count));
+                    Shrimp_x86_64_nasm_store(&frame, instr->call.result, "rax", file);
+                    break;
+                }
+                case SHRIMP_IT_SHL: case SHRIMP_IT_SHR: {
+                    const char* op = instr->t == SHRIMP_IT_SHL ? "shl" : "shr";
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.l, "r10", file);
+                    if (SHRIMP_REF_IS_CONST(instr->binop.r)) {
+                        fprintf(file, "  %s r10, %lu\n", op, Shrimp_function_const(f, instr->binop.r) & 63);
+                    } else {
+                        Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.r, "rcx", file);
+                        fprintf(file, "  %s r10, cl\n", op);
+                    }
+                    Shrimp_x86_64_nasm_store(&frame, instr->binop.result, "r10", file);
+                    break;
+                }
+                case SHRIMP_IT_MULHU: {
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.l, "rax", file);
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.r, "r10", file);
+                    fprintf(file, "  mul r10\n");
+                    Shrimp_x86_64_nasm_store(&frame, instr->binop.result, "rdx", file);
+                    break;
+                }
+                // TODO: I remember a way to make this more concise
+                case SHRIMP_IT_CMP_LT: {
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.l, "r10", file);
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.r, "r11", file);
+
+                    // the operands are compared whole, only the result may be narrower
+                    fprintf(file, "  cmp r10, r11\n");
+                    fprintf(file, "  mov r10, 0\n");
+                    fprintf(file, "  mov r11, 1\n");
+                    fprintf(file, "  cmovb r10, r11\n");
+                    Shrimp_x86_64_nasm_store(&frame, instr->binop.result, "r10", file);
+                    break;
+                }
+                case SHRIMP_IT_CMP_MT: {
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.l, "r10", file);
+                    Shrimp_x86_64_nasm_mov_value_to_reg(&frame, instr->binop.r, "r11", file);
+
+                    // the operands are compared whole, only the result may be narrower
+                    fprintf(file, "  cmp r10, r11\n");
+                    fprintf(file, "  mov r10, 0\n");
+                    fprintf(file, "  mov r11, 1\n");
+                    fprintf(file, "  cmova r10, r11\n");
+                    Shrimp_x86_64_nasm_store(&frame, instr->binop.result, "r10", file);
+                    break;
+                }
+            }
+        }
+        fprintf(file, "  .exit:\n");
+        if (!entry) {
+            if (frame.frame_pointer) {
+                fprintf(file, "  mov rsp, rbp\n");
+                fprintf(file, "  pop rbp\n");
+            } else if (frame.size != 0) {
+                fprintf(file, "  add rsp, %zu\n", frame.size);
+            }
+            fprintf(file, "  ret\n");
+            continue;
+        }
+        if (profile) Shrimp_x86_64_nasm_profile_write(file);
+
+        fprintf(file, "  pop r15\n");
+        fprintf(file, "  pop r14\n");
+        fprintf(file, "  pop r13\n");
+        fprintf(file, "  pop r12\n");
+        fprintf(file, "  pop rbx\n");
+
+        fprintf(file, "  mov rsp, rbp\n");
+        fprintf(file, "  pop rbp\n");
+        fprintf(file, "  mov rdi, rax\n");
+        fprintf(file, "  mov rax, 60\n");
+        fprintf(file, "  syscall\n");
+    }
+    if (profile) Shrimp_x86_64_nasm_profile_data(mod, file);
+    return true;
+}